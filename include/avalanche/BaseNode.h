@@ -5,12 +5,14 @@
 #include <vector>
 
 #include "avalanche/MultiArray.h"
+#include "avalanche/CodeCache.h"
 
 namespace avalanche {
 
 struct BaseNode;
 class Context;
 class ExecutionCache;
+class FusedElementWise;
 
 using NodeId = std::size_t;
 using NodeRef = std::shared_ptr<BaseNode>;
@@ -21,10 +23,91 @@ class BaseNode {
 public:
     const NodeId id;
 
-    BaseNode() :id{new_global_id()}, _shape{}, _dtype{ArrayType::float32} {}
+    BaseNode()
+        :id{new_global_id()}, _shape{}, _dtype{ArrayType::float32},
+         _has_device_placement{false}, _device_placement{0} {}
 
     virtual MultiArrayRef eval(Context &context, ExecutionCache &cache) const = 0;
 
+    /**
+     * Calculates the value of the node from already evaluated values
+     * of its inputs (in the same order as `inputs()` lists them).
+     * Unlike `eval`, never evaluates anything recursively and doesn't use
+     * the cache for storing results. This is what `ExecutionPlan` calls
+     * while running the graph as a flat list of instructions.
+     * Lazy inputs the node has decided not to evaluate during the run
+     * (see `lazy_inputs_to_evaluate`) are passed as nullptr.
+     */
+    virtual MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                                  const ArrayRefList &input_values) const;
+
+    /**
+     * Nodes with the same non-empty key run the same kernel, so `ExecutionPlan`
+     * can evaluate several independent ones of them at once, by calling
+     * `forward_batch` of any one of them.
+     */
+    virtual std::string batch_key() const { return ""; }
+
+    /**
+     * Like `forward`, but for a whole group of nodes sharing the same
+     * `batch_key`, using a single kernel launch.
+     * @param input_values values of the inputs of each node of the group
+     * @returns values of the nodes, in the same order
+     */
+    virtual ArrayRefList forward_batch(
+        Context &context, ExecutionCache &cache,
+        const std::vector<ArrayRefList> &input_values) const;
+
+    /**
+     * How many first inputs (as listed by `inputs()`) must always be evaluated
+     * before the node itself. The rest are lazy: they get evaluated
+     * only if `lazy_inputs_to_evaluate` asks for them.
+     */
+    virtual std::size_t num_eager_inputs() const { return inputs().size(); }
+
+    /**
+     * Given the values of the eager inputs, returns indices of the lazy
+     * inputs the node really needs to calculate its value during this run.
+     */
+    virtual std::vector<std::size_t> lazy_inputs_to_evaluate(
+            Context &context, const ArrayRefList &eager_values) const {
+        return {};
+    }
+
+    /**
+     * Nodes with the same non-empty key, data type and inputs always
+     * calculate the same value, so `ExecutionPlan` evaluates only one
+     * of them. By default, only pure element-wise nodes have the key,
+     * since their `elementwise_code` describes them completely.
+     */
+    virtual std::string structure_key() const;
+
+    /**
+     * Whether the value of the node depends on nothing but the values
+     * of its inputs (unlike the values of variables or random generators).
+     * If all inputs of such node are constant, the node is constant too,
+     * so `ExecutionPlan` can calculate it just once.
+     */
+    virtual bool is_pure() const { return true; }
+
+    /**
+     * Index of the input which value the node always returns unchanged
+     * (like multiplication by ones, or reshaping into the same shape),
+     * so `ExecutionPlan` can use the input directly instead. -1 if there's
+     * no such input, or if it cannot be proven from the static shapes.
+     */
+    virtual int passthrough_input() const { return -1; }
+
+    /**
+     * Like `passthrough_input`, but for nodes choosing the input they return
+     * by the values of their eager inputs (like `Cond`). `ExecutionPlan` asks
+     * only when those values can never change (see `freeze`).
+     */
+    virtual int passthrough_input_given(
+            Context &context, const ArrayRefList &eager_values) const {
+        return -1;
+    }
+
     /**
      * Calculates derivative of a target node with respect to one
      * of the current node's inputs using the chain rule
@@ -46,6 +129,48 @@ public:
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const = 0;
 
+    /**
+     * Adds all OpenCL programs the node compiles during evaluation
+     * on the device to the list, so they can be compiled in advance
+     * (see `Executor::warm_up`).
+     */
+    virtual void collect_programs(const cl::Device &device,
+                                  ProgramSourceList &programs) const {}
+
+    /**
+     * OpenCL code calculating one element of the node into `output_var`
+     * from the corresponding (broadcast) elements of its inputs, named
+     * `input_vars`. Empty for nodes which cannot become a part
+     * of a fused kernel (see `FusedElementWise`).
+     */
+    virtual std::string elementwise_code(
+            const std::vector<std::string> &input_vars,
+            const std::string &output_var) const {
+        return "";
+    }
+
+    /**
+     * Whether the node can take a chain of element-wise operations
+     * (see `FusedElementWise`) calculating its only input, and compute
+     * the elements of the input right when reading them
+     * (see `forward_with_prologue`).
+     */
+    virtual bool accepts_elementwise_prologue() const { return false; }
+
+    /**
+     * Like `forward`, but instead of the value of the only input gets
+     * the values of the inputs of the `prologue` calculating it.
+     */
+    virtual MultiArrayRef forward_with_prologue(
+        Context &context, ExecutionCache &cache,
+        const FusedElementWise &prologue,
+        const ArrayRefList &input_values) const;
+
+    /** Like `collect_programs`, but for `forward_with_prologue` */
+    virtual void collect_programs_with_prologue(
+        const cl::Device &device, const FusedElementWise &prologue,
+        ProgramSourceList &programs) const {}
+
     virtual std::string to_string() const = 0;
     virtual std::string repr() const = 0;
 
@@ -67,6 +192,19 @@ public:
      */
     const Shape& shape() const { return _shape; }
     ArrayType dtype() const { return _dtype; }
+
+    /**
+     * Asks the Executor to calculate the node on a particular device
+     * (by its index in the memory manager), instead of the default device
+     * of the context or the device of the inputs. Values of the inputs
+     * living on other devices get transferred there automatically.
+     */
+    void place_on_device(DeviceIndex device_idx) {
+        _device_placement = device_idx;
+        _has_device_placement = true;
+    }
+    bool has_device_placement() const { return _has_device_placement; }
+    DeviceIndex device_placement() const { return _device_placement; }
     std::string format_repr(const std::string &operation,
                             const std::string &name,
                             const std::string &extra) const;
@@ -76,6 +214,8 @@ public:
 private:
     Shape _shape;
     ArrayType _dtype;
+    bool _has_device_placement;
+    DeviceIndex _device_placement;
 
     static NodeId new_global_id() {
         static NodeId counter = 0;
@@ -0,0 +1,92 @@
+#ifndef AVALANCHE_BUFFERARENA_H
+#define AVALANCHE_BUFFERARENA_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CL_cust/cl2.hpp"
+
+#include "avalanche/CLBufferPool.h"
+
+namespace avalanche {
+
+class CLBuffer;
+
+/**
+ * One large OpenCL buffer split into blocks with fixed offsets,
+ * planned in advance (see `ExecutionPlan`). Each block is exposed as
+ * an OpenCL sub-buffer, so the kernels don't even know they're using
+ * the arena.
+ *
+ * The blocks of values which never live at the same time can share the same
+ * memory. So a block is handed out only when none of the blocks it overlaps
+ * with is in use, which means the `CLBuffer` of its previous occupant
+ * has been destroyed (and that happens only after all kernels using
+ * the buffer are done).
+ */
+class BufferArena : public std::enable_shared_from_this<BufferArena> {
+public:
+    struct Block {
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    static std::shared_ptr<BufferArena> make(const BufferPoolRef &pool,
+                                             const std::vector<Block> &blocks);
+
+    /**
+     * Returns a buffer occupying the block, or nullptr if the block
+     * (or any other block overlapping with it) is still in use.
+     */
+    std::shared_ptr<CLBuffer> acquire(std::size_t block_index);
+
+    std::size_t byte_size() const { return _byte_size; }
+    std::size_t num_blocks() const { return _blocks.size(); }
+    const BufferPoolRef& pool() const { return _pool; }
+
+    /**
+     * Returns the block the current thread has been offered (see `ArenaOffer`)
+     * if the requested size matches it exactly and the block is available.
+     * Otherwise returns nullptr. Any offer can be taken only once.
+     */
+    static std::shared_ptr<CLBuffer> take_offered_block(
+        const CLBufferPool *pool, std::size_t size_in_bytes);
+
+private:
+    BufferPoolRef _pool;
+    cl::Buffer _arena_buffer;
+    std::size_t _byte_size;
+    std::vector<Block> _blocks;
+    std::vector<cl::Buffer> _sub_buffers;
+    // For each block: all other blocks sharing at least one byte with it
+    std::vector<std::vector<std::size_t>> _overlapping_blocks;
+    std::vector<char> _in_use;
+    std::mutex _mutex;
+
+    BufferArena(const BufferPoolRef &pool, const std::vector<Block> &blocks);
+
+    friend class CLBuffer;
+    void release(std::size_t block_index);
+};
+
+using BufferArenaRef = std::shared_ptr<BufferArena>;
+
+
+/**
+ * While alive, makes the next request for a buffer of exactly the size
+ * of the block, made by the current thread through `CLBufferPool`,
+ * to be served from the arena. This is how the Executor places outputs of
+ * the operations into the arena without them knowing about it.
+ */
+class ArenaOffer {
+public:
+    ArenaOffer(BufferArena *arena, std::size_t block_index);
+    ~ArenaOffer();
+    ArenaOffer(const ArenaOffer&) = delete;
+    ArenaOffer& operator=(const ArenaOffer&) = delete;
+};
+
+} // namespace
+
+#endif //AVALANCHE_BUFFERARENA_H
@@ -8,6 +8,7 @@
 namespace avalanche {
 
 class CLBufferPool;
+class BufferArena;
 
 /**
  * This class is not thread-safe!
@@ -15,6 +16,7 @@ class CLBufferPool;
 class CLBuffer {
 public:
     friend class CLBufferPool;
+    friend class BufferArena;
     ~CLBuffer();
     std::size_t device_index() const;
     std::size_t byte_size() const { return _size; }
@@ -108,6 +110,10 @@ private:
     std::promise<void> _ready_promise;
     std::shared_future<void> _is_ready;
     std::string _label;
+    // Set only for buffers occupying a block of an arena, which get returned
+    // there instead of the pool
+    std::shared_ptr<BufferArena> _arena;
+    std::size_t _arena_block;
 
     CLBuffer(const std::shared_ptr<CLBufferPool> &pool,
              cl::Buffer&& _cl_buffer,
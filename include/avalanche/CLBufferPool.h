@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <mutex>
+#include <map>
+#include <string>
 #include <array>
 
 #include "CL_cust/cl2.hpp"
@@ -27,7 +29,7 @@ public:
     CLBufferPool(CLMemoryManager* memory_manager,
                  std::size_t device_index,
                  const cl::Context &context,
-                 const cl::CommandQueue &device_queue);
+                 const std::vector<cl::CommandQueue> &device_queues);
     ~CLBufferPool();
 
     bool is_linked_with_device(const cl::Device &device) const;
@@ -40,24 +42,62 @@ public:
     std::shared_ptr<CLBuffer> reserve_buffer_for_vector(Vector v) {
         return reserve_buffer(sizeof(typename Vector::value_type) * v.size());
     }
+    /**
+     * Small read-only data kernels need besides their arrays, like shapes,
+     * strides and size masks. The same data gets uploaded only once
+     * and then stays on the device, so operations running again and again
+     * on arrays of the same shapes upload nothing and never wait for
+     * the host. The kernels reading the buffer must wait for `is_uploaded`.
+     */
+    struct ConstantData {
+        cl::Buffer buffer;
+        cl::Event is_uploaded;
+    };
+    // Beyond that the data is dropped and uploaded again when necessary
+    static constexpr std::size_t MaxConstantData = 4096;
+    ConstantData constant_data(const void *data, std::size_t size_in_bytes);
+    template <typename Vector>
+    ConstantData constant_data_for_vector(const Vector &v) {
+        return constant_data(
+            v.data(), sizeof(typename Vector::value_type) * v.size());
+    }
+    std::size_t num_constant_data() const;
     static long find_mem_slot(size_t size);
     std::size_t num_available_blocks() const;
     std::size_t num_buckets() const;
     std::size_t device_index() { return _device_index; }
-    cl::CommandQueue& cl_queue() { return _device_queue; }
-    const cl::CommandQueue& cl_queue() const { return _device_queue; }
+    /**
+     * The queue operations should enqueue their commands into.
+     * It's the first queue of the pool, unless the current thread
+     * has selected another one with `QueueSelection`.
+     */
+    cl::CommandQueue& cl_queue();
+    const cl::CommandQueue& cl_queue() const;
+    cl::CommandQueue& cl_queue(std::size_t queue_index) {
+        return _device_queues.at(queue_index);
+    }
+    std::size_t num_queues() const { return _device_queues.size(); }
+    /** Submits everything enqueued so far into any queue of the pool */
+    void flush_all_queues();
     cl::Context& cl_context() { return _cl_context; }
+    const cl::Device& cl_device() const { return _cl_device; }
     std::shared_ptr<CLBufferPool> own_reference();
+    CLMemoryManager* memory_manager() const { return _memory_manager; }
     bool queue_support_ooo_execution() const;
 
 private:
     CLMemoryManager *_memory_manager;
     std::size_t _device_index;
     cl::Context _cl_context;
-    cl::CommandQueue _device_queue;
+    std::vector<cl::CommandQueue> _device_queues;
     const cl::Device _cl_device;
     std::array<std::vector<cl::Buffer>, MaxBuckets> _buckets;
     std::array<std::mutex, MaxBuckets> _buckets_mutex;
+    // The keys are the data themselves, being uploaded from there
+    std::map<std::string, ConstantData> _constant_data;
+    mutable std::mutex _constant_data_mutex;
+
+    void wait_for_constant_data_uploads();
 
     friend class CLBuffer;
     void return_buffer(cl::Buffer &&cl_buffer, long bucket_idx);
@@ -66,6 +106,27 @@ private:
 
 using BufferPoolRef = std::shared_ptr<CLBufferPool>;
 
+
+/**
+ * While alive, makes `CLBufferPool::cl_queue()` return the queue with
+ * the given index for all requests made from the current thread.
+ * This is how the Executor spreads independent parts of the graph across
+ * multiple queues, without operations knowing anything about it.
+ * Dependencies between the queues are expressed via completion events
+ * of the buffers, as usual.
+ */
+class QueueSelection {
+public:
+    QueueSelection(const CLBufferPool *pool, std::size_t queue_index);
+    ~QueueSelection();
+    QueueSelection(const QueueSelection&) = delete;
+    QueueSelection& operator=(const QueueSelection&) = delete;
+
+private:
+    const CLBufferPool *_previous_pool;
+    std::size_t _previous_queue_index;
+};
+
 } // namespace
 
 #endif //AVALANCHE_CLBUFFERPOOL_H
@@ -23,10 +23,15 @@ class CLMemoryManager {
      * The manager should track buffers for all devices.
      */
 public:
+    // Several queues let independent branches of a graph run concurrently
+    // even on drivers ignoring out-of-order execution mode
+    static constexpr std::size_t DefaultQueuesPerDevice = 4;
+
     CLMemoryManager() :_device_counter{0} {}
     ~CLMemoryManager();
     void init_for_all_gpus();
-    void init_for_all(cl_device_type device_type);
+    void init_for_all(cl_device_type device_type,
+                      std::size_t queues_per_device=DefaultQueuesPerDevice);
     BufferPoolRef buffer_pool(DeviceIndex idx);
     std::size_t num_devices() const;
     const DeviceInfo& device_info(DeviceIndex idx) const;
@@ -1,24 +1,65 @@
 #ifndef AVALANCHE_PROGRAMCACHE_H
 #define AVALANCHE_PROGRAMCACHE_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <map>
 
 #include "CL_cust/cl2.hpp"
 
 namespace avalanche {
 
-using BinaryCacheKey = std::tuple<std::string, std::string>;
+// Device name, program name, build options and a hash of the source
+using BinaryCacheKey = std::tuple<std::string, std::string, std::string,
+                                  std::uint64_t>;
 using BinaryCache = std::map<BinaryCacheKey, std::vector<char>>;
 using ProgramCacheKey = std::tuple<
     const cl_context,
     const cl_device_id,
+    const std::string,
     const std::string>;
-using ProgramCache = std::map<ProgramCacheKey, cl::Program>;
+// Programs being compiled by one thread can be awaited by the others
+using ProgramCache = std::map<ProgramCacheKey, std::shared_future<cl::Program>>;
+using KernelCacheKey = std::tuple<
+    const cl_program,
+    const std::string,
+    const cl_command_queue>;
+using KernelCache = std::map<KernelCacheKey, cl::Kernel>;
+
+/** Everything necessary to compile an OpenCL program in advance */
+struct ProgramSource {
+    std::string name;
+    std::string source;
+    std::string options;
+};
+
+using ProgramSourceList = std::vector<ProgramSource>;
 
+/**
+ * Compiles OpenCL programs and keeps them, so each program gets compiled
+ * only once per device.
+ *
+ * Compiled binaries are also stored on disk (see `set_cache_directory`),
+ * so the next processes don't have to compile anything at all.
+ * Each binary is keyed by the device name, the driver version,
+ * the build options and the source of the program. Any change in those
+ * makes the old binary ignored, and so does a binary the driver refuses
+ * to load.
+ *
+ * The class is thread-safe. Different programs can be compiled
+ * by several threads at the same time, and a thread asking for a program
+ * another thread is compiling just waits for the result.
+ */
 class CodeCache {
 public:
+    CodeCache();
+
     cl::Program get_program(const cl::Context &context,
                             const cl::Device &device,
                             const std::string &program_name,
@@ -31,13 +72,85 @@ public:
                             const std::string &source,
                             const std::string &extra_options);
 
+    /**
+     * Programs are identified by their names and build options alone,
+     * so generating a long source just to find an already built program
+     * is a waste. These versions call `make_source` only if the program
+     * hasn't been built (or isn't being built) yet.
+     */
+    using SourceGenerator = std::function<std::string()>;
+
+    cl::Program get_program(const cl::Context &context,
+                            const cl::Device &device,
+                            const std::string &program_name,
+                            const SourceGenerator &make_source,
+                            const std::string &extra_options);
+
+    cl::Program get_program(const cl::Context &context,
+                            const cl::CommandQueue &queue,
+                            const std::string &program_name,
+                            const SourceGenerator &make_source,
+                            const std::string &extra_options);
+
+    /**
+     * Returns a kernel from the program, ready to be launched. Kernels are
+     * created only once and then reused, each thread and queue getting
+     * its own instance, since setting the arguments is not thread-safe.
+     * The kernels of a thread are kept in thread-local storage, so they
+     * (and the programs they hold) are released when the thread ends.
+     */
+    cl::Kernel get_kernel(const cl::Program &program,
+                          const std::string &kernel_name,
+                          const cl::CommandQueue &queue);
+
+    /**
+     * Compiles all given programs for the device (skipping those compiled
+     * already), using up to `num_threads` threads at the same time.
+     * Zero means as many threads as the hardware supports.
+     * After that `get_program` returns them without any delay.
+     */
+    void precompile(const cl::Context &context,
+                    const cl::Device &device,
+                    const ProgramSourceList &programs,
+                    std::size_t num_threads = 0);
+
     static CodeCache& get_default();
 
+    /**
+     * Sets the directory for compiled binaries (created if necessary).
+     * Empty path disables the on-disk cache. By default it's taken from
+     * AVALANCHE_KERNEL_CACHE_DIR environment variable, falling back to
+     * `$XDG_CACHE_HOME/avalanche/kernels` or `~/.cache/avalanche/kernels`.
+     */
+    void set_cache_directory(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cache_directory_ = path;
+    }
+    std::string cache_directory() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cache_directory_;
+    }
+
+    /** How many programs have been loaded from the on-disk cache */
+    std::size_t num_loaded_from_disk() const { return num_loaded_from_disk_; }
+
 private:
+    // Guards everything except the kernels
+    mutable std::mutex mutex_;
+    std::string cache_directory_;
+    std::atomic<std::size_t> num_loaded_from_disk_;
     // Stores all binaries in a map using CL_DEVICE_NAME`s value as a key
     BinaryCache binary_cache_;
     // Stores all programs in a map using both cl_context and cl_device_id as keys
     ProgramCache program_cache_;
+    // Identifies the kernels of this cache in the thread-local storage
+    const std::uint64_t id_;
+
+    cl::Program build_program(const cl::Context &context,
+                              const cl::Device &device,
+                              const std::string &program_name,
+                              const std::string &source,
+                              const std::string &program_options);
 };
 
 
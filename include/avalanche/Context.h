@@ -25,7 +25,9 @@ using ContextRef = std::shared_ptr<Context>;
  * And it doesn't store various temporary data during the computation
  * (this is done by `ExecutionCache`).
  *
- * Each Context is strictly associated with only one GPU.
+ * Each Context is associated with one GPU, its default device. Nodes placed
+ * on other devices of the same memory manager (see
+ * `BaseNode::place_on_device`) keep their data on those devices instead.
  */
 class Context : private std::map<NodeId, MultiArrayRef> {
 public:
@@ -70,7 +72,16 @@ public:
     // Works like get() but throws exception if the node wasn't found
     MultiArrayRef eval(const NodeRef &node) const;
 
-    BufferPoolRef device_pool() { return _buffer_pool; };
+    /**
+     * The pool new arrays should be allocated from: the default device
+     * of the context, unless a `DevicePlacement` is in effect.
+     */
+    BufferPoolRef device_pool() {
+        return _placement_pool ? _placement_pool : _buffer_pool;
+    };
+
+    /** The pool of another device managed by the same memory manager */
+    BufferPoolRef device_pool(DeviceIndex device_idx);
 
     static ContextRef make(BufferPoolRef buffer_pool) {
         return std::shared_ptr<Context>(new Context(buffer_pool));
@@ -84,17 +95,37 @@ public:
 
 private:
     BufferPoolRef _buffer_pool;
+    BufferPoolRef _placement_pool;
 
     Context(BufferPoolRef buffer_pool)
         :std::map<NodeId, MultiArrayRef>(),
          _buffer_pool{buffer_pool}{}
 
+    friend class DevicePlacement;
+
     void check_multi_array_compatibility(const MultiArrayRef &array) const;
     void check_data_shape_compatibility(const Shape &data_shape,
                                         const Shape &node_shape) const;
 };
 
 
+/**
+ * While alive, makes the context allocate all new arrays
+ * (see `Context::device_pool()`) on the given device.
+ */
+class DevicePlacement {
+public:
+    DevicePlacement(Context &context, const BufferPoolRef &pool);
+    ~DevicePlacement();
+    DevicePlacement(const DevicePlacement&) = delete;
+    DevicePlacement& operator=(const DevicePlacement&) = delete;
+
+private:
+    Context &_context;
+    BufferPoolRef _previous_pool;
+};
+
+
 } // namespace
 
 
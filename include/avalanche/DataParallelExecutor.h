@@ -0,0 +1,98 @@
+#ifndef AVALANCHE_DATAPARALLELEXECUTOR_H
+#define AVALANCHE_DATAPARALLELEXECUTOR_H
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "avalanche/Context.h"
+#include "avalanche/Executor.h"
+#include "avalanche/BaseNode.h"
+
+namespace avalanche {
+
+/**
+ * Trains the same model on several devices at once (data parallelism).
+ *
+ * Each device gets its own `Context` and evaluates a replica of the graph
+ * on its own part of the batch: the batch values given to `run` are split
+ * along the first dimension into nearly equal parts, one per replica.
+ * All other values (a learning rate, a learning phase flag, a fixed mask)
+ * are given unchanged to every replica.
+ *
+ * The update nodes (`Update`, `UpdateAdd`, `UpdateSub`) aren't applied
+ * right away. Instead, the steps they would apply (usually the gradients
+ * multiplied by the learning rate) are collected from all replicas,
+ * averaged on the device of the first replica, and only then applied
+ * to the variables of every replica. So the variables stay identical
+ * everywhere, and if the steps are calculated from a loss averaged over
+ * the batch, the result is the same as for the whole batch
+ * on a single device (up to the difference between the sizes of the parts).
+ *
+ * Replicas may share the same device, each still gets its own copy
+ * of the variables.
+ */
+class DataParallelExecutor {
+public:
+    /**
+     * @param contexts one context for each replica. The variables
+     *    of the first one are copied into the others before the first run.
+     * @param result_nodes nodes evaluated by every replica
+     * @param updates update nodes, applied with the averaged steps
+     * @param batch_inputs placeholders (or other nodes) receiving the batch.
+     *    If empty, the batch is every value of rank 1 or higher
+     *    whose first dimension is the largest among them.
+     */
+    DataParallelExecutor(const std::vector<ContextRef> &contexts,
+                         const NodeRefList &result_nodes,
+                         const NodeRefList &updates,
+                         const NodeRefList &batch_inputs = NodeRefList());
+
+    /**
+     * Runs all replicas on their parts of the batch, then applies
+     * the averaged updates.
+     * @param batch_values values for the placeholders (or other nodes).
+     *    The batch values are split between the replicas, the rest
+     *    are shared by all of them.
+     * @return the results of every replica, in the order of the contexts
+     */
+    std::vector<ArrayRefList> run(const NodeValueMap &batch_values);
+
+    /**
+     * Copies the current values of all updated variables from the first
+     * replica to all the others. Happens automatically before the first run.
+     */
+    void synchronize_variables();
+
+    std::size_t num_replicas() const { return _contexts.size(); }
+
+    const ContextRef& context(std::size_t replica) const {
+        return _contexts.at(replica);
+    }
+
+private:
+    std::vector<ContextRef> _contexts;
+    const NodeRefList _result_nodes;
+    std::set<NodeId> _batch_inputs;
+    // The left and the right inputs of the update nodes (without duplicates)
+    NodeRefList _updated_variables;
+    NodeRefList _update_steps;
+    // Calculate results and update steps for each replica
+    std::vector<std::unique_ptr<Executor>> _forward_executors;
+    // Apply the averaged update steps for each replica
+    std::vector<std::unique_ptr<Executor>> _update_executors;
+    // For each update step: placeholders receiving its values
+    // from each of the replicas
+    std::vector<NodeRefList> _gathered_steps;
+    // Runs on the first replica, averaging the steps
+    std::unique_ptr<Executor> _averaging_executor;
+    bool _variables_are_synchronized;
+
+    ArrayRefList split_batch(const MultiArrayRef &batch_value) const;
+    bool is_batch_value(const NodeValueMap::value_type &item,
+                        ShapeDim batch_size) const;
+};
+
+} // namespace
+
+#endif //AVALANCHE_DATAPARALLELEXECUTOR_H
@@ -0,0 +1,246 @@
+#ifndef AVALANCHE_EXECUTIONPLAN_H
+#define AVALANCHE_EXECUTIONPLAN_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "avalanche/BaseNode.h"
+#include "avalanche/BufferArena.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+
+namespace avalanche {
+
+/** A single step of an `ExecutionPlan`: evaluation of one node */
+struct PlanInstruction {
+    // The plan keeps all its nodes alive, so a raw pointer is enough
+    const BaseNode *node;
+    // Slots of the node's inputs, in the same order as `inputs()` lists them
+    std::vector<std::size_t> input_slots;
+    std::size_t num_eager_inputs;
+    // For each input (only lazy inputs have them non-empty):
+    // instructions that must be executed before the input can be used
+    std::vector<std::vector<std::size_t>> lazy_sequences;
+    // Slots from the main sequence the lazy sequences read from
+    std::vector<std::size_t> lazy_dependencies;
+    // Slots which values are not needed anymore once the instruction is done
+    std::vector<std::size_t> slots_to_release;
+    // Independent chain of instructions the instruction belongs to.
+    // Each chain is enqueued into its own queue of the pool (as long as
+    // there are enough queues).
+    std::size_t chain;
+    // Set if some consumers belong to other chains, and so they
+    // shouldn't wait until the queue gets flushed on its own
+    bool flush_queue_after;
+    // Storage for the values of the inputs, reused between the runs
+    ArrayRefList input_values;
+    // Non-empty for instructions evaluating a batch of independent nodes
+    // at once (see `BaseNode::forward_batch`): the slots of all those nodes.
+    // `input_slots` then lists the inputs of each of them, one after another.
+    std::vector<std::size_t> batched_slots;
+};
+
+
+/** Optimizations applied to the graph while building an `ExecutionPlan` */
+struct PlanOptions {
+    // Nodes returning one of their inputs unchanged (see
+    // `BaseNode::passthrough_input`) are skipped
+    bool skip_passthrough_nodes = true;
+    // Structurally identical nodes (see `BaseNode::structure_key`)
+    // are evaluated only once
+    bool merge_duplicates = true;
+    // Parts of the graph depending only on constants are calculated once
+    // and replaced with constants keeping their values in the Context
+    bool fold_constants = true;
+    // Chains of element-wise operations become single kernels
+    // (see `FusedElementWise`)
+    bool fuse_elementwise = true;
+    // Independent small operations of the same kind get launched together
+    bool batch_small_launches = true;
+};
+
+
+/**
+ * The computational graph "compiled" into a flat list of instructions.
+ *
+ * All nodes necessary to calculate the outputs get sorted topologically
+ * once, during construction, and every node gets its own dense slot index.
+ * The values of the nodes are kept in a plain vector indexed by those slots,
+ * and each value gets released right after its last consumer is done.
+ * So running the plan requires neither recursion nor cache lookups.
+ *
+ * Instructions are also split into chains, following the linear parts
+ * of the graph, and independent chains go to different command queues
+ * (see `QueueSelection`), so small kernels from different branches can
+ * run on the device at the same time.
+ *
+ * Nodes placed on other devices (see `BaseNode::place_on_device`) get
+ * evaluated there, with their inputs transferred automatically.
+ *
+ * Nodes with lazy inputs (see `BaseNode::num_eager_inputs`), like `Cond`,
+ * are still evaluated lazily: the parts of the graph reachable only through
+ * their lazy inputs are moved into separate instruction sequences,
+ * executed only if the node asks for them.
+ *
+ * Chains of element-wise operations, which intermediate values aren't used
+ * anywhere else, are evaluated by single generated kernels, so those values
+ * never get written to the memory. If a run gives a value for one of those
+ * intermediate nodes, the plan gets rebuilt without fusion.
+ *
+ * Nodes doing exactly the same thing with the same inputs (like the many
+ * copies of `ones_like(x)` made by back-propagation) are evaluated
+ * only once, and all their consumers share the value.
+ * Nodes which would only return one of their inputs (like multiplications
+ * by ones, or reductions having nothing to reduce, which back-propagation
+ * makes a lot of) are skipped altogether.
+ *
+ * Parts of the graph depending only on constants (like casts or products
+ * of constants appearing in the derivatives) are evaluated only once,
+ * during the first run, and then their values are kept in the `Context`,
+ * just like the values of the constants themselves.
+ *
+ * Plans made for inference only (see `freeze`) replace the frozen nodes
+ * with constants and resolve the conditions depending only on them
+ * (like the learning phase), so the folding covers whole networks.
+ *
+ * Independent operations on small arrays (like updates of many bias
+ * vectors), which would spend more time being launched than working,
+ * are launched in batches: one kernel per batch of operations of the kind.
+ *
+ * The plan also knows exactly when each intermediate value appears and when
+ * it dies, so all of them get fixed places in one `BufferArena`, with values
+ * that never live at the same time sharing the memory. The layout is first
+ * estimated from the shapes of the nodes, and then refined using the real
+ * sizes of the arrays observed during the first run (or any run after
+ * the sizes have changed).
+ */
+class ExecutionPlan {
+public:
+    /**
+     * @param frozen_values values some nodes (like variables) are going
+     *    to have forever, for plans made only for inference (see `freeze`)
+     * @param context where those values come from. Needed only during
+     *    the construction, to evaluate whatever depends on them in advance.
+     */
+    ExecutionPlan(const NodeRefList &result_nodes,
+                  const NodeRefList &update_nodes,
+                  const PlanOptions &options = PlanOptions(),
+                  const NodeValueMap &frozen_values = {},
+                  Context *context = nullptr);
+
+    /**
+     * Evaluates all result and update nodes (in that order).
+     * @param pre_cache_map values for some nodes known in advance
+     *    (like placeholders), which don't have to be evaluated
+     */
+    void run(Context &context, ExecutionCache &cache,
+             const NodeValueMap &pre_cache_map,
+             ArrayRefList &results,
+             ArrayRefList &update_results);
+
+    /** The total number of instructions (including the lazy ones) */
+    std::size_t size() const { return _instructions.size(); }
+    /** The number of instructions executed unconditionally every run */
+    std::size_t main_sequence_size() const { return _main_sequence.size(); }
+    /** The number of independent chains the main sequence is split into */
+    std::size_t num_chains() const { return _num_chains; }
+
+    /**
+     * Compiles all OpenCL programs the nodes of the plan need in advance,
+     * for every device they are going to be evaluated on,
+     * using up to `num_threads` threads (zero means as many as possible).
+     */
+    void precompile_programs(Context &context, std::size_t num_threads) const;
+
+    /** Only arrays up to this size (in elements) are batched */
+    static constexpr std::size_t MaxBatchedArraySize = 4096;
+    /** How many operations one kernel launch can do */
+    static constexpr std::size_t MaxBatchSize = 16;
+
+    /** Used for estimations until the requirements of the device are known */
+    static constexpr std::size_t DefaultArenaAlignment = 128;
+
+    /**
+     * The amount of device memory (in bytes) necessary to keep
+     * all intermediate values of a run. Before the first run it's only
+     * an estimation, based on the shapes of the nodes known in advance.
+     */
+    std::size_t arena_size() const { return _arena_size; }
+
+private:
+    NodeRefList _result_nodes;
+    NodeRefList _update_nodes;
+    PlanOptions _options;
+    NodeValueMap _frozen_values;
+    // The nodes in topological order, slot index == index in the list
+    NodeRefList _nodes;
+    // Nodes made by the plan itself to replace some of the instructions
+    NodeRefList _fused_nodes;
+    // Set for slots evaluated only as a part of a fused, batched or folded
+    // instruction of another slot
+    std::vector<char> _is_fused_away;
+    // Set for slots which values are shared by their duplicates
+    std::vector<char> _has_duplicates;
+    std::vector<PlanInstruction> _instructions;
+    std::vector<std::size_t> _main_sequence;
+    std::vector<std::size_t> _result_slots;
+    std::vector<std::size_t> _update_slots;
+    // Used only to find the slots for values from pre_cache_map
+    std::map<NodeId, std::size_t> _slot_by_node_id;
+    std::size_t _num_chains;
+    // The same nodes without any optimizations, used (and built) only
+    // for runs giving values for nodes this plan has fused, batched
+    // or merged away. It doesn't depend on which of them are given.
+    std::shared_ptr<ExecutionPlan> _unoptimized_plan;
+
+    // The state of the current run
+    ArrayRefList _slots;
+    // Number of the run during which the slot was evaluated last time
+    std::vector<std::size_t> _evaluated_during_run;
+    std::size_t _run_counter;
+    // Set only for runs during which some values have been given
+    // for nodes having inputs (those inputs might be not needed then)
+    std::vector<char> _needed;
+
+    // Memory planning. Lifetimes are measured in positions
+    // within the main sequence.
+    std::vector<std::size_t> _live_from;
+    std::vector<std::size_t> _live_until;
+    std::vector<char> _can_use_arena;
+    std::vector<std::size_t> _arena_block_of_slot;
+    std::vector<BufferArena::Block> _arena_blocks;
+    std::size_t _arena_size;
+    BufferArenaRef _arena;
+    std::vector<std::size_t> _observed_sizes;
+    bool _observe_array_sizes;
+
+    bool needs_unoptimized_plan(const NodeValueMap &pre_cache_map) const;
+    void plan_memory_layout(const std::vector<std::size_t> &sizes,
+                            std::size_t alignment);
+    void observe_array_size(std::size_t slot, Context &context);
+
+    void replace_redundant_slots();
+    std::vector<char> find_constant_slots() const;
+    void freeze_constant_parts(Context &context);
+    void resolve_frozen_conditions(Context &context, ExecutionCache &cache);
+    void fold_constants();
+    void fuse_elementwise_chains(std::vector<char> &in_main_sequence);
+    void batch_small_launches();
+    void build_lazy_sequences(const std::vector<char> &in_main_sequence);
+    void split_into_chains();
+    void mark_needed_slots();
+    void execute_sequence(const std::vector<std::size_t> &sequence,
+                          Context &context, ExecutionCache &cache,
+                          bool is_main_sequence);
+    BufferPoolRef choose_device_pool(PlanInstruction &instruction,
+                                     Context &context);
+    void execute_batch(PlanInstruction &instruction,
+                       Context &context, ExecutionCache &cache);
+    void execute_instruction(std::size_t slot,
+                             Context &context, ExecutionCache &cache);
+};
+
+} // namespace
+
+#endif //AVALANCHE_EXECUTIONPLAN_H
@@ -5,6 +5,7 @@
 
 #include "avalanche/Context.h"
 #include "avalanche/ExecutionCache.h"
+#include "avalanche/ExecutionPlan.h"
 #include "avalanche/BaseNode.h"
 #include "avalanche/backprop.h"
 
@@ -16,58 +17,29 @@ public:
              const NodeRefList &result_nodes)
         :Executor(context, result_nodes, {}) {}
 
+    /**
+     * @param frozen_values see `freeze`
+     */
     Executor(const ContextRef &context,
              const NodeRefList &result_nodes,
-             const NodeRefList &updates)
+             const NodeRefList &updates,
+             const PlanOptions &options = PlanOptions(),
+             const NodeValueMap &frozen_values = {})
     :_context{context},
      _cache{context->device_pool()},
      _result_nodes{result_nodes},
-     _update_nodes{updates}
+     _update_nodes{updates},
+     _plan{result_nodes, updates, options, frozen_values, context.get()}
     {
         if (!context) {
             throw std::invalid_argument("No context!");
         }
-        NodeRefList full_output_list;
-        std::copy(_result_nodes.begin(), _result_nodes.end(),
-                  std::back_inserter(full_output_list));
-        std::copy(_update_nodes.begin(), _update_nodes.end(),
-                  std::back_inserter(full_output_list));
-        auto consumer_map = build_consumers_map(full_output_list);
-        for (auto &item: consumer_map) {
-            // All outputs must receive +1 to the number of their consumers,
-            // because fetching each output is +1 eval, like if we have
-            // an extra node connected
-            bool is_output_node = false;
-            for (const auto &out: full_output_list) {
-                if (out->id == item.first->id) {
-                    is_output_node = true;
-                    break;
-                }
-            }
-            _cache.set_node_params(
-                item.first->id,
-                item.second.size() + (is_output_node ? 1 : 0),
-                0,
-                item.second);
-        }
     }
 
     std::vector<MultiArrayRef> run(const NodeValueMap &pre_cache_map = {}) {
         std::vector<MultiArrayRef> results;
         std::vector<MultiArrayRef> update_results;
-        // just in case we zero the counters. Although in theory
-        // if the previous run had not failed, all counters must already be 0
-        _cache.zero_reuse_counters();
-        _cache.put_all(pre_cache_map);
-        for (auto &target: _result_nodes) {
-            auto result = target->eval(*_context, _cache);
-            results.emplace_back(std::move(result));
-        }
-        for (auto &target: _update_nodes) {
-            auto result = target->eval(*_context, _cache);
-            update_results.emplace_back(std::move(result));
-        }
-        _context->device_pool()->cl_queue().flush();
+        run_async(pre_cache_map, results, update_results);
         for (auto &result: results) {
             result->wait_until_ready();
         }
@@ -77,17 +49,58 @@ public:
         return results;
     }
 
+    /**
+     * Enqueues all the computations, just like `run`, but doesn't wait
+     * until they're done. So the arrays in `results` and `update_results`
+     * become ready some time later.
+     */
+    void run_async(const NodeValueMap &pre_cache_map,
+                   ArrayRefList &results,
+                   ArrayRefList &update_results) {
+        _plan.run(*_context, _cache, pre_cache_map, results, update_results);
+        _context->device_pool()->flush_all_queues();
+    }
+
+    /**
+     * Compiles all OpenCL programs the graph needs at once, on several
+     * threads, instead of compiling them one after another
+     * during the first run. Not mandatory: whatever isn't compiled
+     * in advance still gets compiled on demand.
+     * @param num_threads zero means as many as the hardware supports
+     */
+    void warm_up(std::size_t num_threads = 0) {
+        _plan.precompile_programs(*_context, num_threads);
+    }
+
     const NodeRefList& result_nodes() { return _result_nodes; }
 
     ContextRef& context() { return _context; }
 
+    const ExecutionPlan& plan() const { return _plan; }
+
 private:
     ContextRef _context;
     ExecutionCache _cache;
     const NodeRefList _result_nodes;
     const NodeRefList _update_nodes;
+    ExecutionPlan _plan;
 };
 
+/**
+ * Makes an executor for inference only. All variables the results depend on
+ * become constants keeping copies of their current values, and so do
+ * the nodes from `fixed_values` (like the learning phase placeholder) with
+ * the values given. Conditions depending only on them get resolved once,
+ * and everything else depending only on them gets evaluated right away,
+ * so there's nothing to look up in the context during the runs, and
+ * the fusion covers the whole network. Changing the variables afterwards
+ * doesn't affect the executor.
+ */
+Executor freeze(const ContextRef &context,
+                const NodeRefList &result_nodes,
+                const NodeValueMap &fixed_values = {},
+                const PlanOptions &options = PlanOptions());
+
 }
 
 
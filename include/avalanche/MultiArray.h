@@ -60,6 +60,14 @@ public:
     /** As soon as the original array src is ready, creates a new
      * array containing exactly the same data. */
     MultiArrayRef ref_copy();
+    /**
+     * Creates a new array with the same data in another pool (possibly
+     * on another device). Doesn't block: the copying starts once the array
+     * is ready, and the new array becomes ready when it's done.
+     * Devices not sharing the same OpenCL context exchange the data
+     * through the host memory.
+     */
+    MultiArrayRef copy_to(const BufferPoolRef &device_pool);
     /** Creates a new array with the same buffer underneath, but a new readiness
      * promise, which can be set independently. */
     MultiArrayRef ref_with_shared_buffer() {
@@ -0,0 +1,132 @@
+#ifndef AVALANCHE_WORKGROUPTUNER_H
+#define AVALANCHE_WORKGROUPTUNER_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CL_cust/cl2.hpp"
+
+#include "avalanche/CLBufferPool.h"
+
+namespace avalanche {
+
+/** Groups of kernels sharing the same launch configuration */
+enum class KernelFamily {
+    ElementWise,
+    Broadcasted,
+    Update,
+    Transform,
+    Reduction,
+    Random,
+    Tile
+};
+
+const char* kernel_family_name(KernelFamily family);
+
+/** How the kernels of a family get launched on a particular device */
+struct LaunchConfig {
+    std::size_t work_group_size;
+    // How many elements each work item processes (only for kernels
+    // iterating over their data, the rest always use 1)
+    std::size_t items_per_thread;
+
+    /**
+     * Build options defining WORK_GROUP_SIZE macro, which the kernels
+     * use instead of a hard-coded value
+     */
+    std::string build_options() const;
+
+    /** The global work size necessary to process `num_items` elements */
+    std::size_t global_size(std::size_t num_items) const;
+
+    bool operator==(const LaunchConfig &other) const {
+        return (work_group_size == other.work_group_size
+                && items_per_thread == other.items_per_thread);
+    }
+};
+
+
+/**
+ * Finds the best work group sizes (and the number of elements per work item)
+ * for each family of kernels on each device, by benchmarking all candidates
+ * on a representative workload. The results are kept in a tuning file,
+ * so the tuning has to be done only once per device and driver.
+ *
+ * Until a device is tuned, the kernels are launched with
+ * `DefaultWorkGroupSize` work items per group and one element per item,
+ * as they have always been.
+ *
+ * By default the tuning file is taken from AVALANCHE_TUNING_FILE
+ * environment variable, or else lives in the directory of the default
+ * `CodeCache`. Empty path disables saving and loading of the results.
+ */
+class WorkGroupTuner {
+public:
+    static constexpr std::size_t DefaultWorkGroupSize = 64;
+
+    WorkGroupTuner();
+
+    /** The configuration the kernels of the family must be launched with */
+    LaunchConfig launch_config(const cl::Device &device, KernelFamily family);
+
+    void set_launch_config(const cl::Device &device, KernelFamily family,
+                           const LaunchConfig &config);
+
+    /**
+     * Benchmarks all candidate configurations of the family on the device
+     * of the pool, remembers the fastest one and saves the tuning file.
+     * @return the chosen configuration
+     */
+    LaunchConfig tune(const BufferPoolRef &pool, KernelFamily family);
+
+    /** Tunes all families of kernels for the device of the pool */
+    void tune_all(const BufferPoolRef &pool);
+
+    /** Sets the path of the tuning file, loading the results from it */
+    void set_tuning_file(const std::string &path);
+    std::string tuning_file() const;
+    /** Writes all known results into the tuning file */
+    void save() const;
+
+    static WorkGroupTuner& get_default();
+
+private:
+    mutable std::mutex _mutex;
+    std::string _tuning_file;
+    bool _tuning_file_is_loaded;
+    // Keyed by the family and the device description (name and driver)
+    std::map<std::pair<std::string, std::string>, LaunchConfig> _configs;
+    std::map<cl_device_id, std::string> _device_keys;
+
+    std::string device_key(const cl::Device &device);
+    void load_tuning_file();
+    std::vector<LaunchConfig> candidates(const cl::Device &device,
+                                         KernelFamily family) const;
+};
+
+
+/**
+ * While alive, makes `WorkGroupTuner::launch_config` return the given
+ * configuration for the family on the current thread (only one family
+ * can be overridden at a time). This is how the tuner runs the ordinary
+ * operations with the candidate configurations.
+ */
+class LaunchConfigOverride {
+public:
+    LaunchConfigOverride(KernelFamily family, const LaunchConfig &config);
+    ~LaunchConfigOverride();
+    LaunchConfigOverride(const LaunchConfigOverride&) = delete;
+    LaunchConfigOverride& operator=(const LaunchConfigOverride&) = delete;
+
+private:
+    // Restored once the override is gone
+    bool _previous_is_active;
+    KernelFamily _previous_family;
+    LaunchConfig _previous_config;
+};
+
+} // namespace
+
+#endif //AVALANCHE_WORKGROUPTUNER_H
@@ -47,6 +47,219 @@ get_op_repr_extra(const T &a) {
     return a.repr_extra();
 }
 
+/**
+ * Same trick for `collect_programs` method, which only the operations
+ * compiling their own OpenCL programs have to implement.
+ */
+template <typename T>
+class has_collect_programs_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test( typeof(&C::collect_programs) ) ;
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T>
+typename std::enable_if<!has_collect_programs_method<T>::value, void>::type
+collect_op_programs(const T &a, const cl::Device &device,
+                    ProgramSourceList &programs) {
+}
+
+template <typename T>
+typename std::enable_if<has_collect_programs_method<T>::value, void>::type
+collect_op_programs(const T &a, const cl::Device &device,
+                    ProgramSourceList &programs) {
+    a.collect_programs(device, programs);
+}
+
+/**
+ * And for `elementwise_code`, which only the element-wise operations
+ * have, so they could be fused together.
+ */
+template <typename T>
+class has_elementwise_code_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test( typeof(&C::elementwise_code) ) ;
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T>
+typename std::enable_if<!has_elementwise_code_method<T>::value, std::string>::type
+get_op_elementwise_code(const T &a, const std::vector<std::string> &input_vars,
+                        const std::string &output_var) {
+    return "";
+}
+
+template <typename T>
+typename std::enable_if<has_elementwise_code_method<T>::value, std::string>::type
+get_op_elementwise_code(const T &a, const std::vector<std::string> &input_vars,
+                        const std::string &output_var) {
+    return a.elementwise_code(input_vars, output_var);
+}
+
+/**
+ * Operations which aren't element-wise, but still can be described
+ * by their parameters (see `BaseNode::structure_key`),
+ * have `structure_key` method
+ */
+template <typename T>
+class has_structure_key_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test( typeof(&C::structure_key) ) ;
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T>
+typename std::enable_if<!has_structure_key_method<T>::value, std::string>::type
+get_op_structure_key(const T &a) {
+    return "";
+}
+
+template <typename T>
+typename std::enable_if<has_structure_key_method<T>::value, std::string>::type
+get_op_structure_key(const T &a) {
+    return std::string(typeid(a).name()) + ": " + a.structure_key();
+}
+
+/**
+ * Operations which sometimes just pass one of their inputs through have
+ * `passthrough_input` method, taking the input nodes (so a binary
+ * operation can check whether the other one is, say, a constant zero).
+ * `Reduction` is both a unary and a binary operation, so here
+ * the number of arguments matters.
+ */
+template <typename T, typename... Inputs>
+class has_passthrough_input_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test(
+        decltype(std::declval<const C&>().passthrough_input(
+            std::declval<Inputs>()...)) *);
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T, typename... Inputs>
+typename std::enable_if<!has_passthrough_input_method<T, Inputs...>::value, int>::type
+get_op_passthrough_input(const T &a, const Inputs&... inputs) {
+    return -1;
+}
+
+template <typename T, typename... Inputs>
+typename std::enable_if<has_passthrough_input_method<T, Inputs...>::value, int>::type
+get_op_passthrough_input(const T &a, const Inputs&... inputs) {
+    return a.passthrough_input(inputs...);
+}
+
+/**
+ * Operations which can evaluate many pairs of inputs with one launch
+ * have `forward_batch` and `batch_key` methods
+ */
+template <typename T>
+class has_forward_batch_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test( typeof(&C::forward_batch) ) ;
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T>
+typename std::enable_if<!has_forward_batch_method<T>::value, std::string>::type
+get_op_batch_key(const T &a) {
+    return "";
+}
+
+template <typename T>
+typename std::enable_if<has_forward_batch_method<T>::value, std::string>::type
+get_op_batch_key(const T &a) {
+    return a.batch_key();
+}
+
+template <typename T>
+typename std::enable_if<!has_forward_batch_method<T>::value, ArrayRefList>::type
+op_forward_batch(const T &a, const std::vector<ArrayRefList> &input_values) {
+    throw std::logic_error("The operation cannot be evaluated in batches");
+}
+
+template <typename T>
+typename std::enable_if<has_forward_batch_method<T>::value, ArrayRefList>::type
+op_forward_batch(const T &a, const std::vector<ArrayRefList> &input_values) {
+    return a.forward_batch(input_values);
+}
+
+/**
+ * Operations calculating their input on the fly from a fused chain
+ * of element-wise operations have `forward_with_prologue`
+ * and `collect_programs_with_prologue` methods
+ */
+template <typename T>
+class has_forward_with_prologue_method
+{
+    typedef char one;
+    typedef long two;
+
+    template <typename C> static one test( typeof(&C::forward_with_prologue) ) ;
+    template <typename C> static two test(...);
+
+public:
+    enum { value = sizeof(test<T>(0)) == sizeof(char) };
+};
+
+template <typename T>
+typename std::enable_if<!has_forward_with_prologue_method<T>::value, MultiArrayRef>::type
+op_forward_with_prologue(const T &a, const FusedElementWise &prologue,
+                         const ArrayRefList &input_values) {
+    throw std::logic_error("The operation cannot have element-wise prologues");
+}
+
+template <typename T>
+typename std::enable_if<has_forward_with_prologue_method<T>::value, MultiArrayRef>::type
+op_forward_with_prologue(const T &a, const FusedElementWise &prologue,
+                         const ArrayRefList &input_values) {
+    return a.forward_with_prologue(prologue, input_values);
+}
+
+template <typename T>
+typename std::enable_if<!has_forward_with_prologue_method<T>::value, void>::type
+collect_op_programs_with_prologue(const T &a, const cl::Device &device,
+                                  const FusedElementWise &prologue,
+                                  ProgramSourceList &programs) {
+}
+
+template <typename T>
+typename std::enable_if<has_forward_with_prologue_method<T>::value, void>::type
+collect_op_programs_with_prologue(const T &a, const cl::Device &device,
+                                  const FusedElementWise &prologue,
+                                  ProgramSourceList &programs) {
+    a.collect_programs_with_prologue(device, prologue, programs);
+}
+
 
 template <typename Op>
 class UnaryOp : public BaseNode {
@@ -71,6 +284,11 @@ public:
         return result;
     }
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override {
+        return op.forward(input_values[0]);
+    }
+
     std::string to_string() const override {
         std::string output = op.lh_name() + input->to_string() + op.rh_name();
         return output;
@@ -80,6 +298,42 @@ public:
         return format_repr(typeid(op).name(), "", get_op_repr_extra(op));
     }
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override {
+        collect_op_programs(op, device, programs);
+    }
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const override {
+        return get_op_elementwise_code(op, input_vars, output_var);
+    }
+
+    std::string structure_key() const override {
+        auto key = get_op_structure_key(op);
+        return key.empty() ? BaseNode::structure_key() : key;
+    }
+
+    int passthrough_input() const override {
+        return get_op_passthrough_input(op, input);
+    }
+
+    bool accepts_elementwise_prologue() const override {
+        return has_forward_with_prologue_method<Op>::value;
+    }
+
+    MultiArrayRef forward_with_prologue(
+            Context &context, ExecutionCache &cache,
+            const FusedElementWise &prologue,
+            const ArrayRefList &input_values) const override {
+        return op_forward_with_prologue(op, prologue, input_values);
+    }
+
+    void collect_programs_with_prologue(
+            const cl::Device &device, const FusedElementWise &prologue,
+            ProgramSourceList &programs) const override {
+        collect_op_programs_with_prologue(op, device, prologue, programs);
+    }
+
     NodeRefList inputs() const override {
         return NodeRefList({input});
     }
@@ -130,6 +384,21 @@ public:
         return result;
     }
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override {
+        return op.forward(input_values[0], input_values[1]);
+    }
+
+    std::string batch_key() const override {
+        return get_op_batch_key(op);
+    }
+
+    ArrayRefList forward_batch(
+            Context &context, ExecutionCache &cache,
+            const std::vector<ArrayRefList> &input_values) const override {
+        return op_forward_batch(op, input_values);
+    }
+
     std::string to_string() const override {
         std::string output;
         output += "(";
@@ -142,6 +411,25 @@ public:
         return format_repr(typeid(op).name(), "", get_op_repr_extra(op));
     }
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override {
+        collect_op_programs(op, device, programs);
+    }
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const override {
+        return get_op_elementwise_code(op, input_vars, output_var);
+    }
+
+    std::string structure_key() const override {
+        auto key = get_op_structure_key(op);
+        return key.empty() ? BaseNode::structure_key() : key;
+    }
+
+    int passthrough_input() const override {
+        return get_op_passthrough_input(op, left, right);
+    }
+
     NodeRefList inputs() const override {
         return NodeRefList({left, right});
     }
@@ -12,6 +12,18 @@ class Cond : public BaseNode {
 public:
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    // Only the condition is evaluated unconditionally, the branches are lazy
+    std::size_t num_eager_inputs() const override { return 1; }
+
+    std::vector<std::size_t> lazy_inputs_to_evaluate(
+        Context &context, const ArrayRefList &eager_values) const override;
+
+    int passthrough_input_given(
+        Context &context, const ArrayRefList &eager_values) const override;
+
     std::string to_string() const override;
 
     NodeRefList inputs() const override;
@@ -0,0 +1,51 @@
+#ifndef AVALANCHE_DEVICE_NODES_H
+#define AVALANCHE_DEVICE_NODES_H
+
+/**
+ * Nodes moving the data between devices, which makes possible to spread
+ * a model too large for one device across several of them
+ * (model parallelism).
+ */
+
+#include "avalanche/BaseNode.h"
+
+namespace avalanche {
+
+/**
+ * Copies the value of the input to another device. The copying is
+ * asynchronous: the kernels on the destination device just wait until
+ * it's done. Values already living on the destination device
+ * are passed through without copying.
+ */
+class Transfer : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return NodeRefList({_input}); }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    DeviceIndex destination() const { return _destination; }
+
+    static NodeRef make(const NodeRef &input, DeviceIndex destination);
+
+private:
+    const NodeRef _input;
+    const DeviceIndex _destination;
+
+    Transfer(const NodeRef &input, DeviceIndex destination);
+};
+
+} // namespace
+
+#endif //AVALANCHE_DEVICE_NODES_H
@@ -0,0 +1,169 @@
+#ifndef AVALANCHE_FUSED_NODES_H
+#define AVALANCHE_FUSED_NODES_H
+
+/**
+ * Nodes replacing groups of other nodes within an `ExecutionPlan`,
+ * so the whole group gets calculated by a single kernel.
+ */
+
+#include <string>
+#include <vector>
+
+#include "avalanche/BaseNode.h"
+
+namespace avalanche {
+
+/**
+ * Calculates the size masks for broadcasting of any number of arrays
+ * into one (like `broadcast_size_masks` does for two of them).
+ * @param shapes the shapes of the arrays
+ * @param size_masks the masks of all the arrays, one after another,
+ *    each having as many elements as the rank of the result
+ * @param result_sub_sizes sub-sizes of all dimensions of the result
+ * @returns the shape of the result
+ */
+Shape broadcast_size_masks(const std::vector<Shape> &shapes,
+                           std::vector<cl_ulong> &size_masks,
+                           std::vector<cl_ulong> &result_sub_sizes);
+
+
+/**
+ * Everything a kernel reading the values of a `FusedElementWise` node
+ * (instead of an array) needs for one launch.
+ */
+struct FusedLaunch {
+    Shape result_shape;
+    ArrayRefList input_values;
+    // Uploaded once for every combination of shapes
+    CLBufferPool::ConstantData size_masks_buffer;
+    CLBufferPool::ConstantData result_sizes_buffer;
+    // The kernel must wait for all of them
+    std::vector<cl::Event> data_are_ready;
+    std::vector<cl_ulong> size_masks;
+    std::vector<cl_ulong> result_sub_sizes;
+
+    /** Must be called once the kernels using the launch are enqueued */
+    void keep_alive_until_done(const MultiArrayRef &result) const;
+};
+
+
+/**
+ * A chain of element-wise operations (see `BaseNode::elementwise_code`)
+ * evaluated by one generated kernel. Intermediate values never leave
+ * the registers, so instead of writing and reading an array per operation
+ * the kernel reads only the inputs of the chain and writes its result.
+ * Inputs are broadcast against each other, just like the operations
+ * themselves do.
+ *
+ * Such nodes are made by `ExecutionPlan` and exist only within it:
+ * they cannot be differentiated.
+ */
+class FusedElementWise : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return _inputs; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    /** The fused nodes, the last one gives the result */
+    const NodeRefList& steps() const { return _steps; }
+
+    /** Unique for every distinct chain of operations */
+    const std::string& kernel_name() const { return _kernel_name; }
+
+    /**
+     * OpenCL code defining `SOURCE_ARGUMENTS(Type)` and `READ_SOURCE(index)`
+     * macros, which let other kernels (like reductions) calculate
+     * the elements of the chain while reading them.
+     */
+    const std::string& prologue_source() const { return _prologue_source; }
+
+    /** Prepares the masks for broadcasting of the given input values */
+    FusedLaunch prepare_launch(const ArrayRefList &input_values) const;
+
+    /**
+     * Sets the kernel arguments declared by `SOURCE_ARGUMENTS`,
+     * starting from `first_arg`.
+     * @returns the index of the next argument
+     */
+    cl_uint set_source_arguments(cl::Kernel &kernel, cl_uint first_arg,
+                                 const FusedLaunch &launch) const;
+
+    /**
+     * @param steps element-wise nodes in topological order, each one
+     *    using only the previous steps and the inputs
+     * @param inputs everything else the steps need (without duplicates)
+     */
+    static NodeRef make(const NodeRefList &steps, const NodeRefList &inputs);
+
+private:
+    const NodeRefList _steps;
+    const NodeRefList _inputs;
+    std::string _kernel_name;
+    std::string _prologue_source;
+    std::string _kernel_source;
+
+    FusedElementWise(const NodeRefList &steps, const NodeRefList &inputs);
+};
+
+
+/**
+ * A node reading its only input from a fused chain of element-wise
+ * operations (see `BaseNode::forward_with_prologue`), so the value
+ * of the chain never gets written into memory. Like `FusedElementWise`,
+ * exists only within `ExecutionPlan`.
+ */
+class NodeWithPrologue : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return _prologue->inputs(); }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    const NodeRef& node() const { return _node; }
+
+    /**
+     * @param node a node accepting element-wise prologues
+     * @param prologue a `FusedElementWise` node calculating its input
+     */
+    static NodeRef make(const NodeRef &node, const NodeRef &prologue);
+
+private:
+    const NodeRef _node;
+    const std::shared_ptr<FusedElementWise> _prologue;
+
+    NodeWithPrologue(const NodeRef &node,
+                     const std::shared_ptr<FusedElementWise> &prologue);
+};
+
+} // namespace
+
+#endif //AVALANCHE_FUSED_NODES_H
@@ -1,6 +1,7 @@
 #ifndef AVALANCHE_BROADCASTEDBINARYOP_H
 #define AVALANCHE_BROADCASTEDBINARYOP_H
 
+#include <string>
 #include <vector>
 
 #include "avalanche/Shape.h"
@@ -25,11 +26,51 @@ std::size_t broadcast_size_masks(const Shape &shape1, const Shape &shape2,
                                  std::vector<cl_ulong> &result_sub_sizes);
 
 
+/**
+ * Describes how two shapes get broadcast against each other, using as few
+ * dimensions as possible: dimensions of size 1 are dropped, and neighbouring
+ * dimensions get merged when each array either runs along both of them
+ * or is broadcast along both. Adding a matrix (8, 16, 4) and a vector (4),
+ * for instance, gives just two dimensions (128, 4), with the vector
+ * broadcast along the first one.
+ *
+ * Kernels generated for a pattern have all the strides built in,
+ * so they need neither size masks nor any divisions in the loop
+ * for the common cases (same shapes, scalars, rows and columns).
+ */
+struct BroadcastPattern {
+    // The sizes of the merged dimensions of the result
+    std::vector<std::size_t> dims;
+    // Whether the left (right) array runs along each of the dimensions
+    // or is broadcast along it
+    std::vector<bool> left_runs;
+    std::vector<bool> right_runs;
+
+    static BroadcastPattern of(const Shape &left, const Shape &right);
+
+    /**
+     * Unique for every pattern and suitable for kernel names. The size
+     * of the first dimension doesn't matter for the kernels, so it's
+     * not a part of the signature: arrays with different batch sizes
+     * share the same kernel.
+     */
+    std::string signature() const;
+
+    /**
+     * OpenCL expression calculating the index within the left (or right)
+     * array for the element `item_var` of the result.
+     */
+    std::string index_expression(bool left,
+                                 const std::string &item_var) const;
+};
+
+
 /**
  * Base class for many operations involving broadcasting, which allows
  * to operate on arrays of different shapes without the need to transform
- * them. This class uses a general kernel doing the job, which every
- * subclass can tweak as necessary.
+ * them. Every subclass provides only the code of the operation itself,
+ * and the kernels get generated for each `BroadcastPattern` the arrays
+ * happen to have in runtime.
  * More about broadcasting can be found here:
  * https://docs.scipy.org/doc/numpy/user/basics.broadcasting.html
  */
@@ -54,13 +95,24 @@ public:
 
     virtual bool use_in_back_propagation() const { return true; };
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const;
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const;
 
 private:
     Shape _result_shape;
     ArrayType _result_dtype;
+    ArrayType _left_dtype;
+    ArrayType _right_dtype;
+    Shape _left_shape;
+    Shape _right_shape;
     std::string _operation_name;
-    std::string _kernel_name;
-    std::string _kernel_source;
+    std::string _operation_code;
+
+    std::string kernel_name(const BroadcastPattern &pattern) const;
+    std::string kernel_source(const BroadcastPattern &pattern) const;
 };
 
 } // namespace
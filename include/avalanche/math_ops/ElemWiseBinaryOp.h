@@ -28,12 +28,31 @@ public:
 
     virtual bool use_in_back_propagation() const { return true; };
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const;
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const;
+
+    /** Ops with the same key can be evaluated together by `forward_batch` */
+    std::string batch_key() const { return _kernel_name; }
+
+    /**
+     * Does what `forward` does for many pairs of arrays at once,
+     * using a single kernel launch
+     */
+    ArrayRefList forward_batch(
+        const std::vector<ArrayRefList> &input_values) const;
+
     static Shape infer_elemwise_shape(const Shape &shape1, const Shape &shape2);
 
 private:
     Shape _result_shape;
     ArrayType _result_dtype;
+    ArrayType _left_dtype;
+    ArrayType _right_dtype;
     std::string _operation_name;
+    std::string _operation_code;
     std::string _kernel_name;
     std::string _kernel_source;
 
@@ -1,6 +1,7 @@
 #ifndef AVALANCHE_MATMUL_H
 #define AVALANCHE_MATMUL_H
 
+#include <memory>
 #include <string>
 
 #include "avalanche/MultiArray.h"
@@ -41,6 +42,118 @@ struct MatMul {
     bool use_in_back_propagation() const { return true; };
 };
 
+
+/**
+ * Multiplies stacks of matrices: the last two dimensions of each operand
+ * are the matrices, and all the others are the batch dimensions,
+ * broadcast against each other the same way element-wise operations do.
+ * For instance, multiplying (32, 28, 3) by (3, 4) gives (32, 28, 4),
+ * while (8, 1, 5, 3) by (6, 3, 4) gives (8, 6, 5, 4).
+ * The transposition flags apply to every matrix of the stack.
+ *
+ * All the matrices get multiplied by one call to CLBlast.
+ */
+struct BatchMatMul {
+    bool transpose_left;
+    bool transpose_right;
+    Shape _result_shape;
+    ArrayType _result_dtype;
+
+    BatchMatMul(const NodeRef &left, const NodeRef &right,
+                bool transpose_left=false, bool transpose_right=false);
+
+    Shape shape() const {
+        return _result_shape;
+    }
+
+    ArrayType dtype() const {
+        return _result_dtype;
+    }
+
+    std::string name() const {
+        return std::string(transpose_left ? "T" : "")
+               + "batch_matmul"
+               + (transpose_right ? "T" : "");
+    }
+
+    MultiArrayRef forward(const MultiArrayRef &v1,
+                          const MultiArrayRef &v2) const;
+
+    const NodeRef
+    apply_chain_rule(const NodeRef &wrt_input, const NodeRef &d_target_wrt_this,
+                     const NodeRefList &all_inputs) const;
+    bool use_in_back_propagation() const { return true; };
+};
+
+
+enum class Activation {
+    Linear,
+    ReLU,
+    Sigmoid,
+    Tanh
+};
+
+const char* activation_name(Activation activation);
+
+
+/**
+ * A fully connected layer: `activation(inputs x weights + bias)`.
+ *
+ * Instead of running a multiplication, a broadcasted addition and
+ * an activation one after another, the node runs the GEMM and then one
+ * kernel adding the bias and applying the activation in place, so
+ * no intermediate arrays get allocated.
+ *
+ * The derivative of the activation is calculated from the output
+ * of the node, so back-propagation costs one element-wise kernel
+ * (shared by all three inputs), two GEMMs and a reduction for the bias.
+ */
+class Dense : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return {_inputs, _weights, _bias}; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    Activation activation() const { return _activation; }
+
+    /**
+     * @param inputs a matrix (batch size, number of features)
+     * @param weights a matrix (number of features, number of units)
+     * @param bias a vector (number of units)
+     */
+    static NodeRef make(const NodeRef &inputs, const NodeRef &weights,
+                        const NodeRef &bias,
+                        Activation activation = Activation::Linear);
+
+private:
+    const NodeRef _inputs;
+    const NodeRef _weights;
+    const NodeRef _bias;
+    const Activation _activation;
+    // The chain rule needs the output of the node itself
+    std::weak_ptr<BaseNode> _self;
+    std::string _kernel_name;
+    std::string _kernel_source;
+
+    Dense(const NodeRef &inputs, const NodeRef &weights, const NodeRef &bias,
+          Activation activation);
+};
+
 } // namespace
 
 #endif //AVALANCHE_MATMUL_H
@@ -7,6 +7,7 @@
 #include <iostream>
 
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/opencl_utils.h"
 #include "avalanche/MultiArray.h"
 #include "avalanche/BaseNode.h"
@@ -107,6 +108,33 @@ public:
 
     bool use_in_back_propagation() const { return true; };
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const {
+        const auto launch = WorkGroupTuner::get_default().launch_config(
+            device, KernelFamily::Transform);
+        programs.push_back(
+            {program_name, kernel_source, launch.build_options()});
+    }
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const {
+        const std::string type_name = cl_type_name_of_array(result_dtype);
+        std::ostringstream o;
+        // Enough digits to get exactly the same float back
+        o.precision(9);
+        o << "{ const " << type_name << " v = " << input_vars[0] << "; ";
+        for (std::size_t i = 0; i < NumParams; ++i) {
+            o << "const " << type_name << " p" << i
+              << " = (" << type_name << ")(" << params[i] << "); ";
+        }
+        for (auto &var: variables) {
+            o << "const " << type_name << " "
+              << var.name << " = " << var.expression << "; ";
+        }
+        o << output_var << " = " << opencl_operation << "; }";
+        return o.str();
+    }
+
     virtual const NodeRef apply_chain_rule(const NodeRef &wrt_input,
                                    const NodeRef &d_target_wrt_this,
                                    const NodeRefList &all_inputs) const {
@@ -128,7 +156,7 @@ public:
                                        const std::string &expression) const {
         std::ostringstream o;
         o << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
-            "__kernel __attribute__((reqd_work_group_size(64, 1, 1)))\n"
+            "__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))\n"
             "void transform(\n"
           << "\t__global " << input_type_name << " *source,\n"
           << "\t__global " << output_type_name << " *output,\n"
@@ -138,14 +166,14 @@ public:
               << i << (i == NumParams - 1 ? ')' : ',') << '\n';
         }
         o << "{\n"
-          << "\tconst size_t i = get_global_id(0);\n"
-          << "\tconst " << output_type_name << " v = source[i];\n";
+          << "\tfor (ulong i = get_global_id(0); i < result_size; "
+             "i += get_global_size(0)) {\n"
+          << "\t\tconst " << output_type_name << " v = source[i];\n";
         for (auto &var: variables) {
-            o << "\tconst " << output_type_name << " "
+            o << "\t\tconst " << output_type_name << " "
               << var.name << " = " << var.expression << ";\n";
         }
-        o << "\tif (i < result_size) { output[i] = " << expression
-          << "; }\n}\n";
+        o << "\t\toutput[i] = " << expression << ";\n\t}\n}\n";
         return o.str();
     }
 
@@ -157,16 +185,18 @@ public:
             const std::size_t result_size,
             const std::vector<cl::Event> &wait_for_events) const {
         auto context = get_context_from_queue(queue);
+        const auto launch = WorkGroupTuner::get_default().launch_config(
+            get_device_from_queue(queue), KernelFamily::Transform);
         auto program = CodeCache::get_default().get_program(
             context,
             queue,
             program_name,
             kernel_source,
-            "");
+            launch.build_options());
         cl::Kernel kernel;
-        std::vector<cl::Kernel> kernels;
         try {
-            kernel = cl::Kernel(program, "transform");
+            kernel = CodeCache::get_default().get_kernel(
+                program, "transform", queue);
         } catch (cl::Error &e) {
             throw std::runtime_error(get_opencl_error_string(e.err()));
         }
@@ -176,14 +206,12 @@ public:
         for (cl_uint i = 0; i < NumParams; ++i) {
             kernel.setArg(i + 3, to_array_type<T>(params[i]));
         }
-        constexpr std::size_t work_group_size = 64;
-        const auto work_items = make_divisible_by(work_group_size, result_size);
         cl::Event work_is_done;
         queue.enqueueNDRangeKernel(
             kernel,
             cl::NullRange,
-            cl::NDRange(work_items),
-            cl::NDRange(work_group_size),
+            cl::NDRange(launch.global_size(result_size)),
+            cl::NDRange(launch.work_group_size),
             &wait_for_events,
             &work_is_done);
         return work_is_done;
@@ -406,6 +434,30 @@ public:
     const NodeRef partial_derivative(const NodeRef &input) const override;
 };
 
+/** Limits the values to [min_value, max_value] */
+class Clip : public ConstTransform<2> {
+public:
+    Clip(const NodeRef &input, float min_value, float max_value)
+        : ConstTransform<2>(
+            input, input->dtype(), {},
+            opencl_expression(input->dtype()),
+            "clip(",
+            std::string(", ") + std::to_string(min_value)
+            + ", " + std::to_string(max_value) + ")",
+            {min_value, max_value}) {
+        if (min_value > max_value) {
+            throw std::invalid_argument(
+                "The lower bound of clipping cannot exceed the upper one");
+        }
+    }
+
+    static std::string opencl_expression(ArrayType dtype) {
+        return "clamp(v, p0, p1)";
+    }
+
+    const NodeRef partial_derivative(const NodeRef &input) const override;
+};
+
 class Negate : public Scale {
 public:
     explicit Negate(const NodeRef &input) : Scale(input, -1) {}
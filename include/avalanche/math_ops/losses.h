@@ -24,6 +24,129 @@ public:
         const NodeRefList &all_inputs) const;
 };
 
+/**
+ * Cross-entropy between softmax of the logits (along the axis)
+ * and the labels, given as probabilities of the same shape:
+ * `-sum(labels * log(softmax(logits)))` for each row. A single kernel
+ * finds it as `log(sum(exp(logits))) * sum(labels) - sum(labels * logits)`,
+ * so the softmax itself is never written.
+ * The result has the shape of the logits without the axis.
+ */
+class SoftmaxCrossEntropy : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return {_logits, _labels}; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    ShapeDim axis() const { return _axis; }
+
+    static NodeRef make(const NodeRef &logits, const NodeRef &labels,
+                        ShapeDim axis = -1);
+
+protected:
+    const NodeRef _logits;
+    const NodeRef _labels;
+    const ShapeDim _axis;
+
+    SoftmaxCrossEntropy(const NodeRef &logits, const NodeRef &labels,
+                        ShapeDim axis);
+};
+
+/**
+ * Like `SoftmaxCrossEntropy`, but each row has a label of its own:
+ * the index of the right class (int32 or int64), so the labels have
+ * the shape of the result. The loss is `log(sum(exp(logits))) - logits[label]`,
+ * and neither it nor its gradient ever makes the one-hot labels.
+ * Labels out of range give NaN.
+ */
+class SparseSoftmaxCrossEntropy : public SoftmaxCrossEntropy {
+public:
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    static NodeRef make(const NodeRef &logits, const NodeRef &labels,
+                        ShapeDim axis = -1);
+
+private:
+    SparseSoftmaxCrossEntropy(const NodeRef &logits, const NodeRef &labels,
+                              ShapeDim axis);
+};
+
+/**
+ * The gradient of `SoftmaxCrossEntropy` (or of its sparse version)
+ * with respect to the logits: `g * (softmax(logits) * sum(labels) - labels)`,
+ * where `g` is the gradient of the loss of each row. Calculated by
+ * a single kernel. Cannot be differentiated itself.
+ */
+class SoftmaxCrossEntropyGradient : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override {
+        return {_gradient, _logits, _labels};
+    }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    /**
+     * @param gradient the gradient of the loss
+     * @param axis the (normalized) axis of the rows
+     * @param is_sparse whether the labels are indices of classes
+     */
+    static NodeRef make(const NodeRef &gradient, const NodeRef &logits,
+                        const NodeRef &labels, ShapeDim axis,
+                        bool is_sparse);
+
+private:
+    const NodeRef _gradient;
+    const NodeRef _logits;
+    const NodeRef _labels;
+    const ShapeDim _axis;
+    const bool _is_sparse;
+
+    SoftmaxCrossEntropyGradient(const NodeRef &gradient,
+                                const NodeRef &logits,
+                                const NodeRef &labels,
+                                ShapeDim axis, bool is_sparse);
+};
+
 } // namespace
 
 #endif //AVALANCHE_LOSSES_H
@@ -12,6 +12,8 @@
 
 namespace avalanche {
 
+struct FusedLaunch;
+
 class ShapeDimsToOnes {
 public:
     ShapeDimsToOnes(const NodeRef &shape_node, std::vector<ShapeDim> &dims_to_replace)
@@ -79,6 +81,14 @@ public:
     MultiArrayRef forward(const MultiArrayRef &value) const;
     MultiArrayRef forward(const MultiArrayRef &value,
                           const MultiArrayRef &to_be_like_value) const;
+    /**
+     * Reduces the value of `prologue` without writing it anywhere:
+     * the first step of the reduction calculates the elements
+     * from the `input_values` of the prologue while reading them.
+     */
+    MultiArrayRef forward_with_prologue(
+        const FusedElementWise &prologue,
+        const ArrayRefList &input_values) const;
 
     const NodeRef apply_chain_rule(
         const NodeRef &wrt_input,
@@ -91,8 +101,24 @@ public:
 
     bool use_in_back_propagation() const { return true; };
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const;
+    void collect_programs_with_prologue(
+        const cl::Device &device, const FusedElementWise &prologue,
+        ProgramSourceList &programs) const;
+
     std::string repr_extra() const;
 
+    std::string structure_key() const;
+
+    /**
+     * 0 if the reduction surely has nothing to reduce (the input has
+     * the shape of the result already), -1 otherwise
+     */
+    int passthrough_input(const NodeRef &input) const;
+    int passthrough_input(const NodeRef &input,
+                          const NodeRef &to_be_like) const;
+
 protected:
     struct ReductionStep {
         // Size of the final array after reduction
@@ -101,7 +127,7 @@ protected:
         std::size_t source_stride;
         // How big each block of sub-elements in the dimensions we cut
         std::size_t source_block;
-        // Size of the dimension we're cutting
+        // Size of the dimension we're cutting (or of several adjacent ones)
         std::size_t dim_size;
     };
 
@@ -118,14 +144,22 @@ protected:
 
 private:
 
+    // If a prologue is given, the first step reads its elements
+    // instead of the value (which can be nullptr then)
     MultiArrayRef partial_reduction(
         const MultiArrayRef &value,
         const std::vector<ReductionStep> &reduction_steps,
         const Shape &result_shape_dims_cut,
-        const Shape &result_shape_dims_kept) const;
-    MultiArrayRef full_reduction(const MultiArrayRef &value) const;
+        const Shape &result_shape_dims_kept,
+        const FusedElementWise *prologue = nullptr,
+        const FusedLaunch *prologue_launch = nullptr) const;
+    MultiArrayRef full_reduction(
+        const MultiArrayRef &value,
+        const FusedElementWise *prologue = nullptr,
+        const FusedLaunch *prologue_launch = nullptr) const;
 
     const std::string get_kernel_name(bool is_partial_reduction) const;
+    const std::string get_cooperative_kernel_name() const;
     void estimate_steps_and_dimensions(
         const Shape &input_shape,
         const std::vector<ShapeDim> &dims_to_cut,
@@ -173,8 +207,111 @@ public:
     // TODO: Implement partial derivative
 };
 
+/**
+ * Softmax along one axis, calculated by a single kernel. The maximum
+ * of each row and the sum of exponents shifted by it are found in one
+ * pass over the row, so large values don't overflow. The results are
+ * written in the second pass.
+ * Long rows get a whole work group each, merging the sums in local memory.
+ */
+class Softmax : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return {_input}; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    ShapeDim axis() const { return _axis; }
+
+    static NodeRef make(const NodeRef &input, ShapeDim axis = -1);
+
+private:
+    const NodeRef _input;
+    const ShapeDim _axis;
+    // The chain rule needs the output of the node itself
+    std::weak_ptr<BaseNode> _self;
+
+    Softmax(const NodeRef &input, ShapeDim axis);
+};
+
+/**
+ * The derivative of `Softmax` given the gradient of its output and
+ * the output itself: `y * (g - sum(g * y))` along the axis, calculated
+ * by a single kernel. Cannot be differentiated itself.
+ */
+class SoftmaxGradient : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return {_gradient, _softmax}; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    /**
+     * @param gradient the gradient of the output of softmax
+     * @param softmax the output itself
+     * @param axis the (normalized) axis softmax works along
+     */
+    static NodeRef make(const NodeRef &gradient, const NodeRef &softmax,
+                        ShapeDim axis);
+
+private:
+    const NodeRef _gradient;
+    const NodeRef _softmax;
+    const ShapeDim _axis;
+
+    SoftmaxGradient(const NodeRef &gradient, const NodeRef &softmax,
+                    ShapeDim axis);
+};
+
 const NodeRef softmax(const NodeRef &node, ShapeDim axis=-1);
 
+/** The program with all kernels working on rows of softmax */
+const ProgramSource& softmax_program_source();
+
+/**
+ * Runs one of the kernels from softmax.opencl working on rows along
+ * the axis, choosing between its versions (`<family>_rows_<types>` and
+ * `<family>_coop_<types>`) by the shape of the rows.
+ * @param sources arrays passed to the kernel (each with its offset)
+ * @param rows_shape the shape consisting of the rows
+ * @returns a new array the kernel writes to
+ */
+MultiArrayRef launch_softmax_kernel(const std::string &kernel_family,
+                                    const std::string &types_suffix,
+                                    const ArrayRefList &sources,
+                                    const Shape &rows_shape,
+                                    ShapeDim axis,
+                                    const Shape &result_shape,
+                                    ArrayType result_dtype);
+
 } // namespace
 
 #endif //AVALANCHE_REDUCTIONS_H
@@ -21,6 +21,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 class ElemWisePlus : public ElemWiseBinaryOp {
@@ -37,6 +39,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 class Minus : public BroadcastedBinaryOp {
@@ -53,6 +57,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 
@@ -69,6 +75,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 
@@ -86,6 +94,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 
@@ -112,6 +122,8 @@ public:
         const NodeRef &wrt_input,
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
+
+    int passthrough_input(const NodeRef &left, const NodeRef &right) const;
 };
 
 class Power : public BroadcastedBinaryOp {
@@ -145,6 +157,51 @@ public:
 };
 
 
+/**
+ * Sum of any number of arrays of the same shape, calculated by one kernel
+ * reading all of them at once. Unlike a chain of `ElemWisePlus` nodes,
+ * writes no intermediate sums, which is why back-propagation uses it
+ * for adding up the gradients a node gets from all of its consumers.
+ */
+class AddN : public BaseNode {
+public:
+    MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    std::string to_string() const override;
+
+    std::string repr() const override;
+
+    NodeRefList inputs() const override { return _inputs; }
+
+    const NodeRef apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const override;
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
+    std::string elementwise_code(const std::vector<std::string> &input_vars,
+                                 const std::string &output_var) const override;
+
+    /**
+     * @param inputs at least one node, all of the same shape. Returns
+     *    the only node as it is.
+     */
+    static NodeRef make(const NodeRefList &inputs);
+
+private:
+    const NodeRefList _inputs;
+    std::string _kernel_name;
+    std::string _kernel_source;
+
+    explicit AddN(const NodeRefList &inputs);
+};
+
+
 inline NodeRef operator+(const NodeRef &node1, const NodeRef &node2) {
     return F<Plus>(node1, node2);
 }
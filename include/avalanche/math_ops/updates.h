@@ -30,10 +30,22 @@ public:
 
     std::string name() const { return _operation_name; }
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const;
+
+    /** Ops with the same key can be evaluated together by `forward_batch` */
+    std::string batch_key() const { return _kernel_name; }
+
+    /** Updates many variables at once, using a single kernel launch */
+    ArrayRefList forward_batch(
+        const std::vector<ArrayRefList> &input_values) const;
+
 private:
     Shape _result_shape;
     ArrayType _result_dtype;
+    ArrayType _update_dtype;
     std::string _operation_name;
+    std::string _operation_code;
     std::string _kernel_name;
     std::string _kernel_source;
 };
@@ -15,5 +15,6 @@
 #include "avalanche/math_ops/ElemWiseBinaryOp.h"
 #include "avalanche/math_ops/losses.h"
 #include "avalanche/random_nodes.h"
+#include "avalanche/device_nodes.h"
 
 #endif //AVALANCHE_MATH_OPS_H
@@ -13,6 +13,9 @@ class UniformRandom : public BaseNode {
 public:
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
     const NodeRef
     apply_chain_rule(const NodeRef &wrt_input, const NodeRef &d_target_wrt_this,
                      const NodeRefList &all_inputs) const override {
@@ -25,6 +28,11 @@ public:
 
     NodeRefList inputs() const override { return NodeRefList(); }
 
+    bool is_pure() const override { return false; }
+
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const override;
+
     /**
      *
      * @param shape
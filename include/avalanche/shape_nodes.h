@@ -44,6 +44,10 @@ public:
 
     bool use_in_back_propagation() const { return false; }
 
+    std::string structure_key() const { return "the input as is"; }
+
+    int passthrough_input(const NodeRef &input) const { return 0; }
+
     const NodeRef apply_chain_rule(const NodeRef &wrt_input,
                                    const NodeRef &d_target_wrt_this,
                                    const NodeRefList &all_inputs) const;;
@@ -90,6 +94,10 @@ public:
         const NodeRefList &all_inputs) const;
 
     bool use_in_back_propagation() const { return true; }
+
+    int passthrough_input(const NodeRef &input) const {
+        return input->shape() == _new_shape ? 0 : -1;
+    }
 private:
     const Shape _new_shape;
     const ArrayType _result_dtype;
@@ -100,6 +108,9 @@ class ReshapeLike : public BaseNode {
 public:
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
     std::string to_string() const override;
 
     NodeRefList inputs() const override;
@@ -113,6 +124,8 @@ public:
 
     bool use_in_back_propagation() const override { return true; }
 
+    int passthrough_input() const override;
+
     /**
      * Reshapes `input` to have the shape like `like_node`.
      */
@@ -314,6 +327,9 @@ public:
         const NodeRef &d_target_wrt_this,
         const NodeRefList &all_inputs) const;
 
+    void collect_programs(const cl::Device &device,
+                          ProgramSourceList &programs) const;
+
 private:
     Shape _orig_shape;
     Shape _tiled_shape;
@@ -331,6 +347,9 @@ public:
 
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
     const NodeRef apply_chain_rule(
             const NodeRef &wrt_input,
             const NodeRef &d_target_wrt_this,
@@ -102,6 +102,19 @@ public:
     // we should actually use as the input.
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    // The initializer's dependencies are needed only until the variable
+    // gets its value, so all of them are lazy
+    std::size_t num_eager_inputs() const override { return 0; }
+
+    std::vector<std::size_t> lazy_inputs_to_evaluate(
+        Context &context, const ArrayRefList &eager_values) const override;
+
+    // The value lives in the Context and can be changed at any moment
+    bool is_pure() const override { return false; }
+
     std::string to_string() const override {
         return name;
     }
@@ -162,16 +175,33 @@ public:
     }
 
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
+
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
+    // A placeholder is evaluated only when no value has been fed into it,
+    // and every time it happens the initializer has to be called again
+    std::vector<std::size_t> lazy_inputs_to_evaluate(
+        Context &context, const ArrayRefList &eager_values) const override;
 };
 
 
 class Constant : public BaseNode {
 public:
 
+    /**
+     * @param structure_key non-empty only if the value of the constant
+     *   is completely described by the key and the dependencies
+     *   of the initializer (see `BaseNode::structure_key`)
+     */
     explicit Constant(std::string name, Initializer initializer,
-                      Shape shape, ArrayType dtype)
+                      Shape shape, ArrayType dtype,
+                      std::string structure_key = "")
         :_initializer{initializer},
-         _name{name}
+         _name{name},
+         _structure_key{structure_key},
+         _is_filled{false},
+         _fill_value{0}
     {
         set_dtype(dtype);
         set_shape(shape);
@@ -179,6 +209,9 @@ public:
 
     MultiArrayRef eval(Context &context, ExecutionCache &cache) const override;
 
+    MultiArrayRef forward(Context &context, ExecutionCache &cache,
+                          const ArrayRefList &input_values) const override;
+
     std::string to_string() const override {
         return "Constant(" + _name + ")";
     }
@@ -191,6 +224,22 @@ public:
         return _initializer ? _initializer.dependencies : NodeRefList();
     }
 
+    std::string structure_key() const override { return _structure_key; }
+
+    /**
+     * Whether the constant was made by one of the `fill` family
+     * of methods with the given value
+     */
+    bool is_filled_with(float value) const {
+        return _is_filled && _fill_value == value;
+    }
+
+    /** Same for any node, which doesn't have to be a constant */
+    static bool is_filled_with(const NodeRef &node, float value) {
+        auto constant = dynamic_cast<const Constant*>(node.get());
+        return constant != nullptr && constant->is_filled_with(value);
+    }
+
     const NodeRef
     apply_chain_rule(const NodeRef &wrt_input, const NodeRef &d_target_wrt_this,
                      const NodeRefList &all_inputs) const override {
@@ -266,9 +315,26 @@ public:
     static const NodeRef fill_like(const NodeRef &other_node, float value);
     static const NodeRef fill_like_with_type(const NodeRef &other_node, ArrayType dtype, float value);
 
+    /**
+     * A constant keeping the value of the given node, which must depend
+     * only on other constants (see `BaseNode::is_pure`). The node gets
+     * evaluated only once per Context, the first time the constant is used.
+     */
+    static const NodeRef make_from_node(const NodeRef &node);
+
+    /**
+     * A constant replacing the node (usually a variable) forever,
+     * with the given value of it (see `freeze`)
+     */
+    static const NodeRef make_frozen(const NodeRef &node,
+                                     const MultiArrayRef &value);
+
 private:
     Initializer _initializer;
     std::string _name;
+    std::string _structure_key;
+    bool _is_filled;
+    float _fill_value;
 };
 
 
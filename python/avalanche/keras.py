@@ -21,6 +21,11 @@ def floatx():
     return keras_floatx()
 
 
+def _epsilon():
+    from keras.backend.common import epsilon as keras_epsilon
+    return keras_epsilon()
+
+
 def get_context(device_id: int=None) -> av.Context:
     """
     Returns computational context (similar to tf.Session) for any currently
@@ -466,11 +471,13 @@ def dot(x, y):
         (2, 4, 5)
     ```
     """
-    if ndim(x) != 2 and ndim(y) != 2:
-        raise ValueError(
-            'dot product is currently implemented only for 2D tensors')
-    out = av.ops.matmul(x, y)
-    return out
+    if ndim(x) == 2 and ndim(y) == 2:
+        return av.ops.matmul(x, y)
+    if ndim(x) >= 2 and ndim(y) == 2:
+        return av.ops.batch_matmul(x, y)
+    raise ValueError(
+        'dot product is currently implemented only for nD and 2D tensors '
+        '(Theano-like behavior is not supported)')
 
 
 def image_data_format():
@@ -991,6 +998,56 @@ def binary_crossentropy(target, output, from_logits=False):
     return av.ops.binary_crossentropy(output, target)
 
 
+def categorical_crossentropy(target, output, from_logits=False, axis=-1):
+    """Categorical crossentropy between an output tensor and a target tensor.
+
+    # Arguments
+        target: A tensor of the same shape as `output`.
+        output: A tensor resulting from a softmax
+            (unless `from_logits` is True, in which
+            case `output` is expected to be the logits).
+        from_logits: Boolean, whether `output` is the
+            result of a softmax, or is a tensor of logits.
+        axis: Int specifying the channels axis.
+
+    # Returns
+        Output tensor.
+    """
+    if not from_logits:
+        # Softmax of the logarithms just normalizes the probabilities.
+        # Clipping keeps the logarithms (and their gradients) finite.
+        eps = _epsilon()
+        output = av.ops.log(av.ops.clip(output, eps, 1. - eps))
+    return av.ops.softmax_cross_entropy(output, target, axis)
+
+
+def sparse_categorical_crossentropy(target, output, from_logits=False,
+                                    axis=-1):
+    """Categorical crossentropy with integer targets.
+
+    # Arguments
+        target: An integer tensor.
+        output: A tensor resulting from a softmax
+            (unless `from_logits` is True, in which
+            case `output` is expected to be the logits).
+        from_logits: Boolean, whether `output` is the
+            result of a softmax, or is a tensor of logits.
+        axis: Int specifying the channels axis.
+
+    # Returns
+        Output tensor.
+    """
+    if not from_logits:
+        eps = _epsilon()
+        output = av.ops.log(av.ops.clip(output, eps, 1. - eps))
+    if target.shape.rank == output.shape.rank:
+        # Targets like (batch_size, 1) have the class dimension kept
+        target = av.ops.squeeze(target, axis)
+    if target.dtype not in (av.ArrayType.int32, av.ArrayType.int64):
+        target = av.ops.cast(target, av.ArrayType.int64)
+    return av.ops.sparse_softmax_cross_entropy(output, target, axis)
+
+
 def concatenate(tensors, axis=-1):
     """Concatenates a list of tensors alongside the specified axis.
 
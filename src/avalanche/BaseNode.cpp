@@ -1,7 +1,50 @@
 #include <sstream>
+#include <typeinfo>
+
+#include <fmt/format.h>
 
 #include "avalanche/BaseNode.h"
 
+avalanche::MultiArrayRef
+avalanche::BaseNode::forward(Context &context, ExecutionCache &cache,
+                             const ArrayRefList &input_values) const {
+    throw std::logic_error(
+        fmt::format("Node {} cannot be evaluated from the values of its inputs",
+                    repr()));
+}
+
+avalanche::ArrayRefList
+avalanche::BaseNode::forward_batch(
+        Context &context, ExecutionCache &cache,
+        const std::vector<ArrayRefList> &input_values) const {
+    throw std::logic_error(
+        fmt::format("Node {} cannot be evaluated in batches", repr()));
+}
+
+avalanche::MultiArrayRef
+avalanche::BaseNode::forward_with_prologue(
+        Context &context, ExecutionCache &cache,
+        const FusedElementWise &prologue,
+        const ArrayRefList &input_values) const {
+    throw std::logic_error(
+        fmt::format("Node {} cannot have element-wise prologues", repr()));
+}
+
+std::string avalanche::BaseNode::structure_key() const {
+    if (!is_pure()) {
+        return "";
+    }
+    std::vector<std::string> input_vars;
+    for (std::size_t i = 0; i < inputs().size(); ++i) {
+        input_vars.push_back(fmt::format("x{}", i));
+    }
+    auto code = elementwise_code(input_vars, "y");
+    if (code.empty()) {
+        return "";
+    }
+    return fmt::format("{}: {}", typeid(*this).name(), code);
+}
+
 std::string avalanche::BaseNode::format_repr(const std::string &operation,
                                              const std::string &name,
                                              const std::string &extra) const {
@@ -0,0 +1,107 @@
+#include <fmt/format.h>
+
+#include "avalanche/BufferArena.h"
+#include "avalanche/CLBuffer.h"
+
+namespace avalanche {
+
+struct ArenaOfferState {
+    BufferArena *arena;
+    std::size_t block_index;
+};
+
+static thread_local ArenaOfferState current_offer = {nullptr, 0};
+
+
+BufferArena::BufferArena(const BufferPoolRef &pool,
+                         const std::vector<Block> &blocks)
+    :_pool{pool},
+     _byte_size{0},
+     _blocks{blocks},
+     _overlapping_blocks(blocks.size()),
+     _in_use(blocks.size(), 0)
+{
+    for (const auto &block: _blocks) {
+        if (block.size == 0) {
+            throw std::invalid_argument("Arena blocks cannot be empty");
+        }
+        _byte_size = std::max(_byte_size, block.offset + block.size);
+    }
+    if (_byte_size == 0) {
+        return;
+    }
+    _arena_buffer = cl::Buffer(_pool->cl_context(), CL_MEM_READ_WRITE,
+                               _byte_size);
+    for (std::size_t i = 0; i < _blocks.size(); ++i) {
+        cl_buffer_region region {_blocks[i].offset, _blocks[i].size};
+        _sub_buffers.emplace_back(
+            _arena_buffer.createSubBuffer(
+                CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region));
+        for (std::size_t j = 0; j < _blocks.size(); ++j) {
+            if (i != j
+                    && _blocks[i].offset < _blocks[j].offset + _blocks[j].size
+                    && _blocks[j].offset < _blocks[i].offset + _blocks[i].size) {
+                _overlapping_blocks[i].push_back(j);
+            }
+        }
+    }
+}
+
+std::shared_ptr<BufferArena>
+BufferArena::make(const BufferPoolRef &pool, const std::vector<Block> &blocks) {
+    return std::shared_ptr<BufferArena>(new BufferArena(pool, blocks));
+}
+
+std::shared_ptr<CLBuffer> BufferArena::acquire(std::size_t block_index) {
+    if (block_index >= _blocks.size()) {
+        throw std::out_of_range(
+            fmt::format("The arena has only {} blocks", _blocks.size()));
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_in_use[block_index]) {
+            return nullptr;
+        }
+        for (auto other: _overlapping_blocks[block_index]) {
+            if (_in_use[other]) {
+                return nullptr;
+            }
+        }
+        _in_use[block_index] = 1;
+    }
+    auto *buffer_wrapper = new CLBuffer(
+        _pool, cl::Buffer(_sub_buffers[block_index]),
+        _blocks[block_index].size,
+        CLBufferPool::find_mem_slot(_blocks[block_index].size));
+    buffer_wrapper->_arena = shared_from_this();
+    buffer_wrapper->_arena_block = block_index;
+    return std::shared_ptr<CLBuffer>(buffer_wrapper);
+}
+
+void BufferArena::release(std::size_t block_index) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_use[block_index] = 0;
+}
+
+std::shared_ptr<CLBuffer>
+BufferArena::take_offered_block(const CLBufferPool *pool,
+                                std::size_t size_in_bytes) {
+    auto *arena = current_offer.arena;
+    if (arena == nullptr
+            || arena->_pool.get() != pool
+            || arena->_blocks[current_offer.block_index].size != size_in_bytes) {
+        return nullptr;
+    }
+    current_offer.arena = nullptr;
+    return arena->acquire(current_offer.block_index);
+}
+
+ArenaOffer::ArenaOffer(BufferArena *arena, std::size_t block_index) {
+    current_offer = {arena, block_index};
+}
+
+ArenaOffer::~ArenaOffer() {
+    current_offer = {nullptr, 0};
+}
+
+} // namespace
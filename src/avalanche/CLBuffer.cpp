@@ -4,6 +4,7 @@
 #include "avalanche/logging.h"
 #include "avalanche/CLBuffer.h"
 #include "avalanche/CLBufferPool.h"
+#include "avalanche/BufferArena.h"
 #include "avalanche/opencl_utils.h"
 
 
@@ -36,7 +37,9 @@ CLBuffer::CLBuffer(
     :_pool{pool}, _cl_buffer{cl_buffer}, _size{size}, _bucket{bucket},
      _ready_event{nullptr},
      _ready_promise{std::promise<void>()},
-     _is_ready{_ready_promise.get_future()} {
+     _is_ready{_ready_promise.get_future()},
+     _arena{nullptr},
+     _arena_block{0} {
 }
 
 void CLBuffer::set_completion_event(const cl::Event &event) {
@@ -59,8 +62,14 @@ CLBuffer::~CLBuffer() {
         wait_until_ready();
         _dependencies.clear();
         _ready_event = nullptr;
-        _pool->return_buffer(std::move(_cl_buffer), _bucket);
-        _cl_buffer = nullptr;
+        if (_arena) {
+            _cl_buffer = nullptr;
+            _arena->release(_arena_block);
+            _arena = nullptr;
+        } else {
+            _pool->return_buffer(std::move(_cl_buffer), _bucket);
+            _cl_buffer = nullptr;
+        }
         _pool = nullptr;
     }
 }
@@ -69,8 +78,9 @@ void CLBuffer::wait_until_ready() const {
     if (_ready_event.get() != nullptr) {
         // Intel OpenCL framework can be very reluctant in sending commands
         // to devices, and we should encourage it to do so before we start
-        // waiting for any events to happen.
-        pool_queue().flush();
+        // waiting for any events to happen. The event may come from
+        // any queue of the pool, or depend on commands from other queues.
+        _pool->flush_all_queues();
         if (_is_ready.valid()) {
             _is_ready.get();  // to make sure the callback has been called too
         }
@@ -2,8 +2,11 @@
 #include <cfenv>
 #include <iostream>
 
+#include <fmt/format.h>
+
 #include "avalanche/CLBufferPool.h"
 #include "avalanche/CLBuffer.h"
+#include "avalanche/BufferArena.h"
 #include "avalanche/opencl_utils.h"
 #include "avalanche/MultiArray.h"
 #include "avalanche/CLMemoryManager.h"
@@ -17,20 +20,25 @@
 
 namespace avalanche {
 
+static thread_local const CLBufferPool *selected_pool = nullptr;
+static thread_local std::size_t selected_queue_index = 0;
+
 
 CLBufferPool::CLBufferPool(
     CLMemoryManager* memory_manager,
     std::size_t device_index,
     const cl::Context &context,
-    const cl::CommandQueue &device_queue)
+    const std::vector<cl::CommandQueue> &device_queues)
     :_memory_manager{memory_manager},
      _device_index{device_index},
      _cl_context{context},
-     _device_queue{device_queue},
-     _cl_device{get_device_from_queue(device_queue)} {
+     _device_queues{device_queues},
+     _cl_device{get_device_from_queue(device_queues.at(0))} {
 
 }
 CLBufferPool::~CLBufferPool() {
+    std::lock_guard<std::mutex> lock(_constant_data_mutex);
+    wait_for_constant_data_uploads();
 }
 
 
@@ -45,6 +53,11 @@ CLBufferPool::reserve_buffer(std::size_t size_in_bytes) {
         throw std::invalid_argument(
             "The size must be greater than zero and less than MaxBufferSize");
     }
+    // The Executor may have already planned where the buffer should live
+    auto arena_buffer = BufferArena::take_offered_block(this, size_in_bytes);
+    if (arena_buffer) {
+        return arena_buffer;
+    }
     long bucket_idx = find_mem_slot(size_in_bytes);
     cl::Buffer cl_buffer;
     {
@@ -64,6 +77,48 @@ CLBufferPool::reserve_buffer(std::size_t size_in_bytes) {
     return std::shared_ptr<CLBuffer>(buffer_wrapper);
 }
 
+CLBufferPool::ConstantData
+CLBufferPool::constant_data(const void *data, std::size_t size_in_bytes) {
+    if (size_in_bytes == 0 || size_in_bytes > MaxBufferSize) {
+        throw std::invalid_argument(
+            "The size must be greater than zero and less than MaxBufferSize");
+    }
+    std::string key(static_cast<const char*>(data), size_in_bytes);
+    std::lock_guard<std::mutex> lock(_constant_data_mutex);
+    auto found = _constant_data.find(key);
+    if (found != _constant_data.end()) {
+        return found->second;
+    }
+    if (_constant_data.size() >= MaxConstantData) {
+        // Nothing can be freed while the data is still being written
+        wait_for_constant_data_uploads();
+        _constant_data.clear();
+    }
+    auto inserted = _constant_data.emplace(key, ConstantData()).first;
+    auto &constant = inserted->second;
+    constant.buffer = cl::Buffer(_cl_context, CL_MEM_READ_ONLY, size_in_bytes);
+    // The key lives as long as the buffer, so the writing needs no waiting
+    cl_queue().enqueueWriteBuffer(
+        constant.buffer, CL_FALSE, 0, size_in_bytes, inserted->first.data(),
+        nullptr, &constant.is_uploaded);
+    return constant;
+}
+
+std::size_t CLBufferPool::num_constant_data() const {
+    std::lock_guard<std::mutex> lock(_constant_data_mutex);
+    return _constant_data.size();
+}
+
+void CLBufferPool::wait_for_constant_data_uploads() {
+    std::vector<cl::Event> uploads;
+    for (const auto &item: _constant_data) {
+        uploads.push_back(item.second.is_uploaded);
+    }
+    if (!uploads.empty()) {
+        cl::WaitForEvents(uploads);
+    }
+}
+
 long CLBufferPool::find_mem_slot(size_t size) {
     int save_round = fegetround();
     fesetround(FE_UPWARD);
@@ -94,9 +149,47 @@ std::shared_ptr<CLBufferPool> CLBufferPool::own_reference() {
     return _memory_manager->buffer_pool(_device_index);
 }
 
+cl::CommandQueue& CLBufferPool::cl_queue() {
+    if (selected_pool == this) {
+        return _device_queues[selected_queue_index];
+    }
+    return _device_queues.front();
+}
+
+const cl::CommandQueue& CLBufferPool::cl_queue() const {
+    if (selected_pool == this) {
+        return _device_queues[selected_queue_index];
+    }
+    return _device_queues.front();
+}
+
+void CLBufferPool::flush_all_queues() {
+    for (auto &queue: _device_queues) {
+        queue.flush();
+    }
+}
+
 bool CLBufferPool::queue_support_ooo_execution() const {
     return _memory_manager->device_info(_device_index).supports_out_of_order_execution;
 }
 
 
+QueueSelection::QueueSelection(const CLBufferPool *pool,
+                               std::size_t queue_index)
+    :_previous_pool{selected_pool},
+     _previous_queue_index{selected_queue_index}
+{
+    if (pool != nullptr && queue_index >= pool->num_queues()) {
+        throw std::out_of_range(
+            fmt::format("The pool has only {} queues", pool->num_queues()));
+    }
+    selected_pool = pool;
+    selected_queue_index = queue_index;
+}
+
+QueueSelection::~QueueSelection() {
+    selected_pool = _previous_pool;
+    selected_queue_index = _previous_queue_index;
+}
+
 } // namespace
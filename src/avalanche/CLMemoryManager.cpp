@@ -11,7 +11,14 @@ void CLMemoryManager::init_for_all_gpus() {
     init_for_all(CL_DEVICE_TYPE_GPU);
 }
 
-void CLMemoryManager::init_for_all(const cl_device_type device_type) {
+constexpr std::size_t CLMemoryManager::DefaultQueuesPerDevice;
+
+void CLMemoryManager::init_for_all(const cl_device_type device_type,
+                                   std::size_t queues_per_device) {
+    if (queues_per_device == 0) {
+        throw std::invalid_argument(
+            "Each device needs at least one command queue");
+    }
     std::vector<cl::Platform> all_platforms;
     cl::Platform::get(&all_platforms);
     for (const auto &platform: all_platforms) {
@@ -33,33 +40,40 @@ void CLMemoryManager::init_for_all(const cl_device_type device_type) {
                 if (is_new_device) {
                     std::cout << "Registered OpenCL device "
                               << device_name << "\n";
-                    cl::CommandQueue queue;
-                    bool supports_ooo_execution;
-                    try {
-                        queue = cl::CommandQueue(
-                            context, device,
-                            CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
-                        supports_ooo_execution = true;
-                    } catch (cl::Error &e) {
-                        if (e.err() == CL_INVALID_VALUE ||
-                                e.err() == CL_INVALID_QUEUE_PROPERTIES) {
-                            std::cerr
-                                << "The platform (" << platform_name
-                                << ") doesn't support out of order "
-                                << "execution. Falling back to default mode.\n";
+                    std::vector<cl::CommandQueue> queues;
+                    bool supports_ooo_execution = true;
+                    for (std::size_t i = 0; i < queues_per_device; ++i) {
+                        cl::CommandQueue queue;
+                        if (supports_ooo_execution) {
+                            try {
+                                queue = cl::CommandQueue(
+                                    context, device,
+                                    CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+                            } catch (cl::Error &e) {
+                                if (e.err() == CL_INVALID_VALUE ||
+                                        e.err() == CL_INVALID_QUEUE_PROPERTIES) {
+                                    std::cerr
+                                        << "The platform (" << platform_name
+                                        << ") doesn't support out of order "
+                                        << "execution. Falling back to default mode.\n";
+                                }
+                                supports_ooo_execution = false;
+                            }
+                        }
+                        if (!supports_ooo_execution) {
                             // Apple OpenCL platform may not support
                             // out-of-order execution and not differentiate
                             // between these two error codes.
                             queue = cl::CommandQueue(context, device, 0);
                         }
-                        supports_ooo_execution = false;
+                        queues.push_back(queue);
                     }
 
 //                        (device_name == "Iris" ?
 //                         0 : CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE));
                     _buffer_pools.push_back(
                         std::make_shared<CLBufferPool>(
-                            this, _device_counter, context, queue));
+                            this, _device_counter, context, queues));
                     _device_info.push_back(
                         DeviceInfo({device_name, platform_name,
                                     _device_counter, supports_ooo_execution}));
@@ -1,5 +1,17 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
 #include <iostream>
+#include <set>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
 
 #include "avalanche/CLBufferPool.h"
 #include "avalanche/CodeCache.h"
@@ -10,68 +22,319 @@ namespace avalanche {
 
 static CodeCache default_code_cache;
 
+// Marks the files written by this version of the cache,
+// anything else is ignored
+constexpr char BinaryFileSignature[] = "avalanche-program-binary-v1";
+
+// FNV-1a, which (unlike std::hash) is guaranteed to give the same result
+// everywhere, so it can be used for naming the files
+static std::uint64_t stable_hash(const std::string &data) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (auto c: data) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string default_cache_directory() {
+    const char *path = std::getenv("AVALANCHE_KERNEL_CACHE_DIR");
+    if (path != nullptr) {
+        return path;
+    }
+    path = std::getenv("XDG_CACHE_HOME");
+    if (path != nullptr && *path != '\0') {
+        return std::string(path) + "/avalanche/kernels";
+    }
+    path = std::getenv("HOME");
+    if (path != nullptr && *path != '\0') {
+        return std::string(path) + "/.cache/avalanche/kernels";
+    }
+    return "";
+}
+
+static bool make_directories(const std::string &path) {
+    for (std::size_t pos = 1; pos <= path.size(); ++pos) {
+        if (pos == path.size() || path[pos] == '/') {
+            auto sub_path = path.substr(0, pos);
+            if (mkdir(sub_path.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool read_binary_file(const std::string &file_path,
+                             const std::string &full_key,
+                             std::vector<char> &binary) {
+    std::ifstream file(file_path, std::ios::binary);
+    std::string signature;
+    if (!file || !std::getline(file, signature, '\0')
+            || signature != BinaryFileSignature) {
+        return false;
+    }
+    std::uint64_t key_size, binary_size;
+    if (!file.read(reinterpret_cast<char*>(&key_size), sizeof(key_size))
+            || key_size != full_key.size()) {
+        return false;
+    }
+    // The whole key is stored along with the binary, so even
+    // a collision of hashes cannot bring a wrong program
+    std::string stored_key(key_size, '\0');
+    if (!file.read(&stored_key[0], key_size) || stored_key != full_key) {
+        return false;
+    }
+    if (!file.read(reinterpret_cast<char*>(&binary_size), sizeof(binary_size))
+            || binary_size == 0) {
+        return false;
+    }
+    // A truncated or damaged file must not make us allocate
+    // more than the file could possibly hold
+    const auto binary_start = file.tellg();
+    if (binary_start < 0 || !file.seekg(0, std::ios::end)) {
+        return false;
+    }
+    const auto bytes_left = static_cast<std::uint64_t>(
+        file.tellg() - binary_start);
+    if (binary_size != bytes_left || !file.seekg(binary_start)) {
+        return false;
+    }
+    binary.resize(binary_size);
+    return static_cast<bool>(file.read(binary.data(), binary_size));
+}
+
+static void write_binary_file(const std::string &directory,
+                              const std::string &file_path,
+                              const std::string &full_key,
+                              const std::vector<char> &binary) {
+    if (!make_directories(directory)) {
+        return;
+    }
+    // Other processes may be reading the same file right now,
+    // so it's written aside and then atomically renamed
+    auto temp_path = fmt::format("{}.{}.tmp", file_path, getpid());
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        std::uint64_t key_size = full_key.size();
+        std::uint64_t binary_size = binary.size();
+        file.write(BinaryFileSignature, sizeof(BinaryFileSignature));
+        file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        file.write(full_key.data(), key_size);
+        file.write(reinterpret_cast<const char*>(&binary_size),
+                   sizeof(binary_size));
+        file.write(binary.data(), binary_size);
+        if (!file) {
+            file.close();
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp_path.c_str(), file_path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+    }
+}
+
+static cl::Program compile_program(const cl::Context &context,
+                                   const cl::Device &device,
+                                   const std::string &source,
+                                   const std::string &program_options) {
+    cl::Program program(context, source, false);
+    try {
+        program.build({device}, program_options.c_str());
+    } catch (cl::Error &e) {
+        if (e.err() == CL_BUILD_PROGRAM_FAILURE) {
+            std::ostringstream full_log;
+            cl_build_status status =
+            program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device);
+            std::string name = device.getInfo<CL_DEVICE_NAME>();
+            std::string buildlog = (
+                program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+            full_log << "Build log for " << name << ":\n"
+                << buildlog << std::endl;
+            std::cerr << full_log.str();
+        }
+        throw;
+    }
+    return program;
+}
+
+static std::vector<char> extract_binary(const cl::Program &program) {
+    size_t binary_size;
+    clGetProgramInfo(
+        program(), CL_PROGRAM_BINARY_SIZES,
+        sizeof(binary_size), &binary_size, nullptr);
+    std::vector<char> binary_data(binary_size);
+    char *program_pointers[1] = {binary_data.data()};
+    clGetProgramInfo(
+        program(), CL_PROGRAM_BINARIES,
+        sizeof(program_pointers), &program_pointers, nullptr);
+    return binary_data;
+}
+
+/**
+ * Returns false if the driver doesn't accept the binary
+ * (it might have been produced by another version of the driver)
+ */
+static bool load_program_binary(const cl::Context &context,
+                                const cl::Device &device,
+                                const std::vector<char> &binary,
+                                const std::string &program_options,
+                                cl::Program &program) {
+    size_t binary_size = binary.size();
+    cl_device_id cl_device = device();
+    const unsigned char *binary_ptr = (unsigned char *)binary.data();
+    cl_int binary_status = CL_SUCCESS;
+    cl_int error = CL_SUCCESS;
+    cl_program raw_program = clCreateProgramWithBinary(
+        context(), 1, &cl_device, &binary_size, &binary_ptr,
+        &binary_status, &error);
+    if (error != CL_SUCCESS || binary_status != CL_SUCCESS) {
+        if (raw_program != nullptr) {
+            clReleaseProgram(raw_program);
+        }
+        return false;
+    }
+    program = cl::Program(raw_program);
+    try {
+        program.build({device}, program_options.c_str());
+    } catch (cl::Error &e) {
+        return false;
+    }
+    return true;
+}
+
+static std::uint64_t new_code_cache_id() {
+    static std::atomic<std::uint64_t> last_id{0};
+    return ++last_id;
+}
+
+CodeCache::CodeCache()
+    :cache_directory_{default_cache_directory()},
+     num_loaded_from_disk_{0},
+     id_{new_code_cache_id()} {
+}
+
 cl::Program
 CodeCache::get_program(const cl::Context &context, const cl::Device &device,
                        const std::string &program_name,
                        const std::string &source,
                        const std::string &extra_options) {
-    cl::Program program;
+    return get_program(context, device, program_name,
+                       [&source]() { return source; }, extra_options);
+}
+
+cl::Program
+CodeCache::get_program(const cl::Context &context, const cl::Device &device,
+                       const std::string &program_name,
+                       const SourceGenerator &make_source,
+                       const std::string &extra_options) {
     ProgramCacheKey program_cache_key =
-        std::make_tuple(context(), device(), program_name);
-    auto search = program_cache_.find(program_cache_key);
-    if (search != program_cache_.end()) {
-        program = search->second;
+        std::make_tuple(context(), device(), program_name, extra_options);
+    std::promise<cl::Program> program_promise;
+    std::shared_future<cl::Program> program_is_ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto search = program_cache_.find(program_cache_key);
+        if (search != program_cache_.end()) {
+            program_is_ready = search->second;
+        } else {
+            program_cache_[program_cache_key] = (
+                program_promise.get_future().share());
+        }
+    }
+    if (program_is_ready.valid()) {
+        // Already built, or being built by another thread right now
+        return program_is_ready.get();
+    }
+    // Only this thread builds the program, the others wait for it
+    std::string program_options("-cl-std=CL1.2 ");
+    program_options += extra_options;
+    try {
+        auto program = build_program(context, device, program_name,
+                                     make_source(), program_options);
+        program_promise.set_value(program);
+        return program;
+    } catch (...) {
+        program_promise.set_exception(std::current_exception());
+        // The next attempt should try to build the program again
+        std::lock_guard<std::mutex> lock(mutex_);
+        program_cache_.erase(program_cache_key);
+        throw;
+    }
+}
+
+cl::Program CodeCache::build_program(const cl::Context &context,
+                                     const cl::Device &device,
+                                     const std::string &program_name,
+                                     const std::string &source,
+                                     const std::string &program_options) {
+    cl::Program program;
+    std::string device_name;
+    device.getInfo(CL_DEVICE_NAME, &device_name);
+    // Sources of the same program may differ (e.g. by generated kernels)
+    BinaryCacheKey binary_cache_key = std::make_tuple(
+        device_name, program_name, program_options, stable_hash(source));
+    std::vector<char> binary;
+    std::string cache_directory;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto binary_search = binary_cache_.find(binary_cache_key);
+        if (binary_search != binary_cache_.end()) {
+            binary = binary_search->second;
+        }
+        cache_directory = cache_directory_;
+    }
+    if (!binary.empty()
+            && load_program_binary(context, device, binary,
+                                   program_options, program)) {
+        return program;
+    }
+    if (cache_directory.empty()) {
+        program = compile_program(context, device, source, program_options);
+        binary = extract_binary(program);
     } else {
-        std::string device_name;
-        device.getInfo(CL_DEVICE_NAME, &device_name);
-        BinaryCacheKey binary_cache_key =
-            std::make_tuple(device_name, program_name);
-        auto search = binary_cache_.find(binary_cache_key);
-        if (search == binary_cache_.end()) {
-            program = cl::Program(context, source, false);
-            std::string program_options("-cl-std=CL1.2 ");
-            program_options += extra_options;
-            try {
-                program.build({device}, program_options.c_str());
-            } catch (cl::Error &e) {
-                if (e.err() == CL_BUILD_PROGRAM_FAILURE) {
-                    std::ostringstream full_log;
-                    cl_build_status status =
-                    program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device);
-                    std::string name = device.getInfo<CL_DEVICE_NAME>();
-                    std::string buildlog = (
-                        program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
-                    full_log << "Build log for " << name << ":\n"
-                        << buildlog << std::endl;
-                    std::cerr << full_log.str();
-                }
-                throw;
-            }
-            size_t binary_size;
-            clGetProgramInfo(
-                program(), CL_PROGRAM_BINARY_SIZES,
-                sizeof(binary_size), &binary_size, nullptr);
-            std::vector<char> binary_data(binary_size);
-            char *program_pointers[1] = {binary_data.data()};
-            clGetProgramInfo(
-                program(), CL_PROGRAM_BINARIES,
-                sizeof(program_pointers), &program_pointers, nullptr);
-            binary_cache_[binary_cache_key] = std::move(binary_data);
+        auto driver_version = device.getInfo<CL_DRIVER_VERSION>();
+        auto full_key = fmt::format(
+            "device: {}\ndriver: {}\noptions: {}\nsource:\n{}",
+            device_name, driver_version, program_options, source);
+        auto file_path = fmt::format(
+            "{}/{:016x}.bin", cache_directory, stable_hash(full_key));
+        if (read_binary_file(file_path, full_key, binary)
+                && load_program_binary(context, device, binary,
+                                       program_options, program)) {
+            ++num_loaded_from_disk_;
         } else {
-            auto &binary = search->second;
-            size_t binary_size = binary.size();
-            cl_device_id cl_device = device();
-            const unsigned char *binary_ptr = (unsigned char *)binary.data();
-            program = clCreateProgramWithBinary(
-                context(), 1, &cl_device, &binary_size, &binary_ptr,
-                nullptr, nullptr);
-            program.build();
+            program = compile_program(context, device, source,
+                                      program_options);
+            binary = extract_binary(program);
+            write_binary_file(cache_directory, file_path, full_key, binary);
         }
-        program_cache_[program_cache_key] = program;
     }
+    std::lock_guard<std::mutex> lock(mutex_);
+    binary_cache_[binary_cache_key] = std::move(binary);
     return program;
 }
 
+cl::Kernel CodeCache::get_kernel(const cl::Program &program,
+                                 const std::string &kernel_name,
+                                 const cl::CommandQueue &queue) {
+    // Each thread has its own kernels, which die together with it.
+    // The caches are told apart by their ids rather than addresses,
+    // since a new cache may take the place of a destroyed one.
+    thread_local std::map<std::uint64_t, KernelCache> kernels_of_caches;
+    auto &kernel_cache = kernels_of_caches[id_];
+    KernelCacheKey kernel_cache_key = std::make_tuple(
+        program(), kernel_name, queue());
+    auto search = kernel_cache.find(kernel_cache_key);
+    if (search != kernel_cache.end()) {
+        return search->second;
+    }
+    cl::Kernel kernel(program, kernel_name.c_str());
+    kernel_cache[kernel_cache_key] = kernel;
+    return kernel;
+}
+
 cl::Program CodeCache::get_program(const cl::Context &context,
                                    const cl::CommandQueue &queue,
                                    const std::string &program_name,
@@ -81,6 +344,68 @@ cl::Program CodeCache::get_program(const cl::Context &context,
                        program_name, source, extra_options);
 }
 
+cl::Program CodeCache::get_program(const cl::Context &context,
+                                   const cl::CommandQueue &queue,
+                                   const std::string &program_name,
+                                   const SourceGenerator &make_source,
+                                   const std::string &extra_options) {
+    return get_program(context, get_device_from_queue(queue),
+                       program_name, make_source, extra_options);
+}
+
+void CodeCache::precompile(const cl::Context &context,
+                           const cl::Device &device,
+                           const ProgramSourceList &programs,
+                           std::size_t num_threads) {
+    // Programs are identified by their names and options,
+    // just like in get_program
+    std::vector<const ProgramSource*> unique_programs;
+    std::set<std::pair<std::string, std::string>> known_programs;
+    for (const auto &program: programs) {
+        if (known_programs.insert(
+                std::make_pair(program.name, program.options)).second) {
+            unique_programs.push_back(&program);
+        }
+    }
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    num_threads = std::min(num_threads, unique_programs.size());
+    if (num_threads == 0) {
+        return;
+    }
+    std::atomic<std::size_t> next_program{0};
+    std::mutex error_mutex;
+    std::exception_ptr first_error;
+    auto compile_programs = [&]() {
+        for (auto i = next_program++; i < unique_programs.size();
+                i = next_program++) {
+            const auto &program = *unique_programs[i];
+            try {
+                get_program(context, device, program.name, program.source,
+                            program.options);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < num_threads; ++i) {
+        workers.emplace_back(compile_programs);
+    }
+    // The current thread works too, instead of just waiting
+    compile_programs();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+}
+
 CodeCache &CodeCache::get_default() {
     return default_code_cache;
 }
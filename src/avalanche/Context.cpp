@@ -24,7 +24,10 @@ void Context::init(const NodeId node_id,
 
 void Context::check_multi_array_compatibility(
         const MultiArrayRef &array) const {
-    if (array->buffer_unsafe()->pool() != _buffer_pool) {
+    // Arrays may live on any device known to the same memory manager
+    auto array_pool = array->buffer_unsafe()->pool();
+    if (array_pool != _buffer_pool
+            && array_pool->memory_manager() != _buffer_pool->memory_manager()) {
         throw std::invalid_argument(
             "MultiArray and the Context cannot be linked to different"
             " devices or contexts");
@@ -64,6 +67,18 @@ MultiArrayRef Context::eval(const NodeRef &node) const {
     return result;
 }
 
+BufferPoolRef Context::device_pool(DeviceIndex device_idx) {
+    if (_buffer_pool->device_index() == device_idx) {
+        return _buffer_pool;
+    }
+    auto *memory_manager = _buffer_pool->memory_manager();
+    if (device_idx >= memory_manager->num_devices()) {
+        throw std::invalid_argument(
+            fmt::format("There's no device with index {}", device_idx));
+    }
+    return memory_manager->buffer_pool(device_idx);
+}
+
 bool Context::get(NodeId node_id, MultiArrayRef &result) const {
     auto cached = find(node_id);
     if (cached != this->end()) {
@@ -75,4 +90,15 @@ bool Context::get(NodeId node_id, MultiArrayRef &result) const {
 }
 
 
+DevicePlacement::DevicePlacement(Context &context, const BufferPoolRef &pool)
+    :_context{context},
+     _previous_pool{context._placement_pool}
+{
+    _context._placement_pool = pool;
+}
+
+DevicePlacement::~DevicePlacement() {
+    _context._placement_pool = _previous_pool;
+}
+
 } // namespace
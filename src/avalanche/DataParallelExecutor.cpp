@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <set>
+
+#include <fmt/format.h>
+
+#include "avalanche/DataParallelExecutor.h"
+#include "avalanche/terminal_nodes.h"
+#include "avalanche/math_ops/updates.h"
+#include "avalanche/math_ops/simple_arithemic.h"
+#include "avalanche/math_ops/const_transformation.h"
+
+namespace avalanche {
+
+static bool is_update_node(const NodeRef &node) {
+    const auto *raw_node = node.get();
+    return (dynamic_cast<const BinaryOp<Update>*>(raw_node) != nullptr
+            || dynamic_cast<const BinaryOp<UpdateAdd>*>(raw_node) != nullptr
+            || dynamic_cast<const BinaryOp<UpdateSub>*>(raw_node) != nullptr);
+}
+
+DataParallelExecutor::DataParallelExecutor(
+        const std::vector<ContextRef> &contexts,
+        const NodeRefList &result_nodes,
+        const NodeRefList &updates,
+        const NodeRefList &batch_inputs)
+    :_contexts{contexts},
+     _result_nodes{result_nodes},
+     _variables_are_synchronized{false}
+{
+    if (_contexts.empty()) {
+        throw std::invalid_argument("At least one context is necessary");
+    }
+    for (const auto &context: _contexts) {
+        if (!context) {
+            throw std::invalid_argument("No context!");
+        }
+    }
+    for (const auto &node: batch_inputs) {
+        if (!node) {
+            throw std::invalid_argument("No batch input node!");
+        }
+        _batch_inputs.insert(node->id);
+    }
+    std::set<NodeId> known_variables;
+    std::set<NodeId> known_steps;
+    for (const auto &update: updates) {
+        if (!update || !is_update_node(update)) {
+            throw std::invalid_argument(
+                fmt::format("{} is not an update operation",
+                            update ? update->repr() : "nullptr"));
+        }
+        auto update_inputs = update->inputs();
+        if (known_variables.insert(update_inputs[0]->id).second) {
+            _updated_variables.push_back(update_inputs[0]);
+        }
+        if (known_steps.insert(update_inputs[1]->id).second) {
+            _update_steps.push_back(update_inputs[1]);
+        }
+    }
+
+    NodeRefList forward_outputs(result_nodes);
+    std::copy(_update_steps.begin(), _update_steps.end(),
+              std::back_inserter(forward_outputs));
+    for (const auto &context: _contexts) {
+        _forward_executors.emplace_back(
+            new Executor(context, forward_outputs));
+        _update_executors.emplace_back(
+            new Executor(context, NodeRefList(), updates));
+    }
+
+    if (_contexts.size() > 1 && !_update_steps.empty()) {
+        NodeRefList averaged_steps;
+        const auto scale = 1.0f / static_cast<float>(_contexts.size());
+        for (const auto &step: _update_steps) {
+            NodeRefList replica_steps;
+            NodeRef total;
+            for (std::size_t i = 0; i < _contexts.size(); ++i) {
+                auto replica_step = Placeholder::make(
+                    fmt::format("replica_{}_step", i),
+                    step->shape().dims(), step->dtype());
+                replica_steps.push_back(replica_step);
+                total = total ? total + replica_step : replica_step;
+            }
+            _gathered_steps.push_back(replica_steps);
+            averaged_steps.push_back(total * scale);
+        }
+        _averaging_executor.reset(new Executor(_contexts[0], averaged_steps));
+    }
+}
+
+void DataParallelExecutor::synchronize_variables() {
+    if (!_updated_variables.empty() && _contexts.size() > 1) {
+        Executor reader(_contexts[0], _updated_variables);
+        auto values = reader.run();
+        for (std::size_t i = 1; i < _contexts.size(); ++i) {
+            auto pool = _contexts[i]->device_pool();
+            for (std::size_t k = 0; k < values.size(); ++k) {
+                // Always a copy, even if the replicas share the same device,
+                // since the updates modify the variables in place
+                _contexts[i]->init(_updated_variables[k],
+                                   values[k]->copy_to(pool));
+            }
+        }
+    }
+    _variables_are_synchronized = true;
+}
+
+ArrayRefList
+DataParallelExecutor::split_batch(const MultiArrayRef &batch_value) const {
+    const auto &shape = batch_value->shape();
+    const auto num_parts = _contexts.size();
+    if (shape.rank() == 0 || shape.dim(0) < static_cast<ShapeDim>(num_parts)) {
+        throw std::invalid_argument(
+            fmt::format("The batch of shape {} cannot be split between "
+                        "{} replicas", shape.to_string(), num_parts));
+    }
+    const auto num_rows = static_cast<std::size_t>(shape.dim(0));
+    const auto element_size = array_type_size(batch_value->dtype());
+    const auto row_size = element_size * (shape.size() / num_rows);
+    std::vector<std::uint8_t> data(element_size * shape.size());
+    batch_value->wait_until_ready();
+    batch_value->buffer_unsafe()->read_data(
+        data.data(), data.size(),
+        element_size * batch_value->buffer_offset()).wait();
+
+    ArrayRefList parts;
+    std::size_t first_row = 0;
+    for (std::size_t i = 0; i < num_parts; ++i) {
+        const auto part_rows = (
+            num_rows / num_parts + (i < num_rows % num_parts ? 1 : 0));
+        auto part_dims = shape.dims();
+        part_dims[0] = static_cast<ShapeDim>(part_rows);
+        auto part = _contexts[i]->device_pool()->make_array(
+            Shape(part_dims), batch_value->dtype());
+        part->buffer_unsafe()->write_data(
+            data.data() + first_row * row_size, part_rows * row_size, 0).wait();
+        parts.push_back(part);
+        first_row += part_rows;
+    }
+    return parts;
+}
+
+bool DataParallelExecutor::is_batch_value(
+        const NodeValueMap::value_type &item, ShapeDim batch_size) const {
+    if (!_batch_inputs.empty()) {
+        return _batch_inputs.count(item.first->id) > 0;
+    }
+    const auto &shape = item.second->shape();
+    return shape.rank() > 0 && shape.dim(0) == batch_size;
+}
+
+std::vector<ArrayRefList>
+DataParallelExecutor::run(const NodeValueMap &batch_values) {
+    if (!_variables_are_synchronized) {
+        synchronize_variables();
+    }
+    // Without explicitly named batch inputs, the batch is recognized
+    // by the size of its first dimension
+    ShapeDim batch_size = 0;
+    for (const auto &item: batch_values) {
+        const auto &shape = item.second->shape();
+        if (shape.rank() > 0) {
+            batch_size = std::max(batch_size, shape.dim(0));
+        }
+    }
+    const auto num_replicas = _contexts.size();
+    std::vector<NodeValueMap> replica_values(num_replicas);
+    for (const auto &item: batch_values) {
+        if (is_batch_value(item, batch_size)) {
+            auto parts = split_batch(item.second);
+            for (std::size_t i = 0; i < num_replicas; ++i) {
+                replica_values[i][item.first] = parts[i];
+            }
+        } else {
+            // Replicas only read their inputs, so the ones on the same
+            // device can share the value
+            auto value_pool = item.second->buffer_unsafe()->pool();
+            for (std::size_t i = 0; i < num_replicas; ++i) {
+                auto pool = _contexts[i]->device_pool();
+                replica_values[i][item.first] = (
+                    pool == value_pool
+                    ? item.second : item.second->copy_to(pool));
+            }
+        }
+    }
+
+    // All replicas get their work before we start waiting for any of them
+    std::vector<ArrayRefList> outputs(num_replicas);
+    for (std::size_t i = 0; i < num_replicas; ++i) {
+        ArrayRefList no_updates;
+        _forward_executors[i]->run_async(replica_values[i], outputs[i],
+                                         no_updates);
+    }
+    std::vector<ArrayRefList> results(num_replicas);
+    for (std::size_t i = 0; i < num_replicas; ++i) {
+        results[i].assign(outputs[i].begin(),
+                          outputs[i].begin() + _result_nodes.size());
+    }
+
+    if (!_update_steps.empty()) {
+        const auto first_step = _result_nodes.size();
+        ArrayRefList averaged_steps;
+        if (num_replicas > 1) {
+            NodeValueMap gathered_steps;
+            auto first_pool = _contexts[0]->device_pool();
+            for (std::size_t k = 0; k < _update_steps.size(); ++k) {
+                for (std::size_t i = 0; i < num_replicas; ++i) {
+                    const auto &step_value = outputs[i][first_step + k];
+                    gathered_steps[_gathered_steps[k][i]] = (
+                        i == 0 ? step_value : step_value->copy_to(first_pool));
+                }
+            }
+            averaged_steps = _averaging_executor->run(gathered_steps);
+        } else {
+            averaged_steps.assign(outputs[0].begin() + first_step,
+                                  outputs[0].end());
+        }
+
+        std::vector<ArrayRefList> update_results(num_replicas);
+        for (std::size_t i = 0; i < num_replicas; ++i) {
+            auto pool = _contexts[i]->device_pool();
+            NodeValueMap step_values;
+            for (std::size_t k = 0; k < _update_steps.size(); ++k) {
+                step_values[_update_steps[k]] = (
+                    i == 0 ? averaged_steps[k] : averaged_steps[k]->copy_to(pool));
+            }
+            ArrayRefList no_results;
+            _update_executors[i]->run_async(step_values, no_results,
+                                            update_results[i]);
+        }
+        for (const auto &replica_updates: update_results) {
+            for (const auto &value: replica_updates) {
+                value->wait_until_ready();
+            }
+        }
+    }
+    for (const auto &replica_results: results) {
+        for (const auto &value: replica_results) {
+            value->wait_until_ready();
+        }
+    }
+    return results;
+}
+
+} // namespace
@@ -120,7 +120,10 @@ void ExecutionCache::zero_reuse_counters() {
 }
 
 void ExecutionCache::check_multi_array_compatibility(const MultiArrayRef &array) {
-    if (array->buffer_unsafe()->pool() != _buffer_pool) {
+    // Arrays may live on any device known to the same memory manager
+    auto array_pool = array->buffer_unsafe()->pool();
+    if (array_pool != _buffer_pool
+            && array_pool->memory_manager() != _buffer_pool->memory_manager()) {
         throw std::invalid_argument(
             "MultiArray and the Context cannot be linked to different "
             "devices or contexts");
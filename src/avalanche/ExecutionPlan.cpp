@@ -0,0 +1,1038 @@
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <set>
+
+#include <fmt/format.h>
+
+#include "avalanche/ExecutionPlan.h"
+#include "avalanche/CLBuffer.h"
+#include "avalanche/CodeCache.h"
+#include "avalanche/fused_nodes.h"
+#include "avalanche/opencl_utils.h"
+#include "avalanche/terminal_nodes.h"
+
+namespace avalanche {
+
+constexpr std::size_t NoArenaBlock = std::numeric_limits<std::size_t>::max();
+
+constexpr std::size_t ExecutionPlan::DefaultArenaAlignment;
+constexpr std::size_t ExecutionPlan::MaxBatchedArraySize;
+constexpr std::size_t ExecutionPlan::MaxBatchSize;
+
+ExecutionPlan::ExecutionPlan(const NodeRefList &result_nodes,
+                             const NodeRefList &update_nodes,
+                             const PlanOptions &options,
+                             const NodeValueMap &frozen_values,
+                             Context *context)
+    :_result_nodes{result_nodes},
+     _update_nodes{update_nodes},
+     _options(options),
+     _frozen_values(frozen_values),
+     _num_chains{0},
+     _run_counter{0},
+     _arena_size{0},
+     _observe_array_sizes{true}
+{
+    NodeRefList all_outputs;
+    std::copy(result_nodes.begin(), result_nodes.end(),
+              std::back_inserter(all_outputs));
+    std::copy(update_nodes.begin(), update_nodes.end(),
+              std::back_inserter(all_outputs));
+
+    // Sorting the nodes topologically (depth-first, without recursion,
+    // since the graphs can be really deep). Inputs are visited in the same
+    // order as `eval` would evaluate them, so the kernels are enqueued
+    // in the same order too.
+    struct Frame {
+        NodeRef node;
+        NodeRefList inputs;
+        std::size_t next_input;
+    };
+    std::set<NodeId> discovered;
+    std::vector<Frame> stack;
+    for (const auto &output: all_outputs) {
+        if (!output) {
+            throw std::invalid_argument("Output node cannot be nullptr");
+        }
+        if (!discovered.insert(output->id).second) {
+            continue;
+        }
+        stack.push_back({output, output->inputs(), 0});
+        while (!stack.empty()) {
+            auto &frame = stack.back();
+            if (frame.next_input < frame.inputs.size()) {
+                NodeRef input = frame.inputs[frame.next_input++];
+                if (discovered.insert(input->id).second) {
+                    auto inputs_of_input = input->inputs();
+                    stack.push_back({input, std::move(inputs_of_input), 0});
+                }
+            } else {
+                _slot_by_node_id[frame.node->id] = _nodes.size();
+                _nodes.push_back(frame.node);
+                stack.pop_back();
+            }
+        }
+    }
+
+    _instructions.resize(_nodes.size());
+    for (std::size_t i = 0; i < _nodes.size(); ++i) {
+        auto &instruction = _instructions[i];
+        instruction.node = _nodes[i].get();
+        for (const auto &input: _nodes[i]->inputs()) {
+            instruction.input_slots.push_back(_slot_by_node_id.at(input->id));
+        }
+        instruction.num_eager_inputs = std::min(
+            _nodes[i]->num_eager_inputs(), instruction.input_slots.size());
+        instruction.lazy_sequences.resize(instruction.input_slots.size());
+        instruction.input_values.resize(instruction.input_slots.size());
+        instruction.chain = 0;
+        instruction.flush_queue_after = false;
+    }
+    for (const auto &node: result_nodes) {
+        _result_slots.push_back(_slot_by_node_id.at(node->id));
+    }
+    for (const auto &node: update_nodes) {
+        _update_slots.push_back(_slot_by_node_id.at(node->id));
+    }
+    // Frozen nodes don't need their inputs anymore
+    for (const auto &item: _frozen_values) {
+        auto found = _slot_by_node_id.find(item.first->id);
+        if (found == _slot_by_node_id.end()) {
+            continue;
+        }
+        auto &instruction = _instructions[found->second];
+        _fused_nodes.push_back(
+            Constant::make_frozen(item.first, item.second));
+        instruction.node = _fused_nodes.back().get();
+        instruction.input_slots.clear();
+        instruction.num_eager_inputs = 0;
+        instruction.lazy_sequences.clear();
+        instruction.input_values.clear();
+    }
+    _is_fused_away.assign(_nodes.size(), 0);
+    _has_duplicates.assign(_nodes.size(), 0);
+    if (_options.skip_passthrough_nodes || _options.merge_duplicates) {
+        replace_redundant_slots();
+    }
+    if (!_frozen_values.empty()
+            && (_options.skip_passthrough_nodes || _options.fold_constants)) {
+        if (context == nullptr) {
+            throw std::invalid_argument(
+                "Plans with frozen values need the context they come from");
+        }
+        freeze_constant_parts(*context);
+    } else if (_options.fold_constants) {
+        fold_constants();
+    }
+
+    // The main sequence consists of the outputs and everything they
+    // need unconditionally. Since consumers always come after their inputs,
+    // one backward pass is enough to find all of them.
+    std::vector<char> in_main_sequence(_nodes.size(), 0);
+    for (auto slot: _result_slots) { in_main_sequence[slot] = 1; }
+    for (auto slot: _update_slots) { in_main_sequence[slot] = 1; }
+    for (std::size_t i = _nodes.size(); i-- > 0;) {
+        if (in_main_sequence[i]) {
+            const auto &instruction = _instructions[i];
+            for (std::size_t k = 0; k < instruction.num_eager_inputs; ++k) {
+                in_main_sequence[instruction.input_slots[k]] = 1;
+            }
+        }
+    }
+    for (std::size_t i = 0; i < _nodes.size(); ++i) {
+        if (in_main_sequence[i]) {
+            _main_sequence.push_back(i);
+        }
+    }
+    if (_options.fuse_elementwise) {
+        fuse_elementwise_chains(in_main_sequence);
+    }
+    if (_options.batch_small_launches) {
+        batch_small_launches();
+    }
+    build_lazy_sequences(in_main_sequence);
+    split_into_chains();
+
+    // Each value from the main sequence can be released as soon
+    // as the last instruction using it (directly or from within one of its
+    // lazy sequences) is done. Outputs are kept until the end of the run.
+    std::vector<std::size_t> last_use(_nodes.size(), 0);
+    std::vector<char> is_used(_nodes.size(), 0);
+    for (std::size_t pos = 0; pos < _main_sequence.size(); ++pos) {
+        const auto &instruction = _instructions[_main_sequence[pos]];
+        for (const auto *slots: {&instruction.input_slots,
+                                 &instruction.lazy_dependencies}) {
+            for (auto slot: *slots) {
+                if (in_main_sequence[slot]) {
+                    last_use[slot] = pos;
+                    is_used[slot] = 1;
+                }
+            }
+        }
+    }
+    std::vector<char> is_output(_nodes.size(), 0);
+    for (auto slot: _result_slots) { is_output[slot] = 1; }
+    for (auto slot: _update_slots) { is_output[slot] = 1; }
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        // Batched slots are still a part of the main sequence,
+        // even if they don't have instructions of their own
+        if (in_main_sequence[slot] && is_used[slot] && !is_output[slot]) {
+            _instructions[_main_sequence[last_use[slot]]]
+                .slots_to_release.push_back(slot);
+        }
+    }
+
+    // Only the intermediate values calculated from other values
+    // can be placed into the arena. Outputs are given away, and terminal
+    // or lazy nodes usually keep their values somewhere else.
+    _live_from.resize(_nodes.size(), 0);
+    _live_until.resize(_nodes.size(), 0);
+    _can_use_arena.resize(_nodes.size(), 0);
+    std::vector<std::size_t> estimated_sizes(_nodes.size(), 0);
+    for (std::size_t pos = 0; pos < _main_sequence.size(); ++pos) {
+        auto slot = _main_sequence[pos];
+        const auto &instruction = _instructions[slot];
+        _live_from[slot] = pos;
+        _live_until[slot] = is_used[slot] ? last_use[slot] : pos;
+        _can_use_arena[slot] = (
+            is_used[slot] && !is_output[slot]
+            && !instruction.input_slots.empty()
+            && instruction.num_eager_inputs == instruction.input_slots.size()
+            && instruction.batched_slots.empty());
+        const auto &node = _nodes[slot];
+        if (_can_use_arena[slot] && node->shape().is_complete()) {
+            estimated_sizes[slot] = (
+                node->shape().size() * array_type_size(node->dtype()));
+        }
+    }
+    plan_memory_layout(estimated_sizes, DefaultArenaAlignment);
+
+    _slots.resize(_nodes.size());
+    _evaluated_during_run.resize(_nodes.size(), 0);
+    _observed_sizes.resize(_nodes.size(), 0);
+}
+
+void ExecutionPlan::replace_redundant_slots() {
+    // Inputs come before their consumers, so by the time we get to a node
+    // all duplicates and skipped nodes among its inputs have been replaced
+    // already. The replaced slots themselves are left without consumers.
+    std::vector<std::size_t> replacement(_nodes.size());
+    std::map<std::string, std::size_t> slot_by_key;
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        replacement[slot] = slot;
+        auto &instruction = _instructions[slot];
+        for (auto &input_slot: instruction.input_slots) {
+            input_slot = replacement[input_slot];
+        }
+        // Frozen nodes have been replaced already
+        const auto *node = instruction.node;
+        if (node->has_device_placement()) {
+            continue;
+        }
+        if (_options.skip_passthrough_nodes) {
+            const int passthrough = node->passthrough_input();
+            if (passthrough >= 0 && static_cast<std::size_t>(passthrough)
+                                        < instruction.num_eager_inputs) {
+                replacement[slot] = instruction.input_slots[passthrough];
+                _is_fused_away[slot] = 1;
+                continue;
+            }
+        }
+        auto key = node->structure_key();
+        if (key.empty() || !_options.merge_duplicates) {
+            continue;
+        }
+        key = fmt::format("{} -> {} {}", key, array_type_name(node->dtype()),
+                          node->shape().to_string());
+        for (auto input_slot: instruction.input_slots) {
+            key += fmt::format(" {}", input_slot);
+        }
+        auto inserted = slot_by_key.emplace(key, slot);
+        if (!inserted.second) {
+            const auto original = inserted.first->second;
+            replacement[slot] = original;
+            _has_duplicates[original] = 1;
+            _is_fused_away[slot] = 1;
+        }
+    }
+    for (auto &slot: _result_slots) { slot = replacement[slot]; }
+    for (auto &slot: _update_slots) { slot = replacement[slot]; }
+}
+
+std::vector<char> ExecutionPlan::find_constant_slots() const {
+    // A slot is constant if it's pure and all its inputs are constant,
+    // which makes the terminal constants (and the frozen nodes, replaced
+    // with constants already) constant too. Nodes placed on particular
+    // devices are left as they are.
+    std::vector<char> is_constant(_nodes.size(), 0);
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        const auto *node = _instructions[slot].node;
+        is_constant[slot] = (node->is_pure() && !node->has_device_placement());
+        for (auto input_slot: _instructions[slot].input_slots) {
+            if (!is_constant[input_slot]) {
+                is_constant[slot] = 0;
+            }
+        }
+    }
+    return is_constant;
+}
+
+void ExecutionPlan::freeze_constant_parts(Context &context) {
+    // Nodes depending on frozen placeholders can be evaluated only
+    // with the frozen values in the cache, available to any number
+    // of consumers
+    ExecutionCache cache(context.device_pool());
+    for (const auto &item: _frozen_values) {
+        cache.set_node_params(item.first->id, 0,
+                              std::numeric_limits<int>::max());
+        cache.put(item.first->id, item.second, false);
+    }
+    if (_options.skip_passthrough_nodes) {
+        resolve_frozen_conditions(context, cache);
+    }
+    if (_options.fold_constants) {
+        fold_constants();
+    }
+    // The constants made by the plan get evaluated right away, while
+    // the variables the frozen values come from still have them
+    for (const auto &node: _fused_nodes) {
+        node->eval(context, cache);
+    }
+}
+
+void ExecutionPlan::resolve_frozen_conditions(Context &context,
+                                              ExecutionCache &cache) {
+    // Nodes choosing one of their lazy inputs by constant eager inputs
+    // make the same choice every run, so it can be made right now
+    const auto is_constant = find_constant_slots();
+    std::vector<std::size_t> replacement(_nodes.size());
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        replacement[slot] = slot;
+        auto &instruction = _instructions[slot];
+        for (auto &input_slot: instruction.input_slots) {
+            input_slot = replacement[input_slot];
+        }
+        if (_is_fused_away[slot]
+                || instruction.num_eager_inputs
+                       == instruction.input_slots.size()) {
+            continue;
+        }
+        ArrayRefList eager_values;
+        for (std::size_t k = 0; k < instruction.num_eager_inputs; ++k) {
+            const auto input_slot = instruction.input_slots[k];
+            if (!is_constant[input_slot]) {
+                break;
+            }
+            eager_values.push_back(_nodes[input_slot]->eval(context, cache));
+        }
+        if (eager_values.size() < instruction.num_eager_inputs) {
+            continue;
+        }
+        const int passthrough = instruction.node->passthrough_input_given(
+            context, eager_values);
+        if (passthrough >= 0) {
+            replacement[slot] = instruction.input_slots[passthrough];
+            _is_fused_away[slot] = 1;
+        }
+    }
+    for (auto &slot: _result_slots) { slot = replacement[slot]; }
+    for (auto &slot: _update_slots) { slot = replacement[slot]; }
+}
+
+void ExecutionPlan::fold_constants() {
+    // Constant slots used by something else than other constant slots
+    // get replaced with constants, and the rest of the constant slots
+    // aren't needed anymore
+    const auto is_constant = find_constant_slots();
+    std::vector<char> is_used_outside(_nodes.size(), 0);
+    for (auto slot: _result_slots) { is_used_outside[slot] = 1; }
+    for (auto slot: _update_slots) { is_used_outside[slot] = 1; }
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        if (!is_constant[slot] && !_is_fused_away[slot]) {
+            for (auto input_slot: _instructions[slot].input_slots) {
+                is_used_outside[input_slot] = 1;
+            }
+        }
+    }
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        if (!is_constant[slot] || _is_fused_away[slot]) {
+            continue;
+        }
+        auto &instruction = _instructions[slot];
+        if (!is_used_outside[slot]) {
+            _is_fused_away[slot] = 1;
+        } else if (!instruction.input_slots.empty()) {
+            _fused_nodes.push_back(Constant::make_from_node(_nodes[slot]));
+            instruction.node = _fused_nodes.back().get();
+            instruction.input_slots.clear();
+            instruction.num_eager_inputs = 0;
+            instruction.lazy_sequences.clear();
+            instruction.input_values.clear();
+        }
+    }
+}
+
+void ExecutionPlan::fuse_elementwise_chains(
+        std::vector<char> &in_main_sequence) {
+    // A node can be fused into its consumer if it's the only place
+    // its value is used. Lazy parts of the graph and nodes placed
+    // on particular devices are left as they are. Nodes accepting
+    // element-wise prologues (like reductions) take the whole chain
+    // calculating their input, even if it's just one node.
+    std::vector<std::size_t> num_uses(_nodes.size(), 0);
+    for (const auto &instruction: _instructions) {
+        for (auto slot: instruction.input_slots) {
+            ++num_uses[slot];
+        }
+    }
+    for (auto slot: _result_slots) { num_uses[slot] += 2; }
+    for (auto slot: _update_slots) { num_uses[slot] += 2; }
+    std::vector<char> is_fusable(_nodes.size(), 0);
+    for (auto slot: _main_sequence) {
+        // Folded constants have replaced their nodes already
+        const auto *node = _instructions[slot].node;
+        std::vector<std::string> input_vars(
+            _instructions[slot].input_slots.size(), "x");
+        is_fusable[slot] = (
+            !node->has_device_placement()
+            && _instructions[slot].num_eager_inputs == input_vars.size()
+            && !node->elementwise_code(input_vars, "y").empty());
+    }
+
+    // Consumers come after their inputs, so going backwards we meet
+    // the last node of each chain first and collect the rest from there
+    std::vector<char> is_taken(_nodes.size(), 0);
+    for (auto pos = _main_sequence.size(); pos-- > 0;) {
+        const auto root = _main_sequence[pos];
+        const auto *root_node = _instructions[root].node;
+        const auto &root_inputs = _instructions[root].input_slots;
+        const bool takes_prologue = (
+            !is_fusable[root] && !root_node->has_device_placement()
+            && root_node->accepts_elementwise_prologue()
+            && root_inputs.size() == 1
+            && _instructions[root].num_eager_inputs == 1
+            && is_fusable[root_inputs[0]] && num_uses[root_inputs[0]] == 1
+            && !is_taken[root_inputs[0]]);
+        if (!takes_prologue && (!is_fusable[root] || is_taken[root])) {
+            continue;
+        }
+        const auto last_step = takes_prologue ? root_inputs[0] : root;
+        is_taken[last_step] = 1;
+        std::vector<std::size_t> members({last_step}), to_visit({last_step});
+        while (!to_visit.empty()) {
+            auto slot = to_visit.back();
+            to_visit.pop_back();
+            for (auto input_slot: _instructions[slot].input_slots) {
+                if (is_fusable[input_slot] && num_uses[input_slot] == 1
+                        && !is_taken[input_slot]) {
+                    is_taken[input_slot] = 1;
+                    members.push_back(input_slot);
+                    to_visit.push_back(input_slot);
+                }
+            }
+        }
+        if (!takes_prologue && members.size() < 2) {
+            continue;
+        }
+        std::sort(members.begin(), members.end());
+        std::set<std::size_t> member_set(members.begin(), members.end());
+        NodeRefList steps;
+        std::vector<std::size_t> input_slots;
+        for (auto slot: members) {
+            steps.push_back(_nodes[slot]);
+            for (auto input_slot: _instructions[slot].input_slots) {
+                if (member_set.count(input_slot) == 0
+                        && std::find(input_slots.begin(), input_slots.end(),
+                                     input_slot) == input_slots.end()) {
+                    input_slots.push_back(input_slot);
+                }
+            }
+            if (slot != root) {
+                _is_fused_away[slot] = 1;
+                in_main_sequence[slot] = 0;
+            }
+        }
+        NodeRefList inputs;
+        for (auto input_slot: input_slots) {
+            inputs.push_back(_nodes[input_slot]);
+        }
+        _fused_nodes.push_back(FusedElementWise::make(steps, inputs));
+        if (takes_prologue) {
+            _fused_nodes.push_back(
+                NodeWithPrologue::make(_nodes[root], _fused_nodes.back()));
+        }
+        auto &instruction = _instructions[root];
+        instruction.node = _fused_nodes.back().get();
+        instruction.input_slots = input_slots;
+        instruction.num_eager_inputs = input_slots.size();
+        instruction.lazy_sequences.assign(input_slots.size(), {});
+        instruction.input_values.assign(input_slots.size(), nullptr);
+    }
+    _main_sequence.erase(
+        std::remove_if(_main_sequence.begin(), _main_sequence.end(),
+                       [this](std::size_t slot) {
+                           return _is_fused_away[slot] != 0;
+                       }),
+        _main_sequence.end());
+}
+
+void ExecutionPlan::batch_small_launches() {
+    // Going through the main sequence, each batch stays open for new
+    // members until some instruction uses one of its values, or the first
+    // input of one of its members (updates change their first inputs
+    // in place, and the instructions in between would see the old values).
+    // So the batch can be evaluated in place of its last member, and
+    // no member of a batch depends on another one. Values (and first
+    // inputs) read by the lazy sequences aren't batched, since those
+    // sequences aren't bound to any position.
+    constexpr std::size_t NoBatch = std::numeric_limits<std::size_t>::max();
+    std::vector<char> is_in_main_sequence(_nodes.size(), 0);
+    for (auto slot: _main_sequence) { is_in_main_sequence[slot] = 1; }
+    std::vector<char> is_read_lazily(_nodes.size(), 0);
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        if (!is_in_main_sequence[slot] && !_is_fused_away[slot]) {
+            for (auto input_slot: _instructions[slot].input_slots) {
+                is_read_lazily[input_slot] = 1;
+            }
+        }
+    }
+    struct Batch {
+        std::string key;
+        std::vector<std::size_t> members;
+        // Members never share the first input, so two updates
+        // of the same variable are never done at the same time. Nor does
+        // any member change the input of another one.
+        std::set<std::size_t> first_inputs;
+        std::set<std::size_t> member_inputs;
+    };
+    std::vector<Batch> batches;
+    std::map<std::string, std::size_t> open_batches;
+    std::vector<std::size_t> batch_of_slot(_nodes.size(), NoBatch);
+    for (auto slot: _main_sequence) {
+        const auto &instruction = _instructions[slot];
+        for (auto found = open_batches.begin(); found != open_batches.end();) {
+            const auto batch_index = found->second;
+            const auto &first_inputs = batches[batch_index].first_inputs;
+            bool is_read = false;
+            for (auto input_slot: instruction.input_slots) {
+                if (batch_of_slot[input_slot] == batch_index
+                        || first_inputs.count(input_slot) > 0) {
+                    is_read = true;
+                    break;
+                }
+            }
+            found = is_read ? open_batches.erase(found) : std::next(found);
+        }
+        const auto &node = instruction.node;
+        if (node->has_device_placement() || is_read_lazily[slot]
+                || instruction.input_slots.empty()
+                || is_read_lazily[instruction.input_slots[0]]
+                || instruction.num_eager_inputs != instruction.input_slots.size()
+                || !node->shape().is_complete()
+                || node->shape().size() > MaxBatchedArraySize) {
+            continue;
+        }
+        auto key = node->batch_key();
+        if (key.empty()) {
+            continue;
+        }
+        auto first_input = instruction.input_slots[0];
+        auto found = open_batches.find(key);
+        if (found != open_batches.end()) {
+            auto &batch = batches[found->second];
+            if (batch.members.size() < MaxBatchSize
+                    && batch.first_inputs.count(first_input) == 0
+                    && batch.member_inputs.count(first_input) == 0) {
+                batch.members.push_back(slot);
+                batch.first_inputs.insert(first_input);
+                batch.member_inputs.insert(instruction.input_slots.begin(),
+                                           instruction.input_slots.end());
+                batch_of_slot[slot] = found->second;
+                continue;
+            }
+        }
+        open_batches[key] = batches.size();
+        batch_of_slot[slot] = batches.size();
+        batches.push_back({key, {slot}, {first_input},
+                           {instruction.input_slots.begin(),
+                            instruction.input_slots.end()}});
+    }
+
+    for (const auto &batch: batches) {
+        if (batch.members.size() < 2) {
+            continue;
+        }
+        auto &instruction = _instructions[batch.members.back()];
+        instruction.batched_slots = batch.members;
+        std::vector<std::size_t> input_slots;
+        for (auto member: batch.members) {
+            const auto &member_inputs = _instructions[member].input_slots;
+            input_slots.insert(input_slots.end(),
+                               member_inputs.begin(), member_inputs.end());
+            if (member != batch.members.back()) {
+                _is_fused_away[member] = 1;
+            }
+        }
+        instruction.input_slots = input_slots;
+        instruction.num_eager_inputs = input_slots.size();
+        instruction.lazy_sequences.assign(input_slots.size(), {});
+        instruction.input_values.assign(input_slots.size(), nullptr);
+    }
+    _main_sequence.erase(
+        std::remove_if(_main_sequence.begin(), _main_sequence.end(),
+                       [this](std::size_t slot) {
+                           return _is_fused_away[slot] != 0;
+                       }),
+        _main_sequence.end());
+}
+
+void ExecutionPlan::split_into_chains() {
+    // An instruction continues the chain of its first input not continued
+    // by any other instruction yet. So linear parts of the graph stay within
+    // one chain, while sibling branches (like gradients of different
+    // variables) start their own chains. Lazy sequences stay in chain 0.
+    std::vector<char> chain_is_continued(_nodes.size(), 0);
+    _num_chains = 0;
+    for (auto slot: _main_sequence) {
+        auto &instruction = _instructions[slot];
+        bool continues_chain = false;
+        for (std::size_t k = 0; k < instruction.num_eager_inputs; ++k) {
+            auto input_slot = instruction.input_slots[k];
+            if (!chain_is_continued[input_slot]) {
+                chain_is_continued[input_slot] = 1;
+                instruction.chain = _instructions[input_slot].chain;
+                continues_chain = true;
+                break;
+            }
+        }
+        if (!continues_chain) {
+            instruction.chain = _num_chains++;
+        }
+        for (auto batched_slot: instruction.batched_slots) {
+            _instructions[batched_slot].chain = instruction.chain;
+        }
+    }
+    for (auto &instruction: _instructions) {
+        for (const auto *slots: {&instruction.input_slots,
+                                 &instruction.lazy_dependencies}) {
+            for (auto slot: *slots) {
+                if (_instructions[slot].chain != instruction.chain) {
+                    _instructions[slot].flush_queue_after = true;
+                }
+            }
+        }
+    }
+    for (auto &instruction: _instructions) {
+        for (auto batched_slot: instruction.batched_slots) {
+            if (_instructions[batched_slot].flush_queue_after) {
+                instruction.flush_queue_after = true;
+            }
+        }
+    }
+}
+
+void ExecutionPlan::plan_memory_layout(const std::vector<std::size_t> &sizes,
+                                       std::size_t alignment) {
+    // Greedy placement, largest values first: each value gets the lowest
+    // offset not overlapping with any of the already placed values
+    // which are alive at the same time
+    std::vector<std::size_t> order;
+    for (auto slot: _main_sequence) {
+        if (_can_use_arena[slot] && sizes[slot] > 0) {
+            order.push_back(slot);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&sizes](std::size_t a, std::size_t b) {
+                         return sizes[a] > sizes[b];
+                     });
+    struct PlacedValue {
+        std::size_t slot;
+        std::size_t begin;
+        std::size_t end;
+    };
+    std::vector<PlacedValue> placed;
+    std::vector<std::pair<std::size_t, std::size_t>> taken;
+    _arena_block_of_slot.assign(_nodes.size(), NoArenaBlock);
+    _arena_blocks.clear();
+    _arena_size = 0;
+    for (auto slot: order) {
+        auto aligned_size = make_divisible_by(alignment, sizes[slot]);
+        taken.clear();
+        for (const auto &other: placed) {
+            if (_live_from[other.slot] <= _live_until[slot]
+                    && _live_from[slot] <= _live_until[other.slot]) {
+                taken.emplace_back(other.begin, other.end);
+            }
+        }
+        std::sort(taken.begin(), taken.end());
+        std::size_t offset = 0;
+        for (const auto &range: taken) {
+            if (offset + aligned_size <= range.first) {
+                break;
+            }
+            offset = std::max(offset, range.second);
+        }
+        placed.push_back({slot, offset, offset + aligned_size});
+        _arena_block_of_slot[slot] = _arena_blocks.size();
+        _arena_blocks.push_back({offset, sizes[slot]});
+        _arena_size = std::max(_arena_size, offset + aligned_size);
+    }
+}
+
+void ExecutionPlan::observe_array_size(std::size_t slot, Context &context) {
+    // Only arrays which got a brand new buffer are interesting, not views
+    // of the inputs or values the node keeps in the context
+    const auto &instruction = _instructions[slot];
+    const auto &buffer = _slots[slot]->buffer_unsafe();
+    if (buffer->pool() != context.device_pool()) {
+        // The arena lives on the default device only
+        _observed_sizes[slot] = 0;
+        return;
+    }
+    _observed_sizes[slot] = buffer->byte_size();
+    for (const auto &input_value: instruction.input_values) {
+        if (input_value && input_value->buffer_unsafe() == buffer) {
+            _observed_sizes[slot] = 0;
+            return;
+        }
+    }
+    MultiArrayRef stored_value;
+    if (context.get(instruction.node->id, stored_value)) {
+        _observed_sizes[slot] = 0;
+    }
+}
+
+void ExecutionPlan::build_lazy_sequences(
+        const std::vector<char> &in_main_sequence) {
+    std::vector<char> marked(_nodes.size(), 0);
+    for (auto &instruction: _instructions) {
+        for (std::size_t k = instruction.num_eager_inputs;
+             k < instruction.input_slots.size(); ++k) {
+            auto root = instruction.input_slots[k];
+            if (in_main_sequence[root]) {
+                // Will be evaluated anyway
+                continue;
+            }
+            // Everything the lazy input needs unconditionally,
+            // except what has already been done by the main sequence
+            std::fill(marked.begin(), marked.begin() + root + 1, 0);
+            marked[root] = 1;
+            for (std::size_t j = root + 1; j-- > 0;) {
+                if (marked[j]) {
+                    const auto &dependency = _instructions[j];
+                    for (std::size_t e = 0;
+                         e < dependency.num_eager_inputs; ++e) {
+                        auto slot = dependency.input_slots[e];
+                        if (!in_main_sequence[slot]) {
+                            marked[slot] = 1;
+                        }
+                    }
+                }
+            }
+            auto &sequence = instruction.lazy_sequences[k];
+            for (std::size_t j = 0; j <= root; ++j) {
+                if (marked[j]) {
+                    sequence.push_back(j);
+                }
+            }
+        }
+    }
+
+    for (auto i: _main_sequence) {
+        auto &instruction = _instructions[i];
+        std::set<std::size_t> dependencies, visited;
+        std::vector<std::size_t> to_visit;
+        for (const auto &sequence: instruction.lazy_sequences) {
+            to_visit.insert(to_visit.end(), sequence.begin(), sequence.end());
+        }
+        while (!to_visit.empty()) {
+            auto j = to_visit.back();
+            to_visit.pop_back();
+            if (!visited.insert(j).second) {
+                continue;
+            }
+            const auto &dependency = _instructions[j];
+            for (auto slot: dependency.input_slots) {
+                if (in_main_sequence[slot]) {
+                    dependencies.insert(slot);
+                }
+            }
+            for (const auto &sequence: dependency.lazy_sequences) {
+                to_visit.insert(to_visit.end(),
+                                sequence.begin(), sequence.end());
+            }
+        }
+        instruction.lazy_dependencies.assign(dependencies.begin(),
+                                             dependencies.end());
+    }
+}
+
+bool ExecutionPlan::needs_unoptimized_plan(
+        const NodeValueMap &pre_cache_map) const {
+    for (const auto &item: pre_cache_map) {
+        auto found = _slot_by_node_id.find(item.first->id);
+        if (found != _slot_by_node_id.end()
+                && (_is_fused_away[found->second]
+                    || _has_duplicates[found->second]
+                    || !_instructions[found->second].batched_slots.empty())) {
+            // The value of the node would be ignored (or the rest
+            // of its batch wouldn't be evaluated, or its duplicates would
+            // get the same value), since the node doesn't exist
+            // on its own anymore
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExecutionPlan::run(Context &context, ExecutionCache &cache,
+                        const NodeValueMap &pre_cache_map,
+                        ArrayRefList &results,
+                        ArrayRefList &update_results) {
+    if (needs_unoptimized_plan(pre_cache_map)) {
+        if (!_unoptimized_plan) {
+            PlanOptions options(_options);
+            options.skip_passthrough_nodes = false;
+            options.merge_duplicates = false;
+            options.fold_constants = false;
+            options.fuse_elementwise = false;
+            options.batch_small_launches = false;
+            _unoptimized_plan = std::make_shared<ExecutionPlan>(
+                _result_nodes, _update_nodes, options, _frozen_values);
+        }
+        // This plan stays as it is for the runs not giving such values
+        _unoptimized_plan->run(context, cache, pre_cache_map, results,
+                               update_results);
+        return;
+    }
+    ++_run_counter;
+    for (auto &value: _slots) {
+        value.reset();
+    }
+    bool intermediate_nodes_are_given = false;
+    for (const auto &item: pre_cache_map) {
+        auto found = _slot_by_node_id.find(item.first->id);
+        if (found == _slot_by_node_id.end()) {
+            continue;
+        }
+        auto array_pool = item.second->buffer_unsafe()->pool();
+        if (array_pool->memory_manager()
+                != context.device_pool()->memory_manager()) {
+            throw std::invalid_argument(
+                "MultiArray and the Context cannot be linked to different "
+                "devices or contexts");
+        }
+        _slots[found->second] = item.second;
+        _evaluated_during_run[found->second] = _run_counter;
+        if (!_instructions[found->second].input_slots.empty()) {
+            intermediate_nodes_are_given = true;
+        }
+    }
+    if (intermediate_nodes_are_given) {
+        mark_needed_slots();
+    } else {
+        _needed.clear();
+    }
+    const bool observing_sizes = _observe_array_sizes;
+    if (observing_sizes) {
+        std::fill(_observed_sizes.begin(), _observed_sizes.end(), 0);
+    }
+
+    execute_sequence(_main_sequence, context, cache, true);
+
+    if (observing_sizes) {
+        auto device = get_device_from_queue(context.device_pool()->cl_queue());
+        // The alignment is given in bits
+        std::size_t alignment = std::max<std::size_t>(
+            device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8, 1);
+        plan_memory_layout(_observed_sizes, alignment);
+        _arena = (_arena_blocks.empty()
+                  ? nullptr
+                  : BufferArena::make(context.device_pool(), _arena_blocks));
+        _observe_array_sizes = false;
+    }
+
+    for (auto slot: _result_slots) {
+        results.push_back(_slots[slot]);
+    }
+    for (auto slot: _update_slots) {
+        update_results.push_back(_slots[slot]);
+    }
+    for (auto &value: _slots) {
+        value.reset();
+    }
+}
+
+void ExecutionPlan::precompile_programs(Context &context,
+                                        std::size_t num_threads) const {
+    // Predicts the devices the same way choose_device_pool does,
+    // assuming that all given values live on the default device
+    std::vector<BufferPoolRef> pool_of_slot(_nodes.size());
+    std::map<CLBufferPool*, ProgramSourceList> programs_by_pool;
+    std::vector<BufferPoolRef> pools;
+    for (std::size_t slot = 0; slot < _nodes.size(); ++slot) {
+        const auto &instruction = _instructions[slot];
+        if (_is_fused_away[slot]) {
+            continue;
+        }
+        auto &pool = pool_of_slot[slot];
+        if (instruction.node->has_device_placement()) {
+            pool = context.device_pool(instruction.node->device_placement());
+        } else if (!instruction.input_slots.empty()) {
+            pool = pool_of_slot[instruction.input_slots[0]];
+        } else {
+            pool = context.device_pool();
+        }
+        if (programs_by_pool.count(pool.get()) == 0) {
+            pools.push_back(pool);
+        }
+        instruction.node->collect_programs(pool->cl_device(),
+                                           programs_by_pool[pool.get()]);
+    }
+    for (const auto &pool: pools) {
+        CodeCache::get_default().precompile(
+            pool->cl_context(), pool->cl_device(),
+            programs_by_pool[pool.get()], num_threads);
+    }
+}
+
+void ExecutionPlan::mark_needed_slots() {
+    _needed.assign(_nodes.size(), 0);
+    for (auto slot: _result_slots) { _needed[slot] = 1; }
+    for (auto slot: _update_slots) { _needed[slot] = 1; }
+    for (std::size_t pos = _main_sequence.size(); pos-- > 0;) {
+        auto slot = _main_sequence[pos];
+        const auto &instruction = _instructions[slot];
+        for (auto batched_slot: instruction.batched_slots) {
+            if (_needed[batched_slot]) {
+                _needed[slot] = 1;
+            }
+        }
+        if (!_needed[slot] || _evaluated_during_run[slot] == _run_counter) {
+            continue;
+        }
+        for (auto input_slot: instruction.input_slots) {
+            _needed[input_slot] = 1;
+        }
+        for (auto input_slot: instruction.lazy_dependencies) {
+            _needed[input_slot] = 1;
+        }
+    }
+}
+
+void ExecutionPlan::execute_sequence(const std::vector<std::size_t> &sequence,
+                                     Context &context, ExecutionCache &cache,
+                                     bool is_main_sequence) {
+    for (auto slot: sequence) {
+        if (_evaluated_during_run[slot] != _run_counter
+                && (!is_main_sequence || _needed.empty() || _needed[slot])) {
+            execute_instruction(slot, context, cache);
+        }
+        if (is_main_sequence) {
+            for (auto slot_to_release: _instructions[slot].slots_to_release) {
+                _slots[slot_to_release].reset();
+            }
+        }
+    }
+}
+
+BufferPoolRef ExecutionPlan::choose_device_pool(PlanInstruction &instruction,
+                                               Context &context) {
+    // Nodes are calculated on the device they've been placed on,
+    // otherwise on the device of their first input, otherwise
+    // on the default device of the context. All inputs living elsewhere
+    // get transferred to the chosen device.
+    auto &values = instruction.input_values;
+    BufferPoolRef pool;
+    if (instruction.node->has_device_placement()) {
+        pool = context.device_pool(instruction.node->device_placement());
+    } else {
+        for (const auto &value: values) {
+            if (value) {
+                pool = value->buffer_unsafe()->pool();
+                break;
+            }
+        }
+        if (!pool) {
+            pool = context.device_pool();
+        }
+    }
+    for (auto &value: values) {
+        if (value && value->buffer_unsafe()->pool() != pool) {
+            value = value->copy_to(pool);
+        }
+    }
+    return pool;
+}
+
+void ExecutionPlan::execute_batch(PlanInstruction &instruction,
+                                  Context &context, ExecutionCache &cache) {
+    const auto &members = instruction.batched_slots;
+    const auto num_inputs = instruction.input_values.size() / members.size();
+    std::vector<ArrayRefList> member_values(members.size());
+    for (std::size_t k = 0; k < members.size(); ++k) {
+        auto first_value = instruction.input_values.begin() + k * num_inputs;
+        member_values[k].assign(first_value, first_value + num_inputs);
+    }
+    auto results = instruction.node->forward_batch(
+        context, cache, member_values);
+    for (std::size_t k = 0; k < members.size(); ++k) {
+        _slots[members[k]] = results[k];
+        _evaluated_during_run[members[k]] = _run_counter;
+    }
+}
+
+void ExecutionPlan::execute_instruction(std::size_t slot,
+                                        Context &context,
+                                        ExecutionCache &cache) {
+    auto &instruction = _instructions[slot];
+    auto &values = instruction.input_values;
+    for (std::size_t k = 0; k < instruction.num_eager_inputs; ++k) {
+        values[k] = _slots[instruction.input_slots[k]];
+    }
+    if (instruction.num_eager_inputs < instruction.input_slots.size()) {
+        auto required_inputs = instruction.node->lazy_inputs_to_evaluate(
+            context, values);
+        for (auto k: required_inputs) {
+            // Nested lazy nodes are the only source of recursion here
+            execute_sequence(instruction.lazy_sequences[k],
+                             context, cache, false);
+            values[k] = _slots[instruction.input_slots[k]];
+        }
+    }
+    auto pool = choose_device_pool(instruction, context);
+    auto queue_index = instruction.chain % pool->num_queues();
+    auto arena_block = _arena ? _arena_block_of_slot[slot] : NoArenaBlock;
+    {
+        DevicePlacement placement(context, pool);
+        QueueSelection queue_selection(pool.get(), queue_index);
+        ArenaOffer offer(arena_block != NoArenaBlock ? _arena.get() : nullptr,
+                         arena_block);
+        if (instruction.batched_slots.empty()) {
+            _slots[slot] = instruction.node->forward(context, cache, values);
+        } else {
+            execute_batch(instruction, context, cache);
+        }
+    }
+    if (instruction.flush_queue_after) {
+        pool->cl_queue(queue_index).flush();
+    }
+    _evaluated_during_run[slot] = _run_counter;
+    if (_can_use_arena[slot]) {
+        if (_observe_array_sizes) {
+            observe_array_size(slot, context);
+        } else if (arena_block != NoArenaBlock
+                   && (_slots[slot]->buffer_unsafe()->byte_size()
+                       != _arena_blocks[arena_block].size)) {
+            // The shapes have changed, the layout must be updated
+            _observe_array_sizes = true;
+        }
+    }
+    for (auto &value: values) {
+        value.reset();
+    }
+}
+
+} // namespace
@@ -1,7 +1,43 @@
 
+#include <set>
+
 #include "avalanche/Executor.h"
+#include "avalanche/terminal_nodes.h"
 
 namespace avalanche {
 
+Executor freeze(const ContextRef &context,
+                const NodeRefList &result_nodes,
+                const NodeValueMap &fixed_values,
+                const PlanOptions &options) {
+    if (!context) {
+        throw std::invalid_argument("No context!");
+    }
+    // Looking for the variables without going into their initializers,
+    // which are never needed once the variables have values
+    NodeValueMap frozen_values(fixed_values);
+    ExecutionCache cache(context->device_pool());
+    std::set<NodeId> discovered;
+    NodeRefList to_visit(result_nodes);
+    while (!to_visit.empty()) {
+        auto node = to_visit.back();
+        to_visit.pop_back();
+        if (!discovered.insert(node->id).second
+                || frozen_values.count(node) > 0) {
+            continue;
+        }
+        if (std::dynamic_pointer_cast<Variable>(node)
+                && !std::dynamic_pointer_cast<Placeholder>(node)) {
+            // A copy, so the training could go on
+            frozen_values[node] = node->eval(*context, cache)->copy_to(
+                context->device_pool());
+            continue;
+        }
+        for (const auto &input: node->inputs()) {
+            to_visit.push_back(input);
+        }
+    }
+    return Executor(context, result_nodes, {}, options, frozen_values);
+}
 
 }
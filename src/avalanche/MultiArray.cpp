@@ -3,6 +3,7 @@
 
 #include "avalanche/CLMemoryManager.h"
 #include "avalanche/MultiArray.h"
+#include "avalanche/opencl_utils.h"
 
 namespace avalanche {
 
@@ -36,6 +37,70 @@ MultiArrayRef MultiArray::ref_copy() {
     return result;
 }
 
+// Keeps the data on the host while they're being transferred between
+// devices from different OpenCL contexts
+struct HostStaging {
+    std::vector<std::uint8_t> data;
+    // Lives in the destination context, since events from other
+    // contexts cannot be waited for
+    cl::UserEvent data_on_host;
+};
+
+static void staging_data_read(cl_event event, cl_int status, void *user_data) {
+    auto staging = static_cast<std::shared_ptr<HostStaging>*>(user_data);
+    (*staging)->data_on_host.setStatus(status < 0 ? status : CL_COMPLETE);
+    delete staging;
+}
+
+static void staging_data_written(cl_event event, cl_int status,
+                                 void *user_data) {
+    delete static_cast<std::shared_ptr<HostStaging>*>(user_data);
+}
+
+MultiArrayRef MultiArray::copy_to(const BufferPoolRef &device_pool) {
+    auto result = MultiArray::make(device_pool, _shape, _dtype);
+    const auto element_size = array_type_size(_dtype);
+    const auto bytes_to_copy = element_size * size();
+    auto source_pool = _buffer->pool();
+    auto data_are_ready = make_event_list({_buffer->completion_event()});
+    cl::Event ready_event;
+    if (device_pool->cl_context()() == source_pool->cl_context()()) {
+        // Within the same OpenCL context buffers can be copied directly,
+        // the runtime migrates them between devices if necessary
+        device_pool->cl_queue().enqueueCopyBuffer(
+            _buffer->cl_buffer_unsafe(),
+            result->_buffer->cl_buffer_unsafe(),
+            element_size * _buffer_offset, 0,
+            bytes_to_copy,
+            &data_are_ready, &ready_event);
+    } else {
+        // Otherwise the data have to go through the host. Both steps are
+        // still asynchronous, chained through a user event.
+        auto staging = std::make_shared<HostStaging>();
+        staging->data.resize(bytes_to_copy);
+        staging->data_on_host = cl::UserEvent(device_pool->cl_context());
+        cl::Event reading_is_done;
+        source_pool->cl_queue().enqueueReadBuffer(
+            _buffer->cl_buffer_unsafe(), CL_FALSE,
+            element_size * _buffer_offset, bytes_to_copy,
+            staging->data.data(), &data_are_ready, &reading_is_done);
+        reading_is_done.setCallback(
+            CL_COMPLETE, staging_data_read,
+            new std::shared_ptr<HostStaging>(staging));
+        source_pool->cl_queue().flush();
+        std::vector<cl::Event> data_on_host({staging->data_on_host});
+        device_pool->cl_queue().enqueueWriteBuffer(
+            result->_buffer->cl_buffer_unsafe(), CL_FALSE, 0, bytes_to_copy,
+            staging->data.data(), &data_on_host, &ready_event);
+        ready_event.setCallback(
+            CL_COMPLETE, staging_data_written,
+            new std::shared_ptr<HostStaging>(staging));
+    }
+    result->add_dependencies({_buffer});
+    result->set_completion_event(ready_event);
+    return result;
+}
+
 void MultiArray::add_dependencies(
         std::initializer_list<CLBufferRef> dependencies) {
     _buffer->add_dependencies(dependencies);
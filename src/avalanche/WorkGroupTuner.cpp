@@ -0,0 +1,345 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "avalanche/WorkGroupTuner.h"
+#include "avalanche/CodeCache.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/opencl_utils.h"
+#include "avalanche/terminal_nodes.h"
+#include "avalanche/random_nodes.h"
+#include "avalanche/shape_nodes.h"
+#include "avalanche/math_ops/simple_arithemic.h"
+#include "avalanche/math_ops/const_transformation.h"
+#include "avalanche/math_ops/reductions.h"
+#include "avalanche/math_ops/updates.h"
+
+namespace avalanche {
+
+constexpr std::size_t WorkGroupTuner::DefaultWorkGroupSize;
+
+// Number of elements processed by the benchmarks
+constexpr std::size_t BenchmarkSize = 1 << 20;
+constexpr std::size_t BenchmarkRowSize = 256;
+constexpr int BenchmarkRepeats = 10;
+
+constexpr KernelFamily AllKernelFamilies[] = {
+    KernelFamily::ElementWise,
+    KernelFamily::Broadcasted,
+    KernelFamily::Update,
+    KernelFamily::Transform,
+    KernelFamily::Reduction,
+    KernelFamily::Random,
+    KernelFamily::Tile
+};
+
+struct LaunchConfigOverrideState {
+    bool is_active;
+    KernelFamily family;
+    LaunchConfig config;
+};
+
+static thread_local LaunchConfigOverrideState current_override = {
+    false, KernelFamily::ElementWise, {0, 0}};
+
+
+const char* kernel_family_name(KernelFamily family) {
+    switch (family) {
+        case KernelFamily::ElementWise: return "elementwise";
+        case KernelFamily::Broadcasted: return "broadcasted";
+        case KernelFamily::Update: return "update";
+        case KernelFamily::Transform: return "transform";
+        case KernelFamily::Reduction: return "reduction";
+        case KernelFamily::Random: return "random";
+        case KernelFamily::Tile: return "tile";
+    }
+    throw std::invalid_argument("Unknown kernel family");
+}
+
+static bool processes_many_items_per_thread(KernelFamily family) {
+    return (family == KernelFamily::ElementWise
+            || family == KernelFamily::Broadcasted
+            || family == KernelFamily::Update
+            || family == KernelFamily::Transform);
+}
+
+std::string LaunchConfig::build_options() const {
+    return fmt::format("-DWORK_GROUP_SIZE={}", work_group_size);
+}
+
+std::size_t LaunchConfig::global_size(std::size_t num_items) const {
+    return make_divisible_by(
+        work_group_size,
+        (num_items + items_per_thread - 1) / items_per_thread);
+}
+
+
+static std::string default_tuning_file() {
+    const char *path = std::getenv("AVALANCHE_TUNING_FILE");
+    if (path != nullptr) {
+        return path;
+    }
+    auto directory = CodeCache::get_default().cache_directory();
+    return directory.empty() ? "" : directory + "/work_group_sizes.txt";
+}
+
+WorkGroupTuner::WorkGroupTuner()
+    :_tuning_file{default_tuning_file()},
+     _tuning_file_is_loaded{false} {
+}
+
+std::string WorkGroupTuner::device_key(const cl::Device &device) {
+    auto search = _device_keys.find(device());
+    if (search != _device_keys.end()) {
+        return search->second;
+    }
+    auto key = fmt::format("{} | {}",
+                           device.getInfo<CL_DEVICE_NAME>(),
+                           device.getInfo<CL_DRIVER_VERSION>());
+    // The key has to fit into the last field of a line of the tuning file
+    for (auto &c: key) {
+        if (c == '\n' || c == '\r' || c == '\0') {
+            c = ' ';
+        }
+    }
+    _device_keys[device()] = key;
+    return key;
+}
+
+void WorkGroupTuner::load_tuning_file() {
+    // The caller must hold the lock
+    if (_tuning_file_is_loaded) {
+        return;
+    }
+    _tuning_file_is_loaded = true;
+    if (_tuning_file.empty()) {
+        return;
+    }
+    // Each line: family, work group size, items per thread, device
+    std::ifstream file(_tuning_file);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string family_name, key;
+        LaunchConfig config {0, 0};
+        fields >> family_name >> config.work_group_size
+               >> config.items_per_thread;
+        fields.ignore(1);
+        std::getline(fields, key);
+        if (fields.fail() || key.empty() || config.work_group_size == 0
+                || config.items_per_thread == 0) {
+            continue;
+        }
+        _configs[std::make_pair(family_name, key)] = config;
+    }
+}
+
+LaunchConfig WorkGroupTuner::launch_config(const cl::Device &device,
+                                           KernelFamily family) {
+    if (current_override.is_active && current_override.family == family) {
+        return current_override.config;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    load_tuning_file();
+    auto search = _configs.find(
+        std::make_pair(kernel_family_name(family), device_key(device)));
+    if (search != _configs.end()) {
+        return search->second;
+    }
+    return {DefaultWorkGroupSize, 1};
+}
+
+void WorkGroupTuner::set_launch_config(const cl::Device &device,
+                                       KernelFamily family,
+                                       const LaunchConfig &config) {
+    if (config.work_group_size == 0 || config.items_per_thread == 0) {
+        throw std::invalid_argument(
+            "Work group size and the number of items per thread "
+            "must be positive");
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    load_tuning_file();
+    _configs[std::make_pair(kernel_family_name(family),
+                            device_key(device))] = config;
+}
+
+void WorkGroupTuner::set_tuning_file(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tuning_file = path;
+    _tuning_file_is_loaded = false;
+    _configs.clear();
+    load_tuning_file();
+}
+
+std::string WorkGroupTuner::tuning_file() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _tuning_file;
+}
+
+void WorkGroupTuner::save() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_tuning_file.empty()) {
+        return;
+    }
+    // Written into a temporary file first, so other processes never
+    // see it incomplete
+    auto temp_path = fmt::format("{}.{}.tmp", _tuning_file, ::getpid());
+    {
+        std::ofstream file(temp_path);
+        for (const auto &item: _configs) {
+            file << item.first.first << ' '
+                 << item.second.work_group_size << ' '
+                 << item.second.items_per_thread << ' '
+                 << item.first.second << '\n';
+        }
+        if (!file) {
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp_path.c_str(), _tuning_file.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+    }
+}
+
+std::vector<LaunchConfig>
+WorkGroupTuner::candidates(const cl::Device &device,
+                           KernelFamily family) const {
+    const auto max_work_group_size = (
+        device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    std::vector<std::size_t> items_per_thread {1};
+    if (processes_many_items_per_thread(family)) {
+        items_per_thread = {1, 2, 4, 8};
+    }
+    std::vector<LaunchConfig> result;
+    // Only powers of two, since the reductions rely on it
+    for (std::size_t size = 16; size <= 1024; size *= 2) {
+        if (size > max_work_group_size) {
+            break;
+        }
+        for (auto items: items_per_thread) {
+            result.push_back({size, items});
+        }
+    }
+    return result;
+}
+
+// Returns a node representing the typical work of the family, and values
+// for its inputs
+static NodeRef make_benchmark(const BufferPoolRef &pool, KernelFamily family,
+                              ArrayRefList &input_values) {
+    const auto num_rows = static_cast<ShapeDim>(
+        BenchmarkSize / BenchmarkRowSize);
+    const auto row_size = static_cast<ShapeDim>(BenchmarkRowSize);
+    auto make_input = [&](const Shape &shape) {
+        auto value = pool->make_array(shape, ArrayType::float32);
+        value->write_from_vector(std::vector<float>(shape.size(), 1.0f));
+        input_values.push_back(value);
+        return Placeholder::make("input", shape.dims(), ArrayType::float32);
+    };
+    switch (family) {
+        case KernelFamily::ElementWise: {
+            auto a = make_input(Shape({num_rows, row_size}));
+            auto b = make_input(Shape({num_rows, row_size}));
+            return F<ElemWiseMultiply>(a, b);
+        }
+        case KernelFamily::Broadcasted: {
+            auto a = make_input(Shape({num_rows, row_size}));
+            auto b = make_input(Shape({row_size}));
+            return F<Plus>(a, b);
+        }
+        case KernelFamily::Update: {
+            auto a = make_input(Shape({num_rows, row_size}));
+            auto b = make_input(Shape({num_rows, row_size}));
+            return F<UpdateAdd>(a, b);
+        }
+        case KernelFamily::Transform: {
+            auto a = make_input(Shape({num_rows, row_size}));
+            return FU<Scale>(a, 2.0f);
+        }
+        case KernelFamily::Reduction: {
+            auto a = make_input(Shape({num_rows, row_size}));
+            return FU<ReduceSum>(a, std::vector<ShapeDim>({1}));
+        }
+        case KernelFamily::Random:
+            return UniformRandom::make(Shape({num_rows, row_size}),
+                                       0, 1, ArrayType::float32, 1);
+        case KernelFamily::Tile: {
+            auto a = make_input(Shape({1, row_size}));
+            return FU<Tile>(a, std::vector<ShapeDim>({num_rows, 1}));
+        }
+    }
+    throw std::invalid_argument("Unknown kernel family");
+}
+
+LaunchConfig WorkGroupTuner::tune(const BufferPoolRef &pool,
+                                  KernelFamily family) {
+    auto context = Context::make(pool);
+    ExecutionCache cache(pool);
+    ArrayRefList input_values;
+    auto node = make_benchmark(pool, family, input_values);
+    LaunchConfig best_config {DefaultWorkGroupSize, 1};
+    auto best_time = std::chrono::steady_clock::duration::max();
+    for (const auto &config: candidates(pool->cl_device(), family)) {
+        LaunchConfigOverride forced_config(family, config);
+        try {
+            // The first run compiles the program
+            node->forward(*context, cache, input_values)->wait_until_ready();
+            const auto start = std::chrono::steady_clock::now();
+            ArrayRefList results;
+            for (int i = 0; i < BenchmarkRepeats; ++i) {
+                results.push_back(
+                    node->forward(*context, cache, input_values));
+            }
+            for (const auto &result: results) {
+                result->wait_until_ready();
+            }
+            const auto time = std::chrono::steady_clock::now() - start;
+            if (time < best_time) {
+                best_time = time;
+                best_config = config;
+            }
+        } catch (std::exception &e) {
+            // The configuration is not supported by the device
+            // or the kernel (too much local memory, etc.)
+            continue;
+        }
+    }
+    set_launch_config(pool->cl_device(), family, best_config);
+    save();
+    return best_config;
+}
+
+void WorkGroupTuner::tune_all(const BufferPoolRef &pool) {
+    for (auto family: AllKernelFamilies) {
+        tune(pool, family);
+    }
+}
+
+WorkGroupTuner& WorkGroupTuner::get_default() {
+    static WorkGroupTuner default_tuner;
+    return default_tuner;
+}
+
+LaunchConfigOverride::LaunchConfigOverride(KernelFamily family,
+                                           const LaunchConfig &config)
+    :_previous_is_active{current_override.is_active},
+     _previous_family{current_override.family},
+     _previous_config(current_override.config)
+{
+    current_override = {true, family, config};
+}
+
+LaunchConfigOverride::~LaunchConfigOverride() {
+    current_override = {_previous_is_active, _previous_family,
+                        _previous_config};
+}
+
+} // namespace
@@ -74,10 +74,8 @@ const NodeRef back_propagate_node(
     if (chunks.empty()) {
         result = Constant::zeros_like(variable);
     } else {
-        result = chunks[0];
-        for (std::size_t i = 1; i < chunks.size(); ++i) {
-            result = F<ElemWisePlus>(result, chunks[i]);
-        }
+        // One kernel for all the chunks, instead of a chain of sums
+        result = AddN::make(chunks);
     }
     grad_table.insert({variable, result});
     return result;
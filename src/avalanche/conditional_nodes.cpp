@@ -78,13 +78,17 @@ void handle_not_evaluated_node(const NodeRef &node, Context &context,
     cache.decrease_counter(node->id);
 }
 
+bool condition_is_true(const MultiArrayRef &cond_value) {
+    std::vector<BoolArrayStaticType> condition;
+    cond_value->fetch_data_into(condition);
+    return static_cast<bool>(condition[0]);
+}
+
 MultiArrayRef Cond::eval(Context &context, ExecutionCache &cache) const {
     MultiArrayRef result;
     if (!cache.get(id, result)) {
         auto cond_value = _cond_node->eval(context, cache);
-        std::vector<BoolArrayStaticType> condition;
-        cond_value->fetch_data_into(condition);
-        if (condition[0]) {
+        if (condition_is_true(cond_value)) {
             result = _true_node->eval(context, cache);
             handle_not_evaluated_node(_false_node, context, cache);
         } else {
@@ -96,6 +100,24 @@ MultiArrayRef Cond::eval(Context &context, ExecutionCache &cache) const {
     return result;
 }
 
+MultiArrayRef Cond::forward(Context &context, ExecutionCache &cache,
+                            const ArrayRefList &input_values) const {
+    // Only the branch chosen by `lazy_inputs_to_evaluate` has a value
+    return input_values[1] ? input_values[1] : input_values[2];
+}
+
+std::vector<std::size_t>
+Cond::lazy_inputs_to_evaluate(Context &context,
+                              const ArrayRefList &eager_values) const {
+    return {condition_is_true(eager_values[0]) ? 1u : 2u};
+}
+
+int Cond::passthrough_input_given(Context &context,
+                                  const ArrayRefList &eager_values) const {
+    return static_cast<int>(
+        lazy_inputs_to_evaluate(context, eager_values).at(0));
+}
+
 std::string Cond::to_string() const {
     return fmt::format("(if {} then {} else {})",
                        _cond_node->to_string(),
@@ -0,0 +1,67 @@
+#include <fmt/format.h>
+
+#include "avalanche/device_nodes.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/math_ops/messages.h"
+
+namespace avalanche {
+
+Transfer::Transfer(const NodeRef &input, DeviceIndex destination)
+    :_input{input},
+     _destination{destination}
+{
+    set_shape(input->shape());
+    set_dtype(input->dtype());
+    place_on_device(destination);
+}
+
+MultiArrayRef Transfer::eval(Context &context, ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        result = forward(context, cache, {_input->eval(context, cache)});
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef Transfer::forward(Context &context, ExecutionCache &cache,
+                                const ArrayRefList &input_values) const {
+    const auto &input_value = input_values[0];
+    auto destination_pool = context.device_pool(_destination);
+    if (input_value->buffer_unsafe()->pool() == destination_pool) {
+        return input_value;
+    }
+    return input_value->copy_to(destination_pool);
+}
+
+const NodeRef Transfer::apply_chain_rule(const NodeRef &wrt_input,
+                                         const NodeRef &d_target_wrt_this,
+                                         const NodeRefList &all_inputs) const {
+    if (wrt_input != all_inputs[0]) {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+    // The gradient goes back to where the input lives, if that's known
+    if (wrt_input->has_device_placement()) {
+        return Transfer::make(d_target_wrt_this, wrt_input->device_placement());
+    }
+    return d_target_wrt_this;
+}
+
+std::string Transfer::to_string() const {
+    return fmt::format("transfer({}, device {})",
+                       _input->to_string(), _destination);
+}
+
+std::string Transfer::repr() const {
+    return format_repr("Transfer", "",
+                       fmt::format("device: {}", _destination));
+}
+
+NodeRef Transfer::make(const NodeRef &input, DeviceIndex destination) {
+    auto *raw_ptr = new Transfer(input, destination);
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<Transfer>(raw_ptr));
+}
+
+} // namespace
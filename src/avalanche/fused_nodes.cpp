@@ -0,0 +1,356 @@
+#include <functional>
+#include <map>
+#include <sstream>
+
+#include <fmt/format.h>
+
+#include "avalanche/fused_nodes.h"
+#include "avalanche/CodeCache.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/WorkGroupTuner.h"
+#include "avalanche/opencl_utils.h"
+
+namespace avalanche {
+
+Shape broadcast_size_masks(const std::vector<Shape> &shapes,
+                           std::vector<cl_ulong> &size_masks,
+                           std::vector<cl_ulong> &result_sub_sizes) {
+    Shape result_shape = shapes.at(0);
+    for (std::size_t k = 1; k < shapes.size(); ++k) {
+        result_shape = Shape::align_for_broadcasting(
+            result_shape, shapes[k])[2];
+    }
+    // a scalar value can be interpreted as a vector the shape (1,)
+    const auto rank = std::max<std::size_t>(result_shape.rank(), 1);
+    size_masks.assign(shapes.size() * rank, 0);
+    result_sub_sizes.assign(rank, 1);
+    for (std::size_t k = 0; k < shapes.size(); ++k) {
+        const auto &dims = shapes[k].dims();
+        const auto missing_dims = rank - dims.size();
+        std::size_t cumprod = 1;
+        for (std::size_t i = rank; i-- > missing_dims;) {
+            const auto dim = static_cast<std::size_t>(dims[i - missing_dims]);
+            size_masks[k * rank + i] = (dim == 1 ? 0 : cumprod);
+            cumprod *= dim;
+        }
+    }
+    std::size_t cumprod_res = 1;
+    for (std::size_t i = result_shape.rank(); i-- > 1;) {
+        cumprod_res *= result_shape.dims()[i];
+        result_sub_sizes[i - 1] = cumprod_res;
+    }
+    return result_shape;
+}
+
+
+// The function calculating one element of the result from the inputs,
+// together with macros declaring the inputs as arguments of a kernel
+// (SOURCE_ARGUMENTS) and calling the function (READ_SOURCE), the same
+// ones the reductions use for reading their sources
+static std::string generate_fused_function(const NodeRefList &steps,
+                                           const NodeRefList &inputs) {
+    std::map<NodeId, std::string> var_of_node;
+    std::ostringstream arguments, argument_names, index_declarations,
+        index_calculation, index_tail, body;
+    for (std::size_t k = 0; k < inputs.size(); ++k) {
+        const auto type_name = cl_type_name_of_array(inputs[k]->dtype());
+        var_of_node[inputs[k]->id] = fmt::format("in{}", k);
+        arguments << fmt::format(
+            "__global {type} *source{k}, const ulong source{k}_offset, ",
+            fmt::arg("type", type_name), fmt::arg("k", k));
+        argument_names << fmt::format("source{k}, source{k}_offset, ",
+                                      fmt::arg("k", k));
+        index_declarations << fmt::format("    ulong index{} = 0;\n", k);
+        index_calculation << fmt::format(
+            "        index{k} += dim_coord * size_masks[{k} * rank + j];\n",
+            fmt::arg("k", k));
+        index_tail << fmt::format(
+            "    index{k} += size_masks[{k} * rank + rank - 1]"
+            " * index_to_parse;\n"
+            "    const {type} in{k} = source{k}[source{k}_offset + index{k}];\n",
+            fmt::arg("type", type_name), fmt::arg("k", k));
+    }
+    for (std::size_t j = 0; j < steps.size(); ++j) {
+        const auto &step = steps[j];
+        std::vector<std::string> input_vars;
+        for (const auto &input: step->inputs()) {
+            input_vars.push_back(var_of_node.at(input->id));
+        }
+        auto output_var = fmt::format("t{}", j);
+        body << fmt::format("    {} {};\n    ",
+                            cl_type_name_of_array(step->dtype()), output_var)
+             << step->elementwise_code(input_vars, output_var) << "\n";
+        var_of_node[step->id] = output_var;
+    }
+
+    constexpr const char *function_template = R"clkernel(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#define SOURCE_ARGUMENTS(Type) {arguments}__global ulong *size_masks, __global ulong *result_sizes, const int rank
+#define READ_SOURCE(index) fused_value((index), {argument_names}size_masks, result_sizes, rank)
+
+inline {output_type} fused_value(
+        const ulong i, SOURCE_ARGUMENTS({output_type})) {{
+    ulong index_to_parse = i;
+{index_declarations}    for (int j = 0; j < rank - 1; ++j) {{
+        ulong dim_coord = index_to_parse / result_sizes[j];
+{index_calculation}        index_to_parse = index_to_parse % result_sizes[j];
+    }}
+{index_tail}{body}    return {result_var};
+}}
+    )clkernel";
+
+    return fmt::format(
+        function_template,
+        fmt::arg("arguments", arguments.str()),
+        fmt::arg("argument_names", argument_names.str()),
+        fmt::arg("output_type", cl_type_name_of_array(steps.back()->dtype())),
+        fmt::arg("index_declarations", index_declarations.str()),
+        fmt::arg("index_calculation", index_calculation.str()),
+        fmt::arg("index_tail", index_tail.str()),
+        fmt::arg("body", body.str()),
+        fmt::arg("result_var", var_of_node.at(steps.back()->id)));
+}
+
+static std::string generate_fused_kernel(const std::string &kernel_name,
+                                         ArrayType output_dtype,
+                                         const std::string &function) {
+    constexpr const char *kernel_template = R"clkernel(
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void {kernel_name}(
+         __global {output_type} *output,
+         const ulong result_size,
+         SOURCE_ARGUMENTS({output_type})) {{
+    for (ulong i = get_global_id(0); i < result_size; i += get_global_size(0)) {{
+        output[i] = READ_SOURCE(i);
+    }}
+}}
+    )clkernel";
+
+    return function + fmt::format(
+        kernel_template,
+        fmt::arg("kernel_name", kernel_name),
+        fmt::arg("output_type", cl_type_name_of_array(output_dtype)));
+}
+
+FusedElementWise::FusedElementWise(const NodeRefList &steps,
+                                   const NodeRefList &inputs)
+    :_steps{steps},
+     _inputs{inputs}
+{
+    if (_steps.empty() || _inputs.empty()) {
+        throw std::invalid_argument(
+            "Fused node needs at least one step and one input");
+    }
+    set_shape(_steps.back()->shape());
+    set_dtype(_steps.back()->dtype());
+    _prologue_source = generate_fused_function(_steps, _inputs);
+    // The name must identify the code, since the programs are cached
+    // by their names
+    _kernel_name = fmt::format(
+        "fused_elementwise_{:016x}",
+        std::hash<std::string>()(_prologue_source));
+    _kernel_source = generate_fused_kernel(_kernel_name, dtype(),
+                                           _prologue_source);
+}
+
+NodeRef FusedElementWise::make(const NodeRefList &steps,
+                               const NodeRefList &inputs) {
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<FusedElementWise>(
+            new FusedElementWise(steps, inputs)));
+}
+
+MultiArrayRef FusedElementWise::eval(Context &context,
+                                     ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        ArrayRefList input_values;
+        for (const auto &input: _inputs) {
+            input_values.push_back(input->eval(context, cache));
+        }
+        result = forward(context, cache, input_values);
+        cache.put(id, result);
+    }
+    return result;
+}
+
+FusedLaunch
+FusedElementWise::prepare_launch(const ArrayRefList &input_values) const {
+    FusedLaunch launch;
+    std::vector<Shape> input_shapes;
+    for (const auto &value: input_values) {
+        input_shapes.push_back(value->shape());
+    }
+    launch.result_shape = broadcast_size_masks(
+        input_shapes, launch.size_masks, launch.result_sub_sizes);
+    launch.input_values = input_values;
+
+    auto pool = input_values.at(0)->buffer_unsafe()->pool();
+    launch.size_masks_buffer = pool->constant_data_for_vector(
+        launch.size_masks);
+    launch.result_sizes_buffer = pool->constant_data_for_vector(
+        launch.result_sub_sizes);
+    launch.data_are_ready = make_event_list(
+        {launch.size_masks_buffer.is_uploaded,
+         launch.result_sizes_buffer.is_uploaded});
+    for (const auto &value: input_values) {
+        const auto &event = value->buffer_unsafe()->completion_event();
+        if (event.get() != nullptr) {
+            launch.data_are_ready.push_back(event);
+        }
+    }
+    return launch;
+}
+
+cl_uint FusedElementWise::set_source_arguments(
+        cl::Kernel &kernel, cl_uint first_arg,
+        const FusedLaunch &launch) const {
+    cl_uint arg = first_arg;
+    for (const auto &value: launch.input_values) {
+        kernel.setArg(arg++, value->cl_buffer_unsafe());
+        kernel.setArg(arg++, static_cast<cl_ulong>(value->buffer_offset()));
+    }
+    kernel.setArg(arg++, launch.size_masks_buffer.buffer);
+    kernel.setArg(arg++, launch.result_sizes_buffer.buffer);
+    kernel.setArg(arg++, static_cast<cl_int>(launch.result_sub_sizes.size()));
+    return arg;
+}
+
+void FusedLaunch::keep_alive_until_done(const MultiArrayRef &result) const {
+    result->add_dependencies(input_values);
+}
+
+MultiArrayRef FusedElementWise::forward(Context &context,
+                                        ExecutionCache &cache,
+                                        const ArrayRefList &input_values) const {
+    auto fused_launch = prepare_launch(input_values);
+    auto pool = input_values[0]->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    auto result = pool->make_array(fused_launch.result_shape, dtype());
+    result->set_label(_kernel_name + " at " + __func__, __LINE__);
+
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Broadcasted);
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue,
+        _kernel_name, _kernel_source, launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, _kernel_name, queue);
+    const auto result_size = fused_launch.result_shape.size();
+    kernel.setArg(0, result->cl_buffer_unsafe());
+    kernel.setArg(1, static_cast<cl_ulong>(result_size));
+    set_source_arguments(kernel, 2, fused_launch);
+    cl::Event result_event;
+    queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(launch.global_size(result_size)),
+        cl::NDRange(launch.work_group_size),
+        &fused_launch.data_are_ready,
+        &result_event);
+    fused_launch.keep_alive_until_done(result);
+    result->set_completion_event(result_event);
+    return result;
+}
+
+std::string FusedElementWise::to_string() const {
+    return _steps.back()->to_string();
+}
+
+std::string FusedElementWise::repr() const {
+    return format_repr("FusedElementWise", "",
+                       fmt::format("{} steps", _steps.size()));
+}
+
+const NodeRef
+FusedElementWise::apply_chain_rule(const NodeRef &wrt_input,
+                                   const NodeRef &d_target_wrt_this,
+                                   const NodeRefList &all_inputs) const {
+    throw std::logic_error(
+        "Fused nodes exist only within execution plans "
+        "and cannot be differentiated");
+}
+
+void FusedElementWise::collect_programs(const cl::Device &device,
+                                        ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Broadcasted);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
+NodeWithPrologue::NodeWithPrologue(
+        const NodeRef &node,
+        const std::shared_ptr<FusedElementWise> &prologue)
+    :_node{node},
+     _prologue{prologue}
+{
+    set_shape(_node->shape());
+    set_dtype(_node->dtype());
+}
+
+NodeRef NodeWithPrologue::make(const NodeRef &node, const NodeRef &prologue) {
+    auto fused_prologue = std::dynamic_pointer_cast<FusedElementWise>(
+        prologue);
+    if (!fused_prologue) {
+        throw std::invalid_argument(fmt::format(
+            "{} is not a fused element-wise node", prologue->repr()));
+    }
+    if (!node->accepts_elementwise_prologue()) {
+        throw std::invalid_argument(fmt::format(
+            "{} cannot read its input from an element-wise prologue",
+            node->repr()));
+    }
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<NodeWithPrologue>(
+            new NodeWithPrologue(node, fused_prologue)));
+}
+
+MultiArrayRef NodeWithPrologue::eval(Context &context,
+                                     ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        ArrayRefList input_values;
+        for (const auto &input: inputs()) {
+            input_values.push_back(input->eval(context, cache));
+        }
+        result = forward(context, cache, input_values);
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef NodeWithPrologue::forward(Context &context,
+                                        ExecutionCache &cache,
+                                        const ArrayRefList &input_values) const {
+    return _node->forward_with_prologue(context, cache, *_prologue,
+                                        input_values);
+}
+
+std::string NodeWithPrologue::to_string() const {
+    return _node->to_string();
+}
+
+std::string NodeWithPrologue::repr() const {
+    return format_repr("NodeWithPrologue", "",
+                       fmt::format("{} after {} steps", _node->repr(),
+                                   _prologue->steps().size()));
+}
+
+const NodeRef
+NodeWithPrologue::apply_chain_rule(const NodeRef &wrt_input,
+                                   const NodeRef &d_target_wrt_this,
+                                   const NodeRefList &all_inputs) const {
+    throw std::logic_error(
+        "Fused nodes exist only within execution plans "
+        "and cannot be differentiated");
+}
+
+void NodeWithPrologue::collect_programs(const cl::Device &device,
+                                        ProgramSourceList &programs) const {
+    _node->collect_programs(device, programs);
+    _node->collect_programs_with_prologue(device, *_prologue, programs);
+}
+
+} // namespace
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <clblast.h>
 #include <iostream>
 
@@ -6,71 +7,75 @@
 #include "avalanche/math_ops/BroadcastedBinaryOp.h"
 #include "avalanche/opencl_utils.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/casting.h"
 
 namespace avalanche {
 
-constexpr const std::size_t WORK_GROUP_SIZE = 64;
 
 
-std::string broadcasing_kernel_name(const std::string &operation_name,
-                                    ArrayType left_dtype,
-                                    ArrayType righ_dtype,
-                                    ArrayType output_dtype) {
+std::string broadcasting_kernel_name(const std::string &operation_name,
+                                     ArrayType left_dtype,
+                                     ArrayType right_dtype,
+                                     ArrayType output_dtype,
+                                     const BroadcastPattern &pattern) {
     return fmt::format(
-        "broadcasted_{operation_name}_{left_type}_{right_type}_{output_type}",
+        "broadcasted_{operation_name}_{left_type}_{right_type}_{output_type}"
+        "_{signature}",
         fmt::arg("operation_name", operation_name),
         fmt::arg("left_type", cl_type_name_of_array(left_dtype)),
-        fmt::arg("right_type", cl_type_name_of_array(righ_dtype)),
-        fmt::arg("output_type", cl_type_name_of_array(output_dtype)));
+        fmt::arg("right_type", cl_type_name_of_array(right_dtype)),
+        fmt::arg("output_type", cl_type_name_of_array(output_dtype)),
+        fmt::arg("signature", pattern.signature()));
 }
 
-std::string generate_broadcasting_kernel(const std::string &operation_name,
+std::string generate_broadcasting_kernel(const std::string &kernel_name,
                                          ArrayType left_dtype,
                                          ArrayType right_dtype,
                                          ArrayType output_dtype,
                                          const std::string &operation_code,
-                                         int work_group_size) {
+                                         const BroadcastPattern &pattern) {
     constexpr const char *kernel_template = R"clkernel(
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__kernel __attribute__((reqd_work_group_size({work_group_size}, 1, 1)))
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
 void {kernel_name}(
          __global {left_dtype} *source1,
          const ulong source1_offset,
          __global {right_dtype} *source2,
          const ulong source2_offset,
          __global {output_type} *output,
-         __global ulong *size_mask1,
-         __global ulong *size_mask2,
-         __global ulong *result_sizes,
-         const ulong result_size,
-         const int rank) {{
-    ulong index_to_parse = get_global_id(0);
-    ulong source1_index = 0, source2_index = 0;
-    for (int j = 0; j < rank - 1; ++j) {{
-        ulong dim_coord = index_to_parse / result_sizes[j];
-        source1_index += dim_coord * size_mask1[j];
-        source2_index += dim_coord * size_mask2[j];
-        index_to_parse = index_to_parse % result_sizes[j];
-    }}
-    source1_index += size_mask1[rank - 1] * index_to_parse;
-    source2_index += size_mask2[rank - 1] * index_to_parse;
-    if (get_global_id(0) < result_size) {{
-        {left_dtype} a = source1[source1_offset + source1_index];
-        {right_dtype} b = source2[source2_offset + source2_index];
-        output[get_global_id(0)] = ({output_type})({operation_code});
+         const ulong result_size) {{
+    {read_outside_of_loop}
+    for (ulong i = get_global_id(0); i < result_size; i += get_global_size(0)) {{
+        {read_within_loop}
+        output[i] = ({output_type})({operation_code});
     }}
 }}
     )clkernel";
 
+    // Broadcast scalars are read only once
+    std::string read_outside_of_loop, read_within_loop;
+    auto add_read = [&](const char *var, const char *source,
+                        ArrayType dtype, bool left) {
+        auto index = pattern.index_expression(left, "i");
+        auto code = fmt::format(
+            "const {dtype} {var} = {source}[{source}_offset + {index}];",
+            fmt::arg("dtype", cl_type_name_of_array(dtype)),
+            fmt::arg("var", var),
+            fmt::arg("source", source),
+            fmt::arg("index", index));
+        (index == "0" ? read_outside_of_loop : read_within_loop) += code;
+    };
+    add_read("a", "source1", left_dtype, true);
+    add_read("b", "source2", right_dtype, false);
+
     return fmt::format(
         kernel_template,
-        fmt::arg("kernel_name",
-                 broadcasing_kernel_name(
-                     operation_name, left_dtype, right_dtype, output_dtype)),
+        fmt::arg("kernel_name", kernel_name),
         fmt::arg("operation_code", operation_code),
-        fmt::arg("work_group_size", work_group_size),
+        fmt::arg("read_outside_of_loop", read_outside_of_loop),
+        fmt::arg("read_within_loop", read_within_loop),
         fmt::arg("left_dtype", cl_type_name_of_array(left_dtype)),
         fmt::arg("right_dtype", cl_type_name_of_array(right_dtype)),
         fmt::arg("output_type", cl_type_name_of_array(output_dtype)));
@@ -110,20 +115,99 @@ std::size_t broadcast_size_masks(const Shape &shape1, const Shape &shape2,
     return aligned_shapes[2].size();
 }
 
+BroadcastPattern BroadcastPattern::of(const Shape &left,
+                                      const Shape &right) {
+    Shape left_aligned, right_aligned, result_shape;
+    Shape::align_for_broadcasting(
+        left, right, left_aligned, right_aligned, result_shape);
+    BroadcastPattern result;
+    for (std::size_t i = 0; i < result_shape.rank(); ++i) {
+        if (result_shape.dims()[i] == 1) {
+            continue;
+        }
+        bool left_runs = left_aligned.dims()[i] != 1;
+        bool right_runs = right_aligned.dims()[i] != 1;
+        auto dim = static_cast<std::size_t>(result_shape.dims()[i]);
+        if (!result.dims.empty() && result.left_runs.back() == left_runs
+                && result.right_runs.back() == right_runs) {
+            result.dims.back() *= dim;
+        } else {
+            result.dims.push_back(dim);
+            result.left_runs.push_back(left_runs);
+            result.right_runs.push_back(right_runs);
+        }
+    }
+    if (result.dims.empty()) {
+        // Both arrays have just one element
+        result.dims.push_back(1);
+        result.left_runs.push_back(true);
+        result.right_runs.push_back(true);
+    }
+    return result;
+}
+
+std::string BroadcastPattern::signature() const {
+    // "b" - both arrays run along the dimension,
+    // "l" or "r" - only the left (right) one does
+    std::string result;
+    for (std::size_t i = 0; i < dims.size(); ++i) {
+        if (i > 0) {
+            result += "_";
+        }
+        result += (left_runs[i] && right_runs[i]) ? "b"
+                  : (left_runs[i] ? "l" : "r");
+        if (i > 0) {
+            result += std::to_string(dims[i]);
+        }
+    }
+    return result;
+}
+
+std::string BroadcastPattern::index_expression(
+        bool left, const std::string &item_var) const {
+    const auto &runs = left ? left_runs : right_runs;
+    if (std::all_of(runs.begin(), runs.end(), [](bool r) { return r; })) {
+        return item_var;
+    }
+    if (std::none_of(runs.begin(), runs.end(), [](bool r) { return r; })) {
+        return "0";
+    }
+    std::string result;
+    std::size_t sub_size = 1, stride = 1;
+    for (auto i = static_cast<long>(dims.size()) - 1; i >= 0; --i) {
+        if (runs[i]) {
+            std::string coord;
+            if (i == 0) {
+                coord = fmt::format("{} / {}UL", item_var, sub_size);
+            } else if (sub_size == 1) {
+                coord = fmt::format("{} % {}UL", item_var, dims[i]);
+            } else {
+                coord = fmt::format("{} / {}UL % {}UL",
+                                    item_var, sub_size, dims[i]);
+            }
+            if (stride != 1) {
+                coord = fmt::format("({}) * {}UL", coord, stride);
+            }
+            result = result.empty() ? coord : coord + " + " + result;
+            stride *= dims[i];
+        }
+        sub_size *= dims[i];
+    }
+    return fmt::format("({})", result);
+}
+
 BroadcastedBinaryOp::BroadcastedBinaryOp(const NodeRef &left,
                                          const NodeRef &right,
                                          const std::string &operation_name,
                                          const std::string &operation_cl_code,
                                          ArrayType output_dtype)
     :_result_dtype{output_dtype},
+     _left_dtype{left->dtype()},
+     _right_dtype{right->dtype()},
+     _left_shape{left->shape()},
+     _right_shape{right->shape()},
      _operation_name{operation_name},
-     _kernel_name{
-         broadcasing_kernel_name(
-             operation_name, left->dtype(), right->dtype(), output_dtype)},
-     _kernel_source{
-         generate_broadcasting_kernel(
-             operation_name, left->dtype(), right->dtype(), output_dtype,
-             operation_cl_code, WORK_GROUP_SIZE)}
+     _operation_code{operation_cl_code}
 {
     // Here we calculate only a preliminary result shape for debugging
     // purposes. The real shape can be only evaluated in runtime (`forward`)
@@ -133,79 +217,97 @@ BroadcastedBinaryOp::BroadcastedBinaryOp(const NodeRef &left,
         tmp_left_shape_aligned, tmp_right_shape_aligned, _result_shape);
 }
 
+std::string BroadcastedBinaryOp::kernel_name(
+        const BroadcastPattern &pattern) const {
+    return broadcasting_kernel_name(
+        _operation_name, _left_dtype, _right_dtype, _result_dtype, pattern);
+}
+
+std::string BroadcastedBinaryOp::kernel_source(
+        const BroadcastPattern &pattern) const {
+    return generate_broadcasting_kernel(
+        kernel_name(pattern), _left_dtype, _right_dtype, _result_dtype,
+        _operation_code, pattern);
+}
+
+void BroadcastedBinaryOp::collect_programs(const cl::Device &device,
+                                           ProgramSourceList &programs) const {
+    // Unless both shapes are known in advance, the kernel will be compiled
+    // on the first run, when the real shapes and the pattern are known
+    if (!(_left_shape.is_complete() && _right_shape.is_complete())) {
+        return;
+    }
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Broadcasted);
+    const auto pattern = BroadcastPattern::of(_left_shape, _right_shape);
+    programs.push_back(
+        {kernel_name(pattern), kernel_source(pattern),
+         launch.build_options()});
+}
+
+std::string BroadcastedBinaryOp::elementwise_code(
+        const std::vector<std::string> &input_vars,
+        const std::string &output_var) const {
+    return fmt::format(
+        "{{ const {left_dtype} a = {left}; const {right_dtype} b = {right}; "
+        "{output} = ({output_dtype})({operation_code}); }}",
+        fmt::arg("left_dtype", cl_type_name_of_array(_left_dtype)),
+        fmt::arg("right_dtype", cl_type_name_of_array(_right_dtype)),
+        fmt::arg("output_dtype", cl_type_name_of_array(_result_dtype)),
+        fmt::arg("left", input_vars[0]),
+        fmt::arg("right", input_vars[1]),
+        fmt::arg("output", output_var),
+        fmt::arg("operation_code", _operation_code));
+}
 
 MultiArrayRef avalanche::BroadcastedBinaryOp::forward(
         const MultiArrayRef &v1,
         const MultiArrayRef &v2) const {
-    // Calculating sizes, alignments, differences
+    // At this point we assume that every aspect of both arrays have already
+    // been checked by the constructor, so there's nothing to worry about
     Shape result_shape, aligned_shape_left, aligned_shape_right;
-    std::vector<cl_ulong> left_size_mask, right_size_mask, result_sub_sizes;
-
     Shape::align_for_broadcasting(
         v1->shape(), v2->shape(),
         aligned_shape_left, aligned_shape_right, result_shape);
-    broadcast_size_masks(
-        v1->shape(), v2->shape(),
-        left_size_mask, right_size_mask, result_sub_sizes);
+    const auto pattern = BroadcastPattern::of(v1->shape(), v2->shape());
 
-    // At this point we assume that every aspect of both arrays have already
-    // been checked by the constructor, so there's nothing to worry about
-    // Also at this point both arrays v1 and v2 may still be calculating,
-    // so meanwhile we prepare and upload some other data
     auto pool = v1->buffer_unsafe()->pool();
     auto queue = pool->cl_queue();
-    auto left_mask_buffer = pool->reserve_buffer_for_vector(left_size_mask);
-    left_mask_buffer->set_label(__func__, __LINE__);
-    auto right_mask_buffer = pool->reserve_buffer_for_vector(right_size_mask);
-    right_mask_buffer->set_label(__func__, __LINE__);
-    auto result_sizes_buffer = pool->reserve_buffer_for_vector(result_sub_sizes);
-    result_sizes_buffer->set_label(__func__, __LINE__);
-
-
-
-    auto masks_are_ready = make_event_list(
-        {left_mask_buffer->write_from_vector(left_size_mask, 0),
-         right_mask_buffer->write_from_vector(right_size_mask, 0),
-         result_sizes_buffer->write_from_vector(result_sub_sizes, 0)});
     auto data_are_ready = make_event_list(
         {v1->buffer_unsafe()->completion_event(),
          v2->buffer_unsafe()->completion_event()});
-    std::copy(masks_are_ready.begin(), masks_are_ready.end(),
-              std::back_inserter(data_are_ready));
     auto result = pool->make_array(result_shape, _result_dtype);
     result->set_label(_operation_name + " at " + __func__, __LINE__);
     // To keep the buffers alive until the computation is done we add them
     // as dependencies.
-    result->add_dependencies(
-        {left_mask_buffer, right_mask_buffer, result_sizes_buffer});
     result->add_dependencies({v1, v2});
-    // The main job
+    // The main job. Each pattern gets its own program, which is compiled
+    // only once and then taken from the cache. The name has the signature
+    // of the pattern, so the source is generated only on the first run.
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Broadcasted);
+    const auto name = kernel_name(pattern);
     auto program = CodeCache::get_default().get_program(
-        pool->cl_context(), queue,
-        _kernel_name, _kernel_source, "");
+        pool->cl_context(), queue, name,
+        [this, &pattern]() { return kernel_source(pattern); },
+        launch.build_options());
     using Buf = const cl::Buffer&;
-    cl::KernelFunctor<Buf, cl_ulong, Buf, cl_ulong, Buf, Buf, Buf, Buf, cl_ulong, cl_int>
-        kernel_functor(program, _kernel_name);
+    cl::KernelFunctor<Buf, cl_ulong, Buf, cl_ulong, Buf, cl_ulong>
+        kernel_functor(CodeCache::get_default().get_kernel(
+            program, name, queue));
     const auto result_size = result_shape.size();
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, result_size);
+    const auto work_items = launch.global_size(result_size);
     cl::Event result_event = kernel_functor(
         cl::EnqueueArgs(queue,
                         data_are_ready,
                         cl::NDRange(work_items),
-                        cl::NDRange(WORK_GROUP_SIZE)),
+                        cl::NDRange(launch.work_group_size)),
         v1->cl_buffer_unsafe(),
         static_cast<cl_ulong>(v1->buffer_offset()),
         v2->cl_buffer_unsafe(),
         static_cast<cl_ulong>(v2->buffer_offset()),
         result->cl_buffer_unsafe(),
-        left_mask_buffer->cl_buffer_unsafe(),
-        right_mask_buffer->cl_buffer_unsafe(),
-        result_sizes_buffer->cl_buffer_unsafe(),
-        static_cast<cl_ulong>(result_size),
-        static_cast<cl_int>(left_size_mask.size()));
-    // Without waiting we cannot guarantee that OpenCL will have enough
-    // time to copy all the data into the buffers before the vectors are gone
-    cl::WaitForEvents(masks_are_ready);
+        static_cast<cl_ulong>(result_size));
     // Let us know when everything is done by marking the resulting array
     // as "complete" (ready)
     result->set_completion_event(result_event);
@@ -3,11 +3,10 @@
 #include "avalanche/math_ops/ElemWiseBinaryOp.h"
 #include "avalanche/opencl_utils.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 
 namespace avalanche {
 
-constexpr const std::size_t WORK_GROUP_SIZE = 64;
-
 std::string elemwise_binary_kernel_name(
     const std::string &operation_name,
     ArrayType left_dtype,
@@ -27,12 +26,12 @@ std::string elemwise_binary_kernel_code(
     ArrayType left_dtype,
     ArrayType right_dtype,
     ArrayType output_dtype,
-    const std::string &operation_code,
-    int work_group_size) {
+    const std::string &operation_code) {
+    // WORK_GROUP_SIZE comes from the build options (see WorkGroupTuner)
     constexpr const char *kernel_template = R"clkernel(
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__kernel __attribute__((reqd_work_group_size({work_group_size}, 1, 1)))
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
 void {kernel_name}(
          __global {left_dtype} *left_source,
          const ulong left_offset,
@@ -40,10 +39,10 @@ void {kernel_name}(
          const ulong right_offset,
          __global {output_dtype} *output,
          const ulong data_size) {{
-    if (get_global_id(0) < data_size) {{
-        {left_dtype} a = left_source[left_offset + get_global_id(0)];
-        {right_dtype} b = right_source[right_offset + get_global_id(0)];
-        output[get_global_id(0)] = ({output_dtype})({operation_code});
+    for (ulong i = get_global_id(0); i < data_size; i += get_global_size(0)) {{
+        {left_dtype} a = left_source[left_offset + i];
+        {right_dtype} b = right_source[right_offset + i];
+        output[i] = ({output_dtype})({operation_code});
     }}
 }}
     )clkernel";
@@ -53,7 +52,66 @@ void {kernel_name}(
         fmt::arg("kernel_name",
                  elemwise_binary_kernel_name(operation_name, left_dtype, right_dtype, output_dtype)),
         fmt::arg("operation_code", operation_code),
-        fmt::arg("work_group_size", work_group_size),
+        fmt::arg("left_dtype", cl_type_name_of_array(left_dtype)),
+        fmt::arg("right_dtype", cl_type_name_of_array(right_dtype)),
+        fmt::arg("output_dtype", cl_type_name_of_array(output_dtype)));
+}
+
+std::string elemwise_binary_batch_kernel_code(
+    const std::string &kernel_name,
+    ArrayType left_dtype,
+    ArrayType right_dtype,
+    ArrayType output_dtype,
+    const std::string &operation_code,
+    std::size_t batch_size) {
+    // Each segment of the batch has its own arrays. The table keeps
+    // the end of each segment and the offsets of its inputs.
+    constexpr const char *kernel_template = R"clkernel(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void {kernel_name}(
+{arguments}         __global const ulong *segments,
+         const ulong total_size) {{
+    __global {left_dtype} *left_sources[] = {{{left_sources}}};
+    __global {right_dtype} *right_sources[] = {{{right_sources}}};
+    __global {output_dtype} *outputs[] = {{{outputs}}};
+    for (ulong i = get_global_id(0); i < total_size; i += get_global_size(0)) {{
+        int s = 0;
+        while (i >= segments[3 * s]) {{
+            ++s;
+        }}
+        const ulong j = i - (s == 0 ? 0 : segments[3 * (s - 1)]);
+        {left_dtype} a = left_sources[s][segments[3 * s + 1] + j];
+        {right_dtype} b = right_sources[s][segments[3 * s + 2] + j];
+        outputs[s][j] = ({output_dtype})({operation_code});
+    }}
+}}
+    )clkernel";
+
+    std::string arguments, left_sources, right_sources, outputs;
+    for (std::size_t k = 0; k < batch_size; ++k) {
+        arguments += fmt::format(
+            "         __global {left_dtype} *left_source{k},\n"
+            "         __global {right_dtype} *right_source{k},\n"
+            "         __global {output_dtype} *output{k},\n",
+            fmt::arg("left_dtype", cl_type_name_of_array(left_dtype)),
+            fmt::arg("right_dtype", cl_type_name_of_array(right_dtype)),
+            fmt::arg("output_dtype", cl_type_name_of_array(output_dtype)),
+            fmt::arg("k", k));
+        const char *separator = (k == 0 ? "" : ", ");
+        left_sources += fmt::format("{}left_source{}", separator, k);
+        right_sources += fmt::format("{}right_source{}", separator, k);
+        outputs += fmt::format("{}output{}", separator, k);
+    }
+    return fmt::format(
+        kernel_template,
+        fmt::arg("kernel_name", kernel_name),
+        fmt::arg("arguments", arguments),
+        fmt::arg("left_sources", left_sources),
+        fmt::arg("right_sources", right_sources),
+        fmt::arg("outputs", outputs),
+        fmt::arg("operation_code", operation_code),
         fmt::arg("left_dtype", cl_type_name_of_array(left_dtype)),
         fmt::arg("right_dtype", cl_type_name_of_array(right_dtype)),
         fmt::arg("output_dtype", cl_type_name_of_array(output_dtype)));
@@ -65,9 +123,12 @@ ElemWiseBinaryOp::ElemWiseBinaryOp(const NodeRef &left, const NodeRef &right,
                                    ArrayType output_dtype)
 :_result_shape{infer_elemwise_shape(left->shape(), right->shape())},
  _result_dtype{output_dtype},
+ _left_dtype{left->dtype()},
+ _right_dtype{right->dtype()},
  _operation_name{operation_name},
+ _operation_code{operation_cl_code},
  _kernel_name{elemwise_binary_kernel_name(operation_name, left->dtype(), right->dtype(), output_dtype)},
- _kernel_source{elemwise_binary_kernel_code(operation_name, left->dtype(), right->dtype(), output_dtype, operation_cl_code, WORK_GROUP_SIZE)}
+ _kernel_source{elemwise_binary_kernel_code(operation_name, left->dtype(), right->dtype(), output_dtype, operation_cl_code)}
 {
 }
 
@@ -107,6 +168,28 @@ Shape ElemWiseBinaryOp::infer_elemwise_shape(const Shape &shape1,
     return Shape(result_dims);
 }
 
+void ElemWiseBinaryOp::collect_programs(const cl::Device &device,
+                                        ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::ElementWise);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
+std::string ElemWiseBinaryOp::elementwise_code(
+        const std::vector<std::string> &input_vars,
+        const std::string &output_var) const {
+    return fmt::format(
+        "{{ const {left_dtype} a = {left}; const {right_dtype} b = {right}; "
+        "{output} = ({output_dtype})({operation_code}); }}",
+        fmt::arg("left_dtype", cl_type_name_of_array(_left_dtype)),
+        fmt::arg("right_dtype", cl_type_name_of_array(_right_dtype)),
+        fmt::arg("output_dtype", cl_type_name_of_array(_result_dtype)),
+        fmt::arg("left", input_vars[0]),
+        fmt::arg("right", input_vars[1]),
+        fmt::arg("output", output_var),
+        fmt::arg("operation_code", _operation_code));
+}
+
 MultiArrayRef ElemWiseBinaryOp::forward(const MultiArrayRef &v1,
                                         const MultiArrayRef &v2) const {
     if (v1->shape() != v2->shape()) {
@@ -130,19 +213,22 @@ MultiArrayRef ElemWiseBinaryOp::forward(const MultiArrayRef &v1,
     // as dependencies.
     result->add_dependencies({v1, v2});
     // The main job
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::ElementWise);
     auto program = CodeCache::get_default().get_program(
         pool->cl_context(), queue,
-        _kernel_name, _kernel_source, "");
+        _kernel_name, _kernel_source, launch.build_options());
     using Buf = const cl::Buffer&;
     cl::KernelFunctor<Buf, cl_ulong, Buf, cl_ulong, Buf, cl_ulong>
-        kernel_functor(program, _kernel_name);
+        kernel_functor(CodeCache::get_default().get_kernel(
+            program, _kernel_name, queue));
     const auto result_size = v1->shape().size();
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, result_size);
+    const auto work_items = launch.global_size(result_size);
     cl::Event result_event = kernel_functor(
         cl::EnqueueArgs(queue,
                         data_are_ready,
                         cl::NDRange(work_items),
-                        cl::NDRange(WORK_GROUP_SIZE)),
+                        cl::NDRange(launch.work_group_size)),
         v1->cl_buffer_unsafe(),
         static_cast<cl_ulong>(v1->buffer_offset()),
         v2->cl_buffer_unsafe(),
@@ -155,4 +241,81 @@ MultiArrayRef ElemWiseBinaryOp::forward(const MultiArrayRef &v1,
     return result;
 }
 
+ArrayRefList ElemWiseBinaryOp::forward_batch(
+        const std::vector<ArrayRefList> &input_values) const {
+    std::vector<cl_ulong> segments;
+    std::size_t total_size = 0;
+    for (const auto &values: input_values) {
+        const auto &v1 = values[0], &v2 = values[1];
+        if (v1->shape() != v2->shape()) {
+            throw std::invalid_argument(
+                fmt::format("Cannot perform element-wise operation {} on two "
+                            "incompatible arrays with different shapes: "
+                            "{} and {}", _operation_name,
+                            v1->shape().to_string(), v2->shape().to_string()));
+        }
+        total_size += v1->shape().size();
+        segments.insert(segments.end(),
+                        {static_cast<cl_ulong>(total_size),
+                         static_cast<cl_ulong>(v1->buffer_offset()),
+                         static_cast<cl_ulong>(v2->buffer_offset())});
+    }
+    auto pool = input_values.at(0)[0]->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    // The same batch usually runs with the same offsets again and again,
+    // so the table gets uploaded only once
+    auto segments_buffer = pool->constant_data_for_vector(segments);
+    auto data_are_ready = make_event_list({segments_buffer.is_uploaded});
+    ArrayRefList results;
+    for (const auto &values: input_values) {
+        for (const auto &value: values) {
+            const auto &event = value->buffer_unsafe()->completion_event();
+            if (event.get() != nullptr) {
+                data_are_ready.push_back(event);
+            }
+        }
+        auto result = pool->make_array(values[0]->shape(), _result_dtype);
+        result->set_label(_operation_name + " at " + __func__, __LINE__);
+        result->add_dependencies(values);
+        results.push_back(result);
+    }
+
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::ElementWise);
+    const auto kernel_name = fmt::format(
+        "{}_batch_{}", _kernel_name, input_values.size());
+    // The source is generated only the first time the batch is launched
+    const auto batch_size = input_values.size();
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue, kernel_name,
+        [this, &kernel_name, batch_size]() {
+            return elemwise_binary_batch_kernel_code(
+                kernel_name, _left_dtype, _right_dtype, _result_dtype,
+                _operation_code, batch_size);
+        },
+        launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, kernel_name, queue);
+    cl_uint arg = 0;
+    for (std::size_t k = 0; k < input_values.size(); ++k) {
+        kernel.setArg(arg++, input_values[k][0]->cl_buffer_unsafe());
+        kernel.setArg(arg++, input_values[k][1]->cl_buffer_unsafe());
+        kernel.setArg(arg++, results[k]->cl_buffer_unsafe());
+    }
+    kernel.setArg(arg++, segments_buffer.buffer);
+    kernel.setArg(arg++, static_cast<cl_ulong>(total_size));
+    cl::Event result_event;
+    queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(launch.global_size(total_size)),
+        cl::NDRange(launch.work_group_size),
+        &data_are_ready,
+        &result_event);
+    for (auto &result: results) {
+        result->set_completion_event(result_event);
+    }
+    return results;
+}
+
 } // namespace
@@ -1,25 +1,27 @@
 #include "clblast.h"
+#include <fmt/format.h>
 
 #include "avalanche/base_ops_nodes.h"
+#include "avalanche/CodeCache.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/opencl_utils.h"
 #include "avalanche/math_ops/messages.h"
 #include "avalanche/macroses.h"
 #include "avalanche/casting.h"
+#include "avalanche/terminal_nodes.h"
 
 #include "avalanche/math_ops/MatMul.h"
+#include "avalanche/math_ops/BroadcastedBinaryOp.h"
+#include "avalanche/math_ops/ElemWiseBinaryOp.h"
+#include "avalanche/math_ops/simple_arithemic.h"
+#include "avalanche/math_ops/const_transformation.h"
+#include "avalanche/math_ops/reductions.h"
 
 namespace avalanche {
 
-MatMul::MatMul(const NodeRef &left, const NodeRef &right,
-               bool transpose_left,
-               bool transpose_right)
-    :transpose_left{transpose_left},
-     transpose_right{transpose_right},
-     _result_shape({
-                      transpose_left ? left->shape().dim(1) : left->shape().dim(0),
-                      transpose_right ? right->shape().dim(0) : right->shape().dim(1)}),
-     _result_dtype{left->dtype()}
-{
+static void check_matmul_dtypes(const NodeRef &left, const NodeRef &right) {
     if (left->dtype() != right->dtype()) {
         throw std::invalid_argument(
             "You cannot multiply matrices of different types");
@@ -30,6 +32,33 @@ MatMul::MatMul(const NodeRef &left, const NodeRef &right,
         throw std::invalid_argument(
             "MatMul supports only data types with floating point");
     }
+}
+
+// CLBlast cannot wait for any events, so instead of waiting for
+// the inputs on the host we let the queue do it: the barrier holds
+// back everything enqueued after it, including all kernels of the GEMM
+static void enqueue_barrier_for_inputs(cl::CommandQueue &queue,
+                                       const MultiArrayRef &v1,
+                                       const MultiArrayRef &v2) {
+    auto inputs_are_ready = make_event_list(
+        {v1->buffer_unsafe()->completion_event(),
+         v2->buffer_unsafe()->completion_event()});
+    if (!inputs_are_ready.empty()) {
+        queue.enqueueBarrierWithWaitList(&inputs_are_ready);
+    }
+}
+
+MatMul::MatMul(const NodeRef &left, const NodeRef &right,
+               bool transpose_left,
+               bool transpose_right)
+    :transpose_left{transpose_left},
+     transpose_right{transpose_right},
+     _result_shape({
+                      transpose_left ? left->shape().dim(1) : left->shape().dim(0),
+                      transpose_right ? right->shape().dim(0) : right->shape().dim(1)}),
+     _result_dtype{left->dtype()}
+{
+    check_matmul_dtypes(left, right);
     if (left->shape().rank() != 2) {
         throw std::invalid_argument(
             "Left operand must be a matrix (tensor rank 2)");
@@ -55,12 +84,6 @@ inline clblast::StatusCode array_gemm(
     const MultiArrayRef &result,
     cl_command_queue *queue, cl_event *result_event)
 {
-    auto inputs_are_ready = make_event_list(
-        {a->buffer_unsafe()->completion_event(),
-         b->buffer_unsafe()->completion_event()});
-    if (!inputs_are_ready.empty()) {
-        cl::Event::waitForEvents(inputs_are_ready);
-    }
     return clblast::Gemm<T>(
         clblast::Layout::kRowMajor,
         transpose_a ? clblast::Transpose::kYes : clblast::Transpose::kNo,
@@ -69,9 +92,9 @@ inline clblast::StatusCode array_gemm(
         static_cast<const size_t>(b->shape().dim(transpose_b ? 0 : 1)),
         static_cast<const size_t>(a->shape().dim(transpose_a ? 0 : 1)),
         to_array_type<T>(1.0f),
-        a->cl_buffer_unsafe()(), 0,
+        a->cl_buffer_unsafe()(), a->buffer_offset(),
         static_cast<const size_t>(a->shape().dim(-1)),
-        b->cl_buffer_unsafe()(), 0,
+        b->cl_buffer_unsafe()(), b->buffer_offset(),
         static_cast<const size_t>(b->shape().dim(-1)),
         to_array_type<T>(0.0f),
         result->buffer_unsafe()->cl_buffer_unsafe()(), 0,
@@ -100,6 +123,7 @@ MatMul::forward(const MultiArrayRef &v1, const MultiArrayRef &v2) const {
     auto result = pool->make_array(result_shape, _result_dtype);
     result->set_label(__func__, __LINE__);
     result->add_dependencies({v1, v2});
+    enqueue_barrier_for_inputs(queue, v1, v2);
     cl_command_queue ll_queue = queue.get();
     cl_event result_event = nullptr;
     auto status = gemm_switch(
@@ -137,4 +161,496 @@ const NodeRef MatMul::apply_chain_rule(const NodeRef &wrt_input,
         throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
     }
 }
+
+
+// Sizes of the matrices and how the batch dimensions of the operands
+// get broadcast to the result
+struct BatchGeometry {
+    ShapeDim m, n, k;
+    Shape left_batch;
+    Shape right_batch;
+    Shape result_batch;
+    Shape result_shape;
+};
+
+static Shape batch_dims_of(const Shape &shape) {
+    return Shape(std::vector<ShapeDim>(shape.dims().begin(),
+                                       shape.dims().end() - 2));
+}
+
+static BatchGeometry batch_geometry(const Shape &left, const Shape &right,
+                                    bool transpose_left,
+                                    bool transpose_right) {
+    if (left.rank() < 2 || right.rank() < 2) {
+        throw std::invalid_argument(
+            fmt::format("Both operands of BatchMatMul must have at least "
+                        "two dimensions, got {} and {}",
+                        left.to_string(), right.to_string()));
+    }
+    BatchGeometry result;
+    result.m = left.dim(transpose_left ? -1 : -2);
+    result.k = left.dim(transpose_left ? -2 : -1);
+    result.n = right.dim(transpose_right ? -2 : -1);
+    const auto right_k = right.dim(transpose_right ? -1 : -2);
+    if (result.k != UnknownDim && right_k != UnknownDim
+            && result.k != right_k) {
+        throw std::invalid_argument(
+            fmt::format("Number of columns in the first matrix must be "
+                        "the same as the number of rows in the second. "
+                        "With respect to transpositions, if needed. "
+                        "Got shapes {} and {}",
+                        left.to_string(), right.to_string()));
+    }
+    Shape::align_for_broadcasting(
+        batch_dims_of(left), batch_dims_of(right),
+        result.left_batch, result.right_batch, result.result_batch);
+    auto result_dims = result.result_batch.dims();
+    result_dims.push_back(result.m);
+    result_dims.push_back(result.n);
+    result.result_shape = Shape(result_dims);
+    return result;
+}
+
+template <typename T>
+inline clblast::StatusCode array_batch_gemm(
+    const MultiArrayRef &a, bool transpose_a,
+    const MultiArrayRef &b, bool transpose_b,
+    const MultiArrayRef &result,
+    const BatchGeometry &geometry,
+    cl_command_queue *queue, cl_event *result_event)
+{
+    const auto m = static_cast<size_t>(geometry.m);
+    const auto n = static_cast<size_t>(geometry.n);
+    const auto k = static_cast<size_t>(geometry.k);
+    const auto a_ld = static_cast<size_t>(a->shape().dim(-1));
+    const auto b_ld = static_cast<size_t>(b->shape().dim(-1));
+    const auto a_transpose = (
+        transpose_a ? clblast::Transpose::kYes : clblast::Transpose::kNo);
+    const auto b_transpose = (
+        transpose_b ? clblast::Transpose::kYes : clblast::Transpose::kNo);
+    const auto batch_count = geometry.result_batch.size();
+    if (geometry.right_batch.size() == 1 && !transpose_a) {
+        // Matrices of the left operand lie one after another,
+        // making one tall matrix, so a single GEMM does the job
+        return clblast::Gemm<T>(
+            clblast::Layout::kRowMajor, a_transpose, b_transpose,
+            batch_count * m, n, k,
+            to_array_type<T>(1.0f),
+            a->cl_buffer_unsafe()(), a->buffer_offset(), a_ld,
+            b->cl_buffer_unsafe()(), b->buffer_offset(), b_ld,
+            to_array_type<T>(0.0f),
+            result->cl_buffer_unsafe()(), result->buffer_offset(), n,
+            queue, result_event);
+    }
+    if (geometry.left_batch == geometry.result_batch
+            && geometry.right_batch == geometry.result_batch) {
+        return clblast::GemmStridedBatched<T>(
+            clblast::Layout::kRowMajor, a_transpose, b_transpose,
+            m, n, k,
+            to_array_type<T>(1.0f),
+            a->cl_buffer_unsafe()(), a->buffer_offset(), a_ld, m * k,
+            b->cl_buffer_unsafe()(), b->buffer_offset(), b_ld, k * n,
+            to_array_type<T>(0.0f),
+            result->cl_buffer_unsafe()(), result->buffer_offset(), n, m * n,
+            batch_count, queue, result_event);
+    }
+    // Some matrices are used more than once, so each multiplication gets
+    // its own offsets, found the same way broadcasting kernels find
+    // their elements
+    std::vector<cl_ulong> left_mask, right_mask, result_sub_sizes;
+    broadcast_size_masks(geometry.left_batch, geometry.right_batch,
+                         left_mask, right_mask, result_sub_sizes);
+    const auto rank = left_mask.size();
+    std::vector<size_t> a_offsets, b_offsets, c_offsets;
+    for (std::size_t i = 0; i < batch_count; ++i) {
+        std::size_t index_to_parse = i, left_index = 0, right_index = 0;
+        for (std::size_t j = 0; j + 1 < rank; ++j) {
+            const auto dim_coord = index_to_parse / result_sub_sizes[j];
+            left_index += dim_coord * left_mask[j];
+            right_index += dim_coord * right_mask[j];
+            index_to_parse %= result_sub_sizes[j];
+        }
+        left_index += left_mask[rank - 1] * index_to_parse;
+        right_index += right_mask[rank - 1] * index_to_parse;
+        a_offsets.push_back(a->buffer_offset() + left_index * m * k);
+        b_offsets.push_back(b->buffer_offset() + right_index * k * n);
+        c_offsets.push_back(result->buffer_offset() + i * m * n);
+    }
+    std::vector<T> alphas(batch_count, to_array_type<T>(1.0f));
+    std::vector<T> betas(batch_count, to_array_type<T>(0.0f));
+    return clblast::GemmBatched<T>(
+        clblast::Layout::kRowMajor, a_transpose, b_transpose,
+        m, n, k,
+        alphas.data(),
+        a->cl_buffer_unsafe()(), a_offsets.data(), a_ld,
+        b->cl_buffer_unsafe()(), b_offsets.data(), b_ld,
+        betas.data(),
+        result->cl_buffer_unsafe()(), c_offsets.data(), n,
+        batch_count, queue, result_event);
+}
+
+ARRAY_DTYPE_SWITCH_FLOAT_FUNCTION(batch_gemm_switch, array_batch_gemm,
+                                  clblast::StatusCode,)
+
+BatchMatMul::BatchMatMul(const NodeRef &left, const NodeRef &right,
+                         bool transpose_left,
+                         bool transpose_right)
+    :transpose_left{transpose_left},
+     transpose_right{transpose_right},
+     _result_shape{
+         batch_geometry(left->shape(), right->shape(),
+                        transpose_left, transpose_right).result_shape},
+     _result_dtype{left->dtype()}
+{
+    check_matmul_dtypes(left, right);
+}
+
+MultiArrayRef
+BatchMatMul::forward(const MultiArrayRef &v1, const MultiArrayRef &v2) const {
+    const auto geometry = batch_geometry(
+        v1->shape(), v2->shape(), transpose_left, transpose_right);
+    auto pool = v1->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    auto result = pool->make_array(geometry.result_shape, _result_dtype);
+    result->set_label(__func__, __LINE__);
+    result->add_dependencies({v1, v2});
+    enqueue_barrier_for_inputs(queue, v1, v2);
+    cl_command_queue ll_queue = queue.get();
+    cl_event result_event = nullptr;
+    auto status = batch_gemm_switch(
+        _result_dtype, v1, transpose_left, v2, transpose_right, result,
+        geometry, &ll_queue, &result_event);
+    if (status != clblast::StatusCode::kSuccess) {
+        throw std::runtime_error(
+            std::string("OpenCL error reported failure: ") +
+            get_opencl_error_string(static_cast<int>(status)));
+    }
+    result->set_completion_event(result_event);
+    return result;
+}
+
+const NodeRef BatchMatMul::apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const {
+    NodeRef derivative;
+    if (all_inputs[0] == wrt_input) {
+        if (transpose_left) {
+            derivative = F<BatchMatMul>(all_inputs[1], d_target_wrt_this,
+                                        transpose_right, true);
+        } else {
+            derivative = F<BatchMatMul>(d_target_wrt_this, all_inputs[1],
+                                        false, !transpose_right);
+        }
+    } else if (all_inputs[1] == wrt_input) {
+        if (transpose_right) {
+            derivative = F<BatchMatMul>(d_target_wrt_this, all_inputs[0],
+                                        true, transpose_left);
+        } else {
+            derivative = F<BatchMatMul>(all_inputs[0], d_target_wrt_this,
+                                        !transpose_left, false);
+        }
+    } else {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+    // The matrices an input shares between several batches
+    // collect the gradients of all of them
+    derivative = F<ReduceSum>(derivative, F<NoBackProp>(wrt_input), true);
+    if (derivative->shape() != wrt_input->shape()) {
+        derivative = ReshapeLike::make(derivative, wrt_input);
+    }
+    return derivative;
+}
+
+
+const char* activation_name(Activation activation) {
+    switch (activation) {
+        case Activation::Linear:
+            return "linear";
+        case Activation::ReLU:
+            return "relu";
+        case Activation::Sigmoid:
+            return "sigmoid";
+        case Activation::Tanh:
+            return "tanh";
+    }
+    return "unknown";
+}
+
+// The same expressions (of `v`) the separate activation nodes use
+static std::string activation_expression(Activation activation,
+                                         ArrayType dtype) {
+    switch (activation) {
+        case Activation::ReLU:
+            return ReLU::opencl_expression(dtype);
+        case Activation::Sigmoid:
+            return Sigmoid::opencl_expression(dtype);
+        case Activation::Tanh:
+            return Tanh::opencl_expression(dtype);
+        default:
+            return "v";
+    }
+}
+
+/**
+ * The gradient (a) multiplied by the derivative of the activation,
+ * which is found from the output of the activation (b).
+ */
+class ActivationDiff : public ElemWiseBinaryOp {
+public:
+    ActivationDiff(const NodeRef &gradient, const NodeRef &output,
+                   Activation activation)
+        : ElemWiseBinaryOp(
+            gradient, output,
+            std::string("diff_") + activation_name(activation),
+            diff_code(activation), output->dtype()),
+          _activation{activation} {}
+
+    static std::string diff_code(Activation activation) {
+        switch (activation) {
+            case Activation::ReLU:
+                return "b > 0 ? a : 0";
+            case Activation::Sigmoid:
+                return "a * b * (1 - b)";
+            case Activation::Tanh:
+                return "a * (1 - b * b)";
+            default:
+                return "a";
+        }
+    }
+
+    std::string name() const { return "diff_activation"; }
+
+    const NodeRef apply_chain_rule(const NodeRef &wrt_input,
+                                   const NodeRef &d_target_wrt_this,
+                                   const NodeRefList &all_inputs) const {
+        const auto &gradient = all_inputs[0], &output = all_inputs[1];
+        if (gradient == wrt_input) {
+            // Linear in the gradient, so it's the same derivative
+            // of the activation applied to d_target_wrt_this
+            return std::static_pointer_cast<BaseNode>(
+                std::make_shared<BinaryOp<ActivationDiff>>(
+                    d_target_wrt_this, output, _activation));
+        } else if (output == wrt_input) {
+            auto product = F<ElemWiseMultiply>(d_target_wrt_this, gradient);
+            switch (_activation) {
+                case Activation::Sigmoid:
+                    // d(a * b * (1 - b)) / db = a * (1 - 2 * b)
+                    return F<Minus>(
+                        product,
+                        FU<Scale>(F<ElemWiseMultiply>(product, output), 2.0f));
+                case Activation::Tanh:
+                    // d(a * (1 - b * b)) / db = -2 * a * b
+                    return FU<Scale>(F<ElemWiseMultiply>(product, output),
+                                     -2.0f);
+                default:
+                    // Piecewise constant in the output
+                    return Constant::zeros_like(output);
+            }
+        } else {
+            throw std::logic_error(
+                messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+        }
+    }
+
+private:
+    Activation _activation;
+};
+
+Dense::Dense(const NodeRef &inputs, const NodeRef &weights,
+             const NodeRef &bias, Activation activation)
+    :_inputs{inputs},
+     _weights{weights},
+     _bias{bias},
+     _activation{activation}
+{
+    set_shape(Shape({inputs->shape().dim(0), weights->shape().dim(1)}));
+    set_dtype(inputs->dtype());
+
+    // WORK_GROUP_SIZE comes from the build options (see WorkGroupTuner)
+    constexpr const char *kernel_template = R"clkernel(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void {kernel_name}(
+         __global {dtype} *output,
+         const ulong output_offset,
+         __global {dtype} *bias,
+         const ulong bias_offset,
+         const ulong num_units,
+         const ulong result_size) {{
+    for (ulong i = get_global_id(0); i < result_size; i += get_global_size(0)) {{
+        const {dtype} v = (
+            output[output_offset + i] + bias[bias_offset + i % num_units]);
+        output[output_offset + i] = {activation};
+    }}
+}}
+    )clkernel";
+
+    _kernel_name = fmt::format("dense_epilogue_{}_{}",
+                               activation_name(activation),
+                               cl_type_name_of_array(dtype()));
+    _kernel_source = fmt::format(
+        kernel_template,
+        fmt::arg("kernel_name", _kernel_name),
+        fmt::arg("dtype", cl_type_name_of_array(dtype())),
+        fmt::arg("activation", activation_expression(activation, dtype())));
+}
+
+NodeRef Dense::make(const NodeRef &inputs, const NodeRef &weights,
+                    const NodeRef &bias, Activation activation) {
+    check_matmul_dtypes(inputs, weights);
+    if (bias->dtype() != inputs->dtype()) {
+        throw std::invalid_argument(
+            "The bias must have the same type as the inputs");
+    }
+    if (inputs->shape().rank() != 2 || weights->shape().rank() != 2
+            || bias->shape().rank() != 1) {
+        throw std::invalid_argument(
+            fmt::format("Dense layer expects a matrix of inputs, a matrix "
+                        "of weights and a vector of biases, got shapes "
+                        "{}, {} and {}", inputs->shape().to_string(),
+                        weights->shape().to_string(),
+                        bias->shape().to_string()));
+    }
+    auto features = inputs->shape().dim(1);
+    auto weight_rows = weights->shape().dim(0);
+    auto units = weights->shape().dim(1);
+    auto bias_size = bias->shape().dim(0);
+    if ((features != UnknownDim && weight_rows != UnknownDim
+            && features != weight_rows)
+        || (units != UnknownDim && bias_size != UnknownDim
+            && units != bias_size)) {
+        throw std::invalid_argument(
+            fmt::format("Shapes of the inputs {}, the weights {} and "
+                        "the bias {} don't match",
+                        inputs->shape().to_string(),
+                        weights->shape().to_string(),
+                        bias->shape().to_string()));
+    }
+    auto node = std::shared_ptr<Dense>(
+        new Dense(inputs, weights, bias, activation));
+    node->_self = node;
+    return std::static_pointer_cast<BaseNode>(node);
+}
+
+MultiArrayRef Dense::eval(Context &context, ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        ArrayRefList input_values;
+        for (const auto &input: inputs()) {
+            input_values.push_back(input->eval(context, cache));
+        }
+        result = forward(context, cache, input_values);
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef Dense::forward(Context &context, ExecutionCache &cache,
+                             const ArrayRefList &input_values) const {
+    const auto &inputs = input_values[0];
+    const auto &weights = input_values[1];
+    const auto &bias = input_values[2];
+    if (inputs->shape().dim(1) != weights->shape().dim(0)
+            || weights->shape().dim(1) != bias->shape().dim(0)) {
+        throw std::invalid_argument(
+            fmt::format("Shapes of the inputs {}, the weights {} and "
+                        "the bias {} don't match",
+                        inputs->shape().to_string(),
+                        weights->shape().to_string(),
+                        bias->shape().to_string()));
+    }
+    const Shape result_shape(
+        {inputs->shape().dim(0), weights->shape().dim(1)});
+    auto pool = inputs->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    auto result = pool->make_array(result_shape, dtype());
+    result->set_label(std::string("Dense at ") + __func__, __LINE__);
+    result->add_dependencies(input_values);
+
+    enqueue_barrier_for_inputs(queue, inputs, weights);
+    cl_command_queue ll_queue = queue.get();
+    cl_event gemm_event = nullptr;
+    auto status = gemm_switch(
+        dtype(), inputs, false, weights, false, result,
+        &ll_queue, &gemm_event);
+    if (status != clblast::StatusCode::kSuccess) {
+        throw std::runtime_error(
+            std::string("OpenCL error reported failure: ") +
+            get_opencl_error_string(static_cast<int>(status)));
+    }
+    // The epilogue works on the result of the GEMM in place
+    auto epilogue_can_start = make_event_list(
+        {cl::Event(gemm_event), bias->buffer_unsafe()->completion_event()});
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::ElementWise);
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue,
+        _kernel_name, _kernel_source, launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, _kernel_name, queue);
+    const auto result_size = result_shape.size();
+    kernel.setArg(0, result->cl_buffer_unsafe());
+    kernel.setArg(1, static_cast<cl_ulong>(result->buffer_offset()));
+    kernel.setArg(2, bias->cl_buffer_unsafe());
+    kernel.setArg(3, static_cast<cl_ulong>(bias->buffer_offset()));
+    kernel.setArg(4, static_cast<cl_ulong>(result_shape.dim(1)));
+    kernel.setArg(5, static_cast<cl_ulong>(result_size));
+    cl::Event result_event;
+    queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(launch.global_size(result_size)),
+        cl::NDRange(launch.work_group_size),
+        &epilogue_can_start,
+        &result_event);
+    result->set_completion_event(result_event);
+    return result;
+}
+
+std::string Dense::to_string() const {
+    return fmt::format("{}({} matmul {} + {})", activation_name(_activation),
+                       _inputs->to_string(), _weights->to_string(),
+                       _bias->to_string());
+}
+
+std::string Dense::repr() const {
+    return format_repr("Dense", "", activation_name(_activation));
+}
+
+const NodeRef Dense::apply_chain_rule(const NodeRef &wrt_input,
+                                      const NodeRef &d_target_wrt_this,
+                                      const NodeRefList &all_inputs) const {
+    // The same node is made for every input, but execution plans
+    // merge structurally identical nodes, so it's calculated only once
+    NodeRef d_before_activation = d_target_wrt_this;
+    if (_activation != Activation::Linear) {
+        d_before_activation = std::static_pointer_cast<BaseNode>(
+            std::make_shared<BinaryOp<ActivationDiff>>(
+                d_target_wrt_this, _self.lock(), _activation));
+    }
+    if (all_inputs[0] == wrt_input) {
+        return F<MatMul>(d_before_activation, all_inputs[1], false, true);
+    } else if (all_inputs[1] == wrt_input) {
+        return F<MatMul>(all_inputs[0], d_before_activation, true, false);
+    } else if (all_inputs[2] == wrt_input) {
+        auto derivative = F<ReduceSum>(
+            d_before_activation, F<NoBackProp>(wrt_input), true);
+        if (derivative->shape() != wrt_input->shape()) {
+            derivative = ReshapeLike::make(derivative, wrt_input);
+        }
+        return derivative;
+    } else {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+}
+
+void Dense::collect_programs(const cl::Device &device,
+                             ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::ElementWise);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
 } // namespace
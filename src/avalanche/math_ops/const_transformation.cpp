@@ -80,6 +80,25 @@ const NodeRef ReLU::partial_derivative(const NodeRef &input) const {
     return FU<ReLUDiff>(input);
 }
 
+class ClipDiff : public ConstTransform<2> {
+public:
+    static std::string opencl_expression(ArrayType dtype) {
+        const char *type_name = cl_type_name_of_array(dtype);
+        return fmt::format("(v >= p0 && v <= p1) ? ({0})1 : ({0})0", type_name);
+    }
+
+    ClipDiff(const NodeRef &input, float min_value, float max_value)
+        :ConstTransform<2>(
+            input, input->dtype(),
+            {},
+            opencl_expression(input->dtype()), "diffclip(", ")",
+            {min_value, max_value}) {}
+};
+
+const NodeRef Clip::partial_derivative(const NodeRef &input) const {
+    return FU<ClipDiff>(input, params[0], params[1]);
+}
+
 const NodeRef Exp::partial_derivative(const NodeRef &input) const {
     return FU<Exp>(input);
 }
@@ -5,7 +5,11 @@
 #include "avalanche/math_ops/messages.h"
 #include "avalanche/math_ops/simple_arithemic.h"
 #include "avalanche/math_ops/const_transformation.h"
+#include "avalanche/math_ops/reductions.h"
 #include "avalanche/terminal_nodes.h"
+#include "avalanche/shape_nodes.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/WorkGroupTuner.h"
 
 namespace avalanche {
 
@@ -56,4 +60,313 @@ std::string BinaryCrossEntropy::opencl_expression(ArrayType left_dtype,
     return fmt::format("-b * log(a) - (1.0 - b) * log(({0})1.0 - a)", left_type_name);
 }
 
+// The shape of the logits without the axis (the shape of the losses)
+static Shape shape_of_losses(const Shape &logits_shape, ShapeDim axis) {
+    auto dims = logits_shape.dims();
+    dims.erase(dims.begin() + axis);
+    return Shape(dims);
+}
+
+// Whether the shapes can turn out the same, once all dims are known
+static bool shapes_may_match(const Shape &shape1, const Shape &shape2) {
+    if (shape1.rank() != shape2.rank()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < shape1.rank(); ++i) {
+        if (shape1.dim(i) != shape2.dim(i) && shape1.dim(i) != UnknownDim
+                && shape2.dim(i) != UnknownDim) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_labels_shape(const Shape &labels_shape,
+                               const Shape &expected_shape) {
+    if (!shapes_may_match(labels_shape, expected_shape)) {
+        throw std::invalid_argument(
+            fmt::format("The labels must have shape {}, got {}",
+                        expected_shape.to_string(),
+                        labels_shape.to_string()));
+    }
+}
+
+static void check_logits_and_labels(const NodeRef &logits,
+                                    const NodeRef &labels,
+                                    bool is_sparse) {
+    if (!is_floating_array_type(logits->dtype())) {
+        throw std::invalid_argument(
+            fmt::format("The logits must be a floating point array, got {}",
+                        array_type_name(logits->dtype())));
+    }
+    if (is_sparse) {
+        if (labels->dtype() != ArrayType::int32
+                && labels->dtype() != ArrayType::int64) {
+            throw std::invalid_argument(
+                fmt::format("The labels must be int32 or int64 indices "
+                            "of classes, got {}",
+                            array_type_name(labels->dtype())));
+        }
+    } else if (labels->dtype() != logits->dtype()) {
+        throw std::invalid_argument(
+            fmt::format("The labels must have the same type as "
+                        "the logits ({}), got {}",
+                        array_type_name(logits->dtype()),
+                        array_type_name(labels->dtype())));
+    }
+}
+
+// The part of the names of the kernels telling the types they work with
+static std::string cross_entropy_kernel_types(ArrayType logits_dtype,
+                                              ArrayType labels_dtype,
+                                              bool is_sparse) {
+    if (is_sparse) {
+        return fmt::format("{}_{}", array_type_name(logits_dtype),
+                           array_type_name(labels_dtype));
+    }
+    return array_type_name(logits_dtype);
+}
+
+static void collect_softmax_program(const cl::Device &device,
+                                    ProgramSourceList &programs) {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Reduction);
+    auto program = softmax_program_source();
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
+SoftmaxCrossEntropy::SoftmaxCrossEntropy(const NodeRef &logits,
+                                         const NodeRef &labels,
+                                         ShapeDim axis)
+    :_logits{logits},
+     _labels{labels},
+     _axis{axis}
+{
+    set_shape(shape_of_losses(logits->shape(), axis));
+    set_dtype(logits->dtype());
+}
+
+NodeRef SoftmaxCrossEntropy::make(const NodeRef &logits,
+                                  const NodeRef &labels,
+                                  ShapeDim axis) {
+    check_logits_and_labels(logits, labels, false);
+    auto normalized_axis = logits->shape().normalize_dims({axis}).at(0);
+    check_labels_shape(labels->shape(), logits->shape());
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<SoftmaxCrossEntropy>(
+            new SoftmaxCrossEntropy(logits, labels, normalized_axis)));
+}
+
+MultiArrayRef SoftmaxCrossEntropy::eval(Context &context,
+                                        ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        result = forward(context, cache,
+                         {_logits->eval(context, cache),
+                          _labels->eval(context, cache)});
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef SoftmaxCrossEntropy::forward(
+        Context &context, ExecutionCache &cache,
+        const ArrayRefList &input_values) const {
+    const auto &logits_shape = input_values[0]->shape();
+    if (input_values[1]->shape() != logits_shape) {
+        throw std::invalid_argument(
+            fmt::format("The labels must have shape {}, got {}",
+                        logits_shape.to_string(),
+                        input_values[1]->shape().to_string()));
+    }
+    return launch_softmax_kernel(
+        "softmax_cross_entropy",
+        cross_entropy_kernel_types(dtype(), _labels->dtype(), false),
+        input_values, logits_shape, _axis,
+        shape_of_losses(logits_shape, _axis), dtype());
+}
+
+std::string SoftmaxCrossEntropy::to_string() const {
+    return fmt::format("softmax_cross_entropy({}, {}, {})",
+                       _logits->to_string(), _labels->to_string(), _axis);
+}
+
+std::string SoftmaxCrossEntropy::repr() const {
+    return format_repr("SoftmaxCrossEntropy", "",
+                       fmt::format("axis: {}", _axis));
+}
+
+const NodeRef SoftmaxCrossEntropy::apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const {
+    if (all_inputs[0] == wrt_input) {
+        return SoftmaxCrossEntropyGradient::make(
+            d_target_wrt_this, all_inputs[0], all_inputs[1], _axis, false);
+    } else if (all_inputs[1] == wrt_input) {
+        // -log(softmax(logits)), scaled by the gradient of each loss
+        return F<Multiply>(
+            FU<ExpandDims>(d_target_wrt_this, _axis),
+            FU<Scale>(FU<Log>(Softmax::make(all_inputs[0], _axis)), -1.0f));
+    } else {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+}
+
+void SoftmaxCrossEntropy::collect_programs(const cl::Device &device,
+                                           ProgramSourceList &programs) const {
+    collect_softmax_program(device, programs);
+}
+
+SparseSoftmaxCrossEntropy::SparseSoftmaxCrossEntropy(const NodeRef &logits,
+                                                     const NodeRef &labels,
+                                                     ShapeDim axis)
+    :SoftmaxCrossEntropy(logits, labels, axis)
+{
+}
+
+NodeRef SparseSoftmaxCrossEntropy::make(const NodeRef &logits,
+                                        const NodeRef &labels,
+                                        ShapeDim axis) {
+    check_logits_and_labels(logits, labels, true);
+    auto normalized_axis = logits->shape().normalize_dims({axis}).at(0);
+    check_labels_shape(labels->shape(),
+                       shape_of_losses(logits->shape(), normalized_axis));
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<SparseSoftmaxCrossEntropy>(
+            new SparseSoftmaxCrossEntropy(logits, labels, normalized_axis)));
+}
+
+MultiArrayRef SparseSoftmaxCrossEntropy::forward(
+        Context &context, ExecutionCache &cache,
+        const ArrayRefList &input_values) const {
+    const auto &logits_shape = input_values[0]->shape();
+    const auto result_shape = shape_of_losses(logits_shape, _axis);
+    if (input_values[1]->shape() != result_shape) {
+        throw std::invalid_argument(
+            fmt::format("The labels must have shape {}, got {}",
+                        result_shape.to_string(),
+                        input_values[1]->shape().to_string()));
+    }
+    return launch_softmax_kernel(
+        "sparse_softmax_cross_entropy",
+        cross_entropy_kernel_types(dtype(), _labels->dtype(), true),
+        input_values, logits_shape, _axis, result_shape, dtype());
+}
+
+std::string SparseSoftmaxCrossEntropy::to_string() const {
+    return fmt::format("sparse_softmax_cross_entropy({}, {}, {})",
+                       _logits->to_string(), _labels->to_string(), _axis);
+}
+
+std::string SparseSoftmaxCrossEntropy::repr() const {
+    return format_repr("SparseSoftmaxCrossEntropy", "",
+                       fmt::format("axis: {}", _axis));
+}
+
+const NodeRef SparseSoftmaxCrossEntropy::apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const {
+    if (all_inputs[0] == wrt_input) {
+        return SoftmaxCrossEntropyGradient::make(
+            d_target_wrt_this, all_inputs[0], all_inputs[1], _axis, true);
+    } else if (all_inputs[1] == wrt_input) {
+        throw std::logic_error(
+            "Indices of classes used as labels have no derivatives");
+    } else {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+}
+
+SoftmaxCrossEntropyGradient::SoftmaxCrossEntropyGradient(
+        const NodeRef &gradient, const NodeRef &logits,
+        const NodeRef &labels, ShapeDim axis, bool is_sparse)
+    :_gradient{gradient},
+     _logits{logits},
+     _labels{labels},
+     _axis{axis},
+     _is_sparse{is_sparse}
+{
+    set_shape(logits->shape());
+    set_dtype(logits->dtype());
+}
+
+NodeRef SoftmaxCrossEntropyGradient::make(const NodeRef &gradient,
+                                          const NodeRef &logits,
+                                          const NodeRef &labels,
+                                          ShapeDim axis, bool is_sparse) {
+    check_logits_and_labels(logits, labels, is_sparse);
+    if (gradient->dtype() != logits->dtype()) {
+        throw std::invalid_argument(
+            "The gradient must have the same type as the logits");
+    }
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<SoftmaxCrossEntropyGradient>(
+            new SoftmaxCrossEntropyGradient(
+                gradient, logits, labels, axis, is_sparse)));
+}
+
+MultiArrayRef SoftmaxCrossEntropyGradient::eval(Context &context,
+                                                ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        result = forward(context, cache,
+                         {_gradient->eval(context, cache),
+                          _logits->eval(context, cache),
+                          _labels->eval(context, cache)});
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef SoftmaxCrossEntropyGradient::forward(
+        Context &context, ExecutionCache &cache,
+        const ArrayRefList &input_values) const {
+    const auto &logits_shape = input_values[1]->shape();
+    const auto losses_shape = shape_of_losses(logits_shape, _axis);
+    const auto &labels_shape = input_values[2]->shape();
+    if (input_values[0]->shape() != losses_shape
+            || labels_shape != (_is_sparse ? losses_shape : logits_shape)) {
+        throw std::invalid_argument(
+            fmt::format("Shapes of the gradient {}, the logits {} and "
+                        "the labels {} don't match",
+                        input_values[0]->shape().to_string(),
+                        logits_shape.to_string(),
+                        labels_shape.to_string()));
+    }
+    return launch_softmax_kernel(
+        (_is_sparse
+         ? "sparse_softmax_cross_entropy_gradient"
+         : "softmax_cross_entropy_gradient"),
+        cross_entropy_kernel_types(dtype(), _labels->dtype(), _is_sparse),
+        input_values, logits_shape, _axis, logits_shape, dtype());
+}
+
+std::string SoftmaxCrossEntropyGradient::to_string() const {
+    return fmt::format("{}softmax_cross_entropy_gradient({}, {}, {}, {})",
+                       _is_sparse ? "sparse_" : "",
+                       _gradient->to_string(), _logits->to_string(),
+                       _labels->to_string(), _axis);
+}
+
+std::string SoftmaxCrossEntropyGradient::repr() const {
+    return format_repr("SoftmaxCrossEntropyGradient", "",
+                       fmt::format("axis: {}, sparse: {}", _axis, _is_sparse));
+}
+
+const NodeRef SoftmaxCrossEntropyGradient::apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const {
+    throw std::logic_error(
+        "Second derivatives of softmax cross-entropy are not implemented");
+}
+
+void SoftmaxCrossEntropyGradient::collect_programs(
+        const cl::Device &device, ProgramSourceList &programs) const {
+    collect_softmax_program(device, programs);
+}
+
 } // namespace
@@ -1,5 +1,8 @@
 #include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <cmath>
 
@@ -8,6 +11,8 @@
 
 #include "avalanche/opencl_utils.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
+#include "avalanche/fused_nodes.h"
 #include "avalanche/math_ops/reductions.h"
 #include "avalanche/math_ops/simple_arithemic.h"
 #include "avalanche/terminal_nodes.h"
@@ -21,7 +26,6 @@ constexpr char cl_sources_of_random_generators[] = {
 #include "avalanche/kernels/reductions.hex"
 };
 
-constexpr std::size_t WORK_GROUP_SIZE = 64;
 
 
 Reduction::Reduction(const NodeRef &input)
@@ -47,27 +51,38 @@ void Reduction::estimate_steps_and_dimensions(
         result_shape_dims_cut = Shape();
     } else {
         // Preparing list of intermediate steps necessary to reduce
-        // all requested dimensions (one by one)
+        // all requested dimensions. Adjacent dimensions are laid out
+        // in memory just like one dimension of their combined size,
+        // so each run of them gets cut by a single step.
         reduction_steps.reserve(dims_to_cut.size());
         std::vector<ShapeDim> result_dims = input_shape.dims();
         std::vector<ShapeDim> result_dims_preserved = input_shape.dims();
-        for (auto dim = dims_to_cut.rbegin();
-             dim != dims_to_cut.rend(); ++dim) {
+        auto run_end = dims_to_cut.rbegin();
+        while (run_end != dims_to_cut.rend()) {
+            auto run_start = run_end;
+            while (std::next(run_start) != dims_to_cut.rend()
+                   && *std::next(run_start) == *run_start - 1) {
+                ++run_start;
+            }
+            const auto first_dim = *run_start, last_dim = *run_end;
             ReductionStep step{};
-            step.dim_size = static_cast<size_t>(result_dims[*dim]);
+            step.dim_size = 1;
+            for (auto dim = first_dim; dim <= last_dim; ++dim) {
+                step.dim_size *= static_cast<size_t>(result_dims[dim]);
+                result_dims_preserved[dim] = 1;
+            }
             step.source_block = 1;
-            for (auto next_dim = result_dims.begin() + *dim + 1;
+            for (auto next_dim = result_dims.begin() + last_dim + 1;
                  next_dim != result_dims.end(); ++next_dim) {
                 step.source_block *= *next_dim;
             }
             step.source_stride = step.source_block * step.dim_size;
-            std::move(result_dims.begin() + *dim + 1, result_dims.end(),
-                      result_dims.begin() + *dim);
-            result_dims.resize(result_dims.size() - 1);
+            result_dims.erase(result_dims.begin() + first_dim,
+                              result_dims.begin() + last_dim + 1);
             step.result_size = 1;
             for (auto d: result_dims) { step.result_size *= d; }
             reduction_steps.push_back(step);
-            result_dims_preserved[*dim] = 1;
+            run_end = std::next(run_start);
         }
         result_shape_dims_cut = Shape(result_dims);
         result_shape_dims_kept = Shape(result_dims_preserved);
@@ -116,6 +131,23 @@ Reduction::Reduction(const NodeRef &input,
     }
 }
 
+int Reduction::passthrough_input(const NodeRef &input) const {
+    const bool nothing_to_reduce = (
+        input->shape().is_complete()
+        && input->shape() == shape()
+        && input->dtype() == dtype());
+    return nothing_to_reduce ? 0 : -1;
+}
+
+int Reduction::passthrough_input(const NodeRef &input,
+                                 const NodeRef &to_be_like) const {
+    // The result gets the shape of `to_be_like` only in runtime
+    if (!to_be_like->shape().is_complete()) {
+        return -1;
+    }
+    return passthrough_input(input);
+}
+
 std::vector<ShapeDim> Reduction::estimate_dims_to_cut(
         const Shape &input_shape, const Shape &to_be_like_shape) const {
     Shape input_shape_aligned, sample_shape_aligned, output_shape_aligned;
@@ -133,56 +165,147 @@ std::vector<ShapeDim> Reduction::estimate_dims_to_cut(
     return dims_to_cut;
 }
 
-cl::Program load_reduction_program(cl::CommandQueue &queue) {
+const ProgramSource& reduction_program_source() {
+    static const ProgramSource source {
+        "reductions", cl_sources_of_random_generators, ""};
+    return source;
+}
+
+cl::Program load_reduction_program(cl::CommandQueue &queue,
+                                   const LaunchConfig &launch) {
     auto context = get_context_from_queue(queue);
+    const auto &program = reduction_program_source();
     return CodeCache::get_default().get_program(
         context,
         queue,
-        "reductions",
-        cl_sources_of_random_generators,
-        "");
+        program.name,
+        program.source,
+        launch.build_options());
+}
+
+// The same reductions, reading their sources through the prologue
+static ProgramSource reduction_program_source(
+        const FusedElementWise &prologue) {
+    const auto &program = reduction_program_source();
+    return {fmt::format("{}_of_{}", program.name, prologue.kernel_name()),
+            prologue.prologue_source() + program.source, ""};
+}
+
+// Loads the program the first step of a reduction needs and sets
+// the arguments telling the kernel where to read its source from.
+// Returns the index of the next argument.
+static cl_uint prepare_first_step(cl::CommandQueue &queue,
+                                  const LaunchConfig &launch,
+                                  const std::string &kernel_name,
+                                  const MultiArrayRef &value,
+                                  const FusedElementWise *prologue,
+                                  const FusedLaunch *prologue_launch,
+                                  cl::Kernel &kernel,
+                                  std::vector<cl::Event> &wait_for_events) {
+    if (prologue == nullptr) {
+        auto program = load_reduction_program(queue, launch);
+        kernel = CodeCache::get_default().get_kernel(
+            program, kernel_name, queue);
+        kernel.setArg(0, value->cl_buffer_unsafe());
+        kernel.setArg(1, static_cast<cl_ulong>(value->buffer_offset()));
+        wait_for_events = make_event_list(
+            {value->buffer_unsafe()->completion_event()});
+        return 2;
+    }
+    const auto source = reduction_program_source(*prologue);
+    auto program = CodeCache::get_default().get_program(
+        get_context_from_queue(queue), queue,
+        source.name, source.source, launch.build_options());
+    kernel = CodeCache::get_default().get_kernel(program, kernel_name, queue);
+    wait_for_events = prologue_launch->data_are_ready;
+    return prologue->set_source_arguments(kernel, 0, *prologue_launch);
+}
+
+// Whether the step is better done by whole work groups per output
+// (see `cooperative_reduction_kernel_template`) than by work items
+static bool reduce_cooperatively(std::size_t result_size,
+                                 std::size_t source_block,
+                                 std::size_t dim_size,
+                                 const LaunchConfig &launch) {
+    if (dim_size < launch.work_group_size) {
+        // Most of the group would be idle
+        return false;
+    }
+    // Contiguous dimensions are read by neighbouring work items at once,
+    // otherwise only having too few outputs to occupy the device
+    // makes the cooperation worth it
+    return source_block == 1 || result_size < dim_size;
 }
 
 MultiArrayRef Reduction::partial_reduction(
         const MultiArrayRef &value,
         const std::vector<ReductionStep> &reduction_steps,
         const Shape &result_shape_dims_cut,
-        const Shape &result_shape_dims_kept) const {
+        const Shape &result_shape_dims_kept,
+        const FusedElementWise *prologue,
+        const FusedLaunch *prologue_launch) const {
     if (reduction_steps.empty()) {
         // If we pass empty array as list of dimensions to reduce,
         // then we need to do nothing.
         return value;
     }
-    auto pool = value->buffer_unsafe()->pool();
+    auto pool = (prologue != nullptr
+                 ? prologue_launch->input_values.at(0)
+                 : value)->buffer_unsafe()->pool();
     auto queue = pool->cl_queue();
-    auto program = load_reduction_program(queue);
-    using KernelType = cl::KernelFunctor<
-        const cl::Buffer&, cl_ulong, const cl::Buffer&,
-        cl_ulong, cl_ulong, cl_ulong, cl_ulong>;
-    KernelType kernel(program, get_kernel_name(true));
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Reduction);
+    cl::Kernel kernel;
+    std::vector<cl::Event> wait_for_events;
     CLBufferRef result_buffer;
-    CLBufferRef source_buffer = value->buffer_unsafe();
-    std::vector<cl::Event> wait_for_events(1);
-    for (auto &step: reduction_steps) {
-        wait_for_events[0] = source_buffer->completion_event();
+    CLBufferRef source_buffer = (
+        prologue != nullptr ? nullptr : value->buffer_unsafe());
+    for (std::size_t i = 0; i < reduction_steps.size(); ++i) {
+        const auto &step = reduction_steps[i];
+        const bool is_cooperative = reduce_cooperatively(
+            step.result_size, step.source_block, step.dim_size, launch);
+        const auto kernel_name = (
+            is_cooperative
+            ? get_cooperative_kernel_name()
+            : get_kernel_name(true));
+        cl_uint arg;
+        if (i > 0) {
+            // All the steps after the first one read the previous result
+            auto program = load_reduction_program(queue, launch);
+            kernel = CodeCache::get_default().get_kernel(
+                program, kernel_name, queue);
+            kernel.setArg(0, source_buffer->cl_buffer_unsafe());
+            kernel.setArg(1, static_cast<cl_ulong>(0));
+            wait_for_events = make_event_list(
+                {source_buffer->completion_event()});
+            arg = 2;
+        } else {
+            arg = prepare_first_step(queue, launch, kernel_name, value,
+                                     prologue, prologue_launch,
+                                     kernel, wait_for_events);
+        }
         result_buffer = pool->reserve_buffer(
             step.result_size * array_type_size(_result_dtype));
-        result_buffer->add_dependencies({source_buffer});
-        const auto work_items = make_divisible_by(
-            WORK_GROUP_SIZE, step.result_size);
-
-        cl::Event reduction_is_done = kernel(
-            cl::EnqueueArgs(queue,
-                            wait_for_events,
-                            cl::NDRange(work_items),
-                            cl::NDRange(WORK_GROUP_SIZE)),
-            source_buffer->cl_buffer_unsafe(),
-            static_cast<cl_ulong>(value->buffer_offset()),
-            result_buffer->cl_buffer_unsafe(),
-            static_cast<cl_ulong>(step.result_size),
-            static_cast<cl_ulong>(step.source_stride),
-            static_cast<cl_ulong>(step.source_block),
-            static_cast<cl_ulong>(step.dim_size));
+        if (source_buffer) {
+            result_buffer->add_dependencies({source_buffer});
+        }
+        const auto work_items = (
+            is_cooperative
+            ? step.result_size * launch.work_group_size
+            : make_divisible_by(launch.work_group_size, step.result_size));
+        kernel.setArg(arg++, result_buffer->cl_buffer_unsafe());
+        kernel.setArg(arg++, static_cast<cl_ulong>(step.result_size));
+        kernel.setArg(arg++, static_cast<cl_ulong>(step.source_stride));
+        kernel.setArg(arg++, static_cast<cl_ulong>(step.source_block));
+        kernel.setArg(arg++, static_cast<cl_ulong>(step.dim_size));
+        cl::Event reduction_is_done;
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(work_items),
+            cl::NDRange(launch.work_group_size),
+            &wait_for_events,
+            &reduction_is_done);
         result_buffer->set_completion_event(reduction_is_done);
         source_buffer = result_buffer;
     }
@@ -240,74 +363,133 @@ MultiArrayRef Reduction::forward(const MultiArrayRef &value,
     }
 }
 
-MultiArrayRef Reduction::full_reduction(const MultiArrayRef &value) const {
-    auto pool = value->buffer_unsafe()->pool();
-    auto queue = pool->cl_queue();
-    auto context = get_context_from_queue(queue);
-    auto device = get_device_from_queue(queue);
-    cl_uint max_compute_units;
-    device.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &max_compute_units);
-    // This two-step reduction algorithm requires the work group to be
-    // the power of two in size.
-    cl_uint optimal_num_work_groups = (
-        1U << static_cast<cl_uint>(std::log2(max_compute_units)));
-    if (optimal_num_work_groups < 2) {
-        throw std::runtime_error(
-            "Incompatible OpenCL device that cannot "
-            "be used for 2-step reduction.");
+MultiArrayRef Reduction::forward_with_prologue(
+        const FusedElementWise &prologue,
+        const ArrayRefList &input_values) const {
+    auto prologue_launch = prologue.prepare_launch(input_values);
+    std::vector<ReductionStep> reduction_steps;
+    Shape result_shape_dims_cut;
+    Shape result_shape_dims_kept;
+    estimate_steps_and_dimensions(
+        prologue_launch.result_shape, _dims_to_cut,
+        reduction_steps, result_shape_dims_cut, result_shape_dims_kept);
+    MultiArrayRef result;
+    if (result_shape_dims_cut.rank() == 0) {
+        result = full_reduction(nullptr, &prologue, &prologue_launch);
+    } else {
+        result = partial_reduction(
+            nullptr, reduction_steps,
+            result_shape_dims_cut, result_shape_dims_kept,
+            &prologue, &prologue_launch);
     }
-    auto program = load_reduction_program(queue);
-    auto kernel_name = get_kernel_name(false);
-    auto kernel = cl::Kernel(program, kernel_name.c_str());
-    const std::size_t step1_work_items = (
-        WORK_GROUP_SIZE * optimal_num_work_groups);
-    const std::size_t step1_scratchpad_size = (
-        array_type_size(_result_dtype) * WORK_GROUP_SIZE);
-    auto wait_for_events = make_event_list(
-        {value->buffer_unsafe()->completion_event()});
-    auto step1_buffer = pool->reserve_buffer(
-        array_type_size(_result_dtype) * optimal_num_work_groups);
-    step1_buffer->set_label(__func__, __LINE__);
-    step1_buffer->add_dependencies({value->buffer_unsafe()});
-    kernel.setArg(0, value->cl_buffer_unsafe());
-    kernel.setArg(1, static_cast<cl_ulong>(value->buffer_offset()));
-    kernel.setArg(2, step1_buffer->cl_buffer_unsafe());
-    kernel.setArg(3, static_cast<cl_ulong>(step1_scratchpad_size), nullptr);
-    kernel.setArg(4, static_cast<cl_ulong>(value->shape().size()));
-    kernel.setArg(5, static_cast<cl_int>(CL_TRUE));
-    cl::Event step_is_done;
-    queue.enqueueNDRangeKernel(
-        kernel,
-        cl::NullRange,
-        cl::NDRange(step1_work_items),
-        cl::NDRange(WORK_GROUP_SIZE),
-        &wait_for_events,
-        &step_is_done);
-    // Full reduction always results in a scalar
-    auto result = pool->make_array(Shape(), _result_dtype);
-    result->add_dependencies({step1_buffer});
-    kernel.setArg(0, step1_buffer->cl_buffer_unsafe());
-    kernel.setArg(1, static_cast<cl_ulong>(0));
-    kernel.setArg(2, result->cl_buffer_unsafe());
-    kernel.setArg(
-        3,
-        array_type_size(_result_dtype) * (optimal_num_work_groups / 2),
-        nullptr);
-    kernel.setArg(4, static_cast<cl_ulong>(optimal_num_work_groups));
-    kernel.setArg(5, static_cast<cl_int>(CL_FALSE));
-    wait_for_events[0] = std::move(step_is_done);
-    cl::Event step2_is_done;
-    queue.enqueueNDRangeKernel(
-        kernel,
-        cl::NullRange,
-        cl::NDRange(optimal_num_work_groups / 2),
-        cl::NDRange(optimal_num_work_groups / 2),
-        &wait_for_events,
-        &step2_is_done);
-    result->set_completion_event(step2_is_done);
+    prologue_launch.keep_alive_until_done(result);
     return result;
 }
 
+// Querying the device takes longer than launching a kernel on some
+// drivers, so the answers are remembered for each device
+static std::size_t compute_units_of(const cl::Device &device) {
+    static std::mutex mutex;
+    static std::map<cl_device_id, std::size_t> known_devices;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = known_devices.find(device());
+    if (found == known_devices.end()) {
+        const std::size_t compute_units = (
+            device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>());
+        found = known_devices.emplace(
+            device(), std::max<std::size_t>(compute_units, 1)).first;
+    }
+    return found->second;
+}
+
+// How many work groups a pass of the full reduction needs to reduce
+// `length` elements. A few groups per compute unit keep the device busy,
+// more would only leave more work to the next pass.
+static std::size_t full_reduction_groups(std::size_t length,
+                                         std::size_t compute_units,
+                                         const LaunchConfig &launch) {
+    constexpr std::size_t GroupsPerComputeUnit = 4;
+    // Each work item reads (at least) a vector of 4 elements
+    const std::size_t elements_per_group = launch.work_group_size * 4;
+    const std::size_t groups_needed = (
+        (length + elements_per_group - 1) / elements_per_group);
+    return std::max<std::size_t>(
+        1, std::min(groups_needed, compute_units * GroupsPerComputeUnit));
+}
+
+MultiArrayRef Reduction::full_reduction(
+        const MultiArrayRef &value,
+        const FusedElementWise *prologue,
+        const FusedLaunch *prologue_launch) const {
+    auto pool = (prologue != nullptr
+                 ? prologue_launch->input_values.at(0)
+                 : value)->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Reduction);
+    const std::size_t compute_units = compute_units_of(pool->cl_device());
+    const auto kernel_name = get_kernel_name(false);
+    const std::size_t total_length = (
+        prologue != nullptr
+        ? prologue_launch->result_shape.size()
+        : value->shape().size());
+    std::size_t length = total_length;
+    // Every pass reduces the partial results of the previous one,
+    // until a single value is left
+    CLBufferRef source_buffer = (
+        prologue != nullptr ? nullptr : value->buffer_unsafe());
+    CLBufferRef result_buffer;
+    bool is_first_step = true;
+    do {
+        cl::Kernel kernel;
+        std::vector<cl::Event> wait_for_events;
+        cl_uint arg;
+        if (is_first_step) {
+            arg = prepare_first_step(queue, launch, kernel_name, value,
+                                     prologue, prologue_launch,
+                                     kernel, wait_for_events);
+        } else {
+            auto program = load_reduction_program(queue, launch);
+            kernel = CodeCache::get_default().get_kernel(
+                program, kernel_name, queue);
+            kernel.setArg(0, source_buffer->cl_buffer_unsafe());
+            kernel.setArg(1, static_cast<cl_ulong>(0));
+            wait_for_events = make_event_list(
+                {source_buffer->completion_event()});
+            arg = 2;
+        }
+        const auto num_groups = full_reduction_groups(
+            length, compute_units, launch);
+        result_buffer = pool->reserve_buffer(
+            array_type_size(_result_dtype) * num_groups);
+        result_buffer->set_label(__func__, __LINE__);
+        if (source_buffer) {
+            result_buffer->add_dependencies({source_buffer});
+        }
+        kernel.setArg(arg++, result_buffer->cl_buffer_unsafe());
+        kernel.setArg(arg++, static_cast<cl_ulong>(length));
+        // Only the pass producing the single final value finishes
+        // the reduction (like dividing the sum for the mean)
+        kernel.setArg(arg++, static_cast<cl_ulong>(total_length));
+        kernel.setArg(arg++, static_cast<cl_int>(
+            num_groups == 1 ? CL_TRUE : CL_FALSE));
+        cl::Event step_is_done;
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(num_groups * launch.work_group_size),
+            cl::NDRange(launch.work_group_size),
+            &wait_for_events,
+            &step_is_done);
+        result_buffer->set_completion_event(step_is_done);
+        source_buffer = result_buffer;
+        length = num_groups;
+        is_first_step = false;
+    } while (length > 1);
+    // Full reduction always results in a scalar
+    return MultiArray::from_buffer(result_buffer, Shape(), _result_dtype);
+}
+
 const NodeRef Reduction::apply_chain_rule(const NodeRef &wrt_input,
                                           const NodeRef &d_target_wrt_this,
                                           const NodeRefList &all_inputs) const {
@@ -336,10 +518,40 @@ const std::string Reduction::get_kernel_name(bool is_partial_reduction) const {
     }
 }
 
+const std::string Reduction::get_cooperative_kernel_name() const {
+    return fmt::format("reduce_coop_{}_{}", kernel_op_name(),
+                       array_type_name(_result_dtype));
+}
+
 std::string Reduction::name() const {
     return fmt::format("reduce_{}_to_be_like", kernel_op_name());
 }
 
+void Reduction::collect_programs(const cl::Device &device,
+                                 ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Reduction);
+    auto program = reduction_program_source();
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
+void Reduction::collect_programs_with_prologue(
+        const cl::Device &device, const FusedElementWise &prologue,
+        ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Reduction);
+    auto program = reduction_program_source(prologue);
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
+std::string Reduction::structure_key() const {
+    return fmt::format("{} along {}{}", kernel_op_name(),
+                       Shape::dims_to_string(_dims_to_cut, false),
+                       _keep_dims ? ", keeping the dimensions" : "");
+}
+
 std::string Reduction::repr_extra() const {
     return fmt::format("along_axis: {}",
                        Shape::dims_to_string(_dims_to_cut, false));
@@ -357,11 +569,240 @@ const NodeRef ReduceMean::partial_derivative(const NodeRef &input) const {
             FU<ProductOfDims>(input, _dims_to_cut, dtype())));
 }
 
+constexpr char cl_sources_of_softmax[] = {
+#include "avalanche/kernels/softmax.hex"
+};
+
+const ProgramSource& softmax_program_source() {
+    static const ProgramSource source {
+        "softmax", cl_sources_of_softmax, ""};
+    return source;
+}
+
+// Softmax works on rows: all the elements along the axis
+// (see softmax.opencl for how they are laid out)
+struct SoftmaxRows {
+    std::size_t num_rows;
+    std::size_t row_length;
+    // The number of elements after the axis
+    std::size_t row_stride;
+
+    static SoftmaxRows of(const Shape &shape, ShapeDim axis) {
+        SoftmaxRows rows{1, static_cast<std::size_t>(shape.dim(axis)), 1};
+        for (ShapeDim i = axis + 1; i < shape.rank(); ++i) {
+            rows.row_stride *= shape.dim(i);
+        }
+        rows.num_rows = shape.size() / std::max<std::size_t>(
+            rows.row_length, 1);
+        return rows;
+    }
+};
+
+MultiArrayRef launch_softmax_kernel(const std::string &kernel_family,
+                                    const std::string &types_suffix,
+                                    const ArrayRefList &sources,
+                                    const Shape &rows_shape,
+                                    ShapeDim axis,
+                                    const Shape &result_shape,
+                                    ArrayType result_dtype) {
+    auto pool = sources.at(0)->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Reduction);
+    const auto rows = SoftmaxRows::of(rows_shape, axis);
+    // Rows can be reduced just like any other dimension
+    const bool is_cooperative = reduce_cooperatively(
+        rows.num_rows, rows.row_stride, rows.row_length, launch);
+    const auto kernel_name = fmt::format(
+        "{}_{}_{}", kernel_family, is_cooperative ? "coop" : "rows",
+        types_suffix);
+    const auto &program_source = softmax_program_source();
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue, program_source.name,
+        program_source.source, launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, kernel_name, queue);
+    auto result = pool->make_array(result_shape, result_dtype);
+    result->set_label(kernel_family, __LINE__);
+    result->add_dependencies(sources);
+    std::vector<cl::Event> wait_for_events;
+    cl_uint arg = 0;
+    for (const auto &source: sources) {
+        kernel.setArg(arg++, source->cl_buffer_unsafe());
+        kernel.setArg(arg++, static_cast<cl_ulong>(source->buffer_offset()));
+        auto is_ready = source->buffer_unsafe()->completion_event();
+        if (is_ready.get() != nullptr) {
+            wait_for_events.push_back(is_ready);
+        }
+    }
+    kernel.setArg(arg++, result->cl_buffer_unsafe());
+    kernel.setArg(arg++, static_cast<cl_ulong>(rows.num_rows));
+    kernel.setArg(arg++, static_cast<cl_ulong>(rows.row_length));
+    kernel.setArg(arg++, static_cast<cl_ulong>(rows.row_stride));
+    const auto work_items = (
+        is_cooperative
+        ? rows.num_rows * launch.work_group_size
+        : make_divisible_by(launch.work_group_size, rows.num_rows));
+    cl::Event result_event;
+    if (work_items > 0) {
+        queue.enqueueNDRangeKernel(
+            kernel,
+            cl::NullRange,
+            cl::NDRange(work_items),
+            cl::NDRange(launch.work_group_size),
+            &wait_for_events,
+            &result_event);
+        result->set_completion_event(result_event);
+    }
+    return result;
+}
+
+static void check_softmax_arguments(const NodeRef &input) {
+    if (!is_floating_array_type(input->dtype())) {
+        throw std::invalid_argument(
+            fmt::format("Softmax needs a floating point array, got {}",
+                        array_type_name(input->dtype())));
+    }
+}
+
+Softmax::Softmax(const NodeRef &input, ShapeDim axis)
+    :_input{input},
+     _axis{axis}
+{
+    set_shape(input->shape());
+    set_dtype(input->dtype());
+}
+
+NodeRef Softmax::make(const NodeRef &input, ShapeDim axis) {
+    check_softmax_arguments(input);
+    auto normalized_axis = input->shape().normalize_dims({axis}).at(0);
+    auto node = std::shared_ptr<Softmax>(new Softmax(input, normalized_axis));
+    node->_self = node;
+    return std::static_pointer_cast<BaseNode>(node);
+}
+
+MultiArrayRef Softmax::eval(Context &context, ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        result = forward(context, cache, {_input->eval(context, cache)});
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef Softmax::forward(Context &context, ExecutionCache &cache,
+                               const ArrayRefList &input_values) const {
+    const auto &shape = input_values[0]->shape();
+    return launch_softmax_kernel("softmax", array_type_name(dtype()),
+                                 input_values, shape, _axis, shape, dtype());
+}
+
+std::string Softmax::to_string() const {
+    return fmt::format("softmax({}, {})", _input->to_string(), _axis);
+}
+
+std::string Softmax::repr() const {
+    return format_repr("Softmax", "", fmt::format("axis: {}", _axis));
+}
+
+const NodeRef Softmax::apply_chain_rule(const NodeRef &wrt_input,
+                                        const NodeRef &d_target_wrt_this,
+                                        const NodeRefList &all_inputs) const {
+    if (all_inputs[0] == wrt_input) {
+        return SoftmaxGradient::make(d_target_wrt_this, _self.lock(), _axis);
+    } else {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+}
+
+void Softmax::collect_programs(const cl::Device &device,
+                               ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Reduction);
+    auto program = softmax_program_source();
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
+SoftmaxGradient::SoftmaxGradient(const NodeRef &gradient,
+                                 const NodeRef &softmax,
+                                 ShapeDim axis)
+    :_gradient{gradient},
+     _softmax{softmax},
+     _axis{axis}
+{
+    set_shape(softmax->shape());
+    set_dtype(softmax->dtype());
+}
+
+NodeRef SoftmaxGradient::make(const NodeRef &gradient,
+                              const NodeRef &softmax,
+                              ShapeDim axis) {
+    check_softmax_arguments(softmax);
+    if (gradient->dtype() != softmax->dtype()) {
+        throw std::invalid_argument(
+            "The gradient must have the same type as softmax");
+    }
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<SoftmaxGradient>(
+            new SoftmaxGradient(gradient, softmax, axis)));
+}
+
+MultiArrayRef SoftmaxGradient::eval(Context &context,
+                                    ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        result = forward(context, cache,
+                         {_gradient->eval(context, cache),
+                          _softmax->eval(context, cache)});
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef SoftmaxGradient::forward(Context &context,
+                                       ExecutionCache &cache,
+                                       const ArrayRefList &input_values) const {
+    if (input_values[0]->shape() != input_values[1]->shape()) {
+        throw std::invalid_argument(
+            fmt::format("The gradient {} must have the same shape "
+                        "as softmax {}",
+                        input_values[0]->shape().to_string(),
+                        input_values[1]->shape().to_string()));
+    }
+    const auto &shape = input_values[0]->shape();
+    return launch_softmax_kernel("softmax_gradient", array_type_name(dtype()),
+                                 input_values, shape, _axis, shape, dtype());
+}
+
+std::string SoftmaxGradient::to_string() const {
+    return fmt::format("softmax_gradient({}, {}, {})",
+                       _gradient->to_string(), _softmax->to_string(), _axis);
+}
+
+std::string SoftmaxGradient::repr() const {
+    return format_repr("SoftmaxGradient", "", fmt::format("axis: {}", _axis));
+}
+
+const NodeRef SoftmaxGradient::apply_chain_rule(
+        const NodeRef &wrt_input,
+        const NodeRef &d_target_wrt_this,
+        const NodeRefList &all_inputs) const {
+    throw std::logic_error(
+        "Second derivatives of softmax are not implemented");
+}
+
+void SoftmaxGradient::collect_programs(const cl::Device &device,
+                                       ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Reduction);
+    auto program = softmax_program_source();
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
 const NodeRef softmax(const NodeRef &node, const ShapeDim axis) {
-    auto mean = FU<ReduceMean>(node, std::vector<ShapeDim>({axis}), true);
-    auto exp_node = FU<Exp>(node - mean);
-    auto sum_node = FU<ReduceSum>(exp_node, std::vector<ShapeDim>({axis}), true);
-    return exp_node / sum_node;
+    return Softmax::make(node, axis);
 }
 
 } // namespace
@@ -1,7 +1,13 @@
+#include <algorithm>
 #include <iostream>
 
+#include <fmt/format.h>
+
 #include "avalanche/opencl_utils.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/Context.h"
+#include "avalanche/ExecutionCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/MultiArray.h"
 #include "avalanche/terminal_nodes.h"
 #include "avalanche/math_ops/simple_arithemic.h"
@@ -12,6 +18,32 @@
 
 namespace avalanche {
 
+/**
+ * Whether an arithmetic operation returns `input` as it is because
+ * the other operand is a constant filled with the `neutral` value.
+ * Only if `input` is already known to have the shape and the type
+ * of the result, since otherwise it gets broadcast or cast.
+ */
+bool passes_through(const NodeRef &input, const NodeRef &other,
+                    float neutral, const Shape &result_shape,
+                    ArrayType result_dtype) {
+    return (Constant::is_filled_with(other, neutral)
+            && input->shape().is_complete()
+            && input->shape() == result_shape
+            && input->dtype() == result_dtype);
+}
+
+
+int Plus::passthrough_input(const NodeRef &left,
+                            const NodeRef &right) const {
+    if (passes_through(left, right, 0, shape(), dtype())) {
+        return 0;
+    }
+    if (passes_through(right, left, 0, shape(), dtype())) {
+        return 1;
+    }
+    return -1;
+}
 
 const NodeRef Plus::apply_chain_rule(
         const NodeRef &wrt_input,
@@ -31,6 +63,14 @@ const NodeRef Plus::apply_chain_rule(
 }
 
 
+int Minus::passthrough_input(const NodeRef &left,
+                             const NodeRef &right) const {
+    if (passes_through(left, right, 0, shape(), dtype())) {
+        return 0;
+    }
+    return -1;
+}
+
 const NodeRef
 Minus::apply_chain_rule(const NodeRef &wrt_input,
                         const NodeRef &d_target_wrt_this,
@@ -52,6 +92,17 @@ Minus::apply_chain_rule(const NodeRef &wrt_input,
 }
 
 
+int Multiply::passthrough_input(const NodeRef &left,
+                                const NodeRef &right) const {
+    if (passes_through(left, right, 1, shape(), dtype())) {
+        return 0;
+    }
+    if (passes_through(right, left, 1, shape(), dtype())) {
+        return 1;
+    }
+    return -1;
+}
+
 const NodeRef Multiply::apply_chain_rule(const NodeRef &wrt_input,
                                          const NodeRef &d_target_wrt_this,
                                          const NodeRefList &all_inputs) const {
@@ -73,6 +124,14 @@ const NodeRef Multiply::apply_chain_rule(const NodeRef &wrt_input,
     return derivative;
 }
 
+int Divide::passthrough_input(const NodeRef &left,
+                              const NodeRef &right) const {
+    if (passes_through(left, right, 1, shape(), dtype())) {
+        return 0;
+    }
+    return -1;
+}
+
 const NodeRef Divide::apply_chain_rule(const NodeRef &wrt_input,
                                        const NodeRef &d_target_wrt_this,
                                        const NodeRefList &all_inputs) const {
@@ -133,6 +192,17 @@ const NodeRef Power::apply_chain_rule(const NodeRef &wrt_input,
     return derivative;
 }
 
+int ElemWisePlus::passthrough_input(const NodeRef &left,
+                                    const NodeRef &right) const {
+    if (passes_through(left, right, 0, shape(), dtype())) {
+        return 0;
+    }
+    if (passes_through(right, left, 0, shape(), dtype())) {
+        return 1;
+    }
+    return -1;
+}
+
 const NodeRef ElemWisePlus::apply_chain_rule(const NodeRef &wrt_input,
                                              const NodeRef &d_target_wrt_this,
                                              const NodeRefList &all_inputs) const {
@@ -140,6 +210,17 @@ const NodeRef ElemWisePlus::apply_chain_rule(const NodeRef &wrt_input,
     return d_target_wrt_this;
 }
 
+int ElemWiseMultiply::passthrough_input(const NodeRef &left,
+                                        const NodeRef &right) const {
+    if (passes_through(left, right, 1, shape(), dtype())) {
+        return 0;
+    }
+    if (passes_through(right, left, 1, shape(), dtype())) {
+        return 1;
+    }
+    return -1;
+}
+
 const NodeRef ElemWiseMultiply::apply_chain_rule(const NodeRef &wrt_input,
                                                  const NodeRef &d_target_wrt_this,
                                                  const NodeRefList &all_inputs) const {
@@ -153,4 +234,170 @@ const NodeRef ElemWiseMultiply::apply_chain_rule(const NodeRef &wrt_input,
         throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
     }
 }
+
+AddN::AddN(const NodeRefList &inputs)
+    :_inputs{inputs}
+{
+    Shape result_shape = inputs[0]->shape();
+    ArrayType result_dtype = inputs[0]->dtype();
+    for (std::size_t k = 1; k < inputs.size(); ++k) {
+        result_shape = ElemWiseBinaryOp::infer_elemwise_shape(
+            result_shape, inputs[k]->shape());
+        result_dtype = choose_common_array_type(result_dtype,
+                                                inputs[k]->dtype());
+    }
+    set_shape(result_shape);
+    set_dtype(result_dtype);
+
+    // WORK_GROUP_SIZE comes from the build options (see WorkGroupTuner)
+    constexpr const char *kernel_template = R"clkernel(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void {kernel_name}(
+{arguments}         __global {output_dtype} *output,
+         const ulong data_size) {{
+    for (ulong i = get_global_id(0); i < data_size; i += get_global_size(0)) {{
+        output[i] = {sum};
+    }}
+}}
+    )clkernel";
+
+    const char *output_dtype = cl_type_name_of_array(result_dtype);
+    std::string arguments, sum;
+    _kernel_name = "add_n";
+    for (std::size_t k = 0; k < inputs.size(); ++k) {
+        const char *dtype = cl_type_name_of_array(inputs[k]->dtype());
+        _kernel_name += std::string("_") + dtype;
+        arguments += fmt::format(
+            "         __global {dtype} *source{k},\n"
+            "         const ulong source{k}_offset,\n",
+            fmt::arg("dtype", dtype), fmt::arg("k", k));
+        sum += fmt::format("{}({})source{}[source{}_offset + i]",
+                           (k == 0 ? "" : " + "), output_dtype, k, k);
+    }
+    _kernel_name += std::string("_") + output_dtype;
+    _kernel_source = fmt::format(
+        kernel_template,
+        fmt::arg("kernel_name", _kernel_name),
+        fmt::arg("arguments", arguments),
+        fmt::arg("output_dtype", output_dtype),
+        fmt::arg("sum", sum));
+}
+
+NodeRef AddN::make(const NodeRefList &inputs) {
+    if (inputs.empty()) {
+        throw std::invalid_argument("AddN needs at least one input");
+    }
+    if (inputs.size() == 1) {
+        return inputs[0];
+    }
+    return std::static_pointer_cast<BaseNode>(
+        std::shared_ptr<AddN>(new AddN(inputs)));
+}
+
+MultiArrayRef AddN::eval(Context &context, ExecutionCache &cache) const {
+    MultiArrayRef result;
+    if (!cache.get(id, result)) {
+        ArrayRefList input_values;
+        for (const auto &input: _inputs) {
+            input_values.push_back(input->eval(context, cache));
+        }
+        result = forward(context, cache, input_values);
+        cache.put(id, result);
+    }
+    return result;
+}
+
+MultiArrayRef AddN::forward(Context &context, ExecutionCache &cache,
+                            const ArrayRefList &input_values) const {
+    const auto &first = input_values[0];
+    std::vector<cl::Event> data_are_ready;
+    for (const auto &value: input_values) {
+        if (value->shape() != first->shape()) {
+            throw std::invalid_argument(
+                fmt::format("AddN cannot sum arrays of different shapes: "
+                            "{} and {}", first->shape().to_string(),
+                            value->shape().to_string()));
+        }
+        const auto &event = value->buffer_unsafe()->completion_event();
+        if (event.get() != nullptr) {
+            data_are_ready.push_back(event);
+        }
+    }
+    auto pool = first->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    auto result = pool->make_array(first->shape(), dtype());
+    result->set_label(std::string("AddN at ") + __func__, __LINE__);
+    result->add_dependencies(input_values);
+
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::ElementWise);
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue,
+        _kernel_name, _kernel_source, launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, _kernel_name, queue);
+    cl_uint arg = 0;
+    for (const auto &value: input_values) {
+        kernel.setArg(arg++, value->cl_buffer_unsafe());
+        kernel.setArg(arg++, static_cast<cl_ulong>(value->buffer_offset()));
+    }
+    const auto result_size = first->shape().size();
+    kernel.setArg(arg++, result->cl_buffer_unsafe());
+    kernel.setArg(arg++, static_cast<cl_ulong>(result_size));
+    cl::Event result_event;
+    queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(launch.global_size(result_size)),
+        cl::NDRange(launch.work_group_size),
+        &data_are_ready,
+        &result_event);
+    result->set_completion_event(result_event);
+    return result;
+}
+
+std::string AddN::to_string() const {
+    std::string output = "AddN(";
+    for (std::size_t k = 0; k < _inputs.size(); ++k) {
+        output += (k == 0 ? "" : ", ") + _inputs[k]->to_string();
+    }
+    return output + ")";
+}
+
+std::string AddN::repr() const {
+    return format_repr("AddN", "", std::to_string(_inputs.size()) + " inputs");
+}
+
+const NodeRef AddN::apply_chain_rule(const NodeRef &wrt_input,
+                                     const NodeRef &d_target_wrt_this,
+                                     const NodeRefList &all_inputs) const {
+    // Each occurrence of the input among `all_inputs` gets its own chunk
+    // (see `build_consumers_map`), so there's nothing to multiply
+    if (std::find(all_inputs.begin(), all_inputs.end(), wrt_input)
+            == all_inputs.end()) {
+        throw std::logic_error(messages::CANT_DIFF_UNEXISTING_INPUT_MESSAGE);
+    }
+    return d_target_wrt_this;
+}
+
+void AddN::collect_programs(const cl::Device &device,
+                            ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::ElementWise);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
+std::string AddN::elementwise_code(const std::vector<std::string> &input_vars,
+                                   const std::string &output_var) const {
+    const char *output_dtype = cl_type_name_of_array(dtype());
+    std::string sum;
+    for (std::size_t k = 0; k < input_vars.size(); ++k) {
+        sum += fmt::format("{}({})({})", (k == 0 ? "" : " + "),
+                           output_dtype, input_vars[k]);
+    }
+    return fmt::format("{} = {};", output_var, sum);
+}
+
 } // namespace
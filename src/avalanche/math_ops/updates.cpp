@@ -3,12 +3,11 @@
 #include "avalanche/math_ops/updates.h"
 #include "avalanche/CodeCache.h"
 #include "avalanche/opencl_utils.h"
+#include "avalanche/WorkGroupTuner.h"
 
 
 namespace avalanche {
 
-constexpr const std::size_t WORK_GROUP_SIZE = 64;
-
 std::string updating_kernel_name(
         const std::string &operation_name,
         ArrayType stype,
@@ -25,20 +24,19 @@ std::string updating_kernel_source(
     const std::string &operation_name,
     ArrayType stype,
     ArrayType dtype,
-    const std::string &operation_code,
-    int work_group_size) {
+    const std::string &operation_code) {
     constexpr const char *kernel_template = R"clkernel(
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__kernel __attribute__((reqd_work_group_size({work_group_size}, 1, 1)))
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
 void {kernel_name}(
          __global {dtype} *target,
          const ulong target_offset,
          __global {stype} *update,
          const ulong update_offset,
          const ulong target_size) {{
-    if (get_global_id(0) < target_size) {{
-        target[target_offset + get_global_id(0)] {operation_code} update[update_offset + get_global_id(0)];
+    for (ulong i = get_global_id(0); i < target_size; i += get_global_size(0)) {{
+        target[target_offset + i] {operation_code} update[update_offset + i];
     }}
 }}
     )clkernel";
@@ -48,7 +46,57 @@ void {kernel_name}(
         fmt::arg("kernel_name",
                  updating_kernel_name(operation_name, stype, dtype)),
         fmt::arg("operation_code", operation_code),
-        fmt::arg("work_group_size", work_group_size),
+        fmt::arg("dtype", cl_type_name_of_array(dtype)),
+        fmt::arg("stype", cl_type_name_of_array(stype)));
+}
+
+std::string updating_batch_kernel_source(
+    const std::string &kernel_name,
+    ArrayType stype,
+    ArrayType dtype,
+    const std::string &operation_code,
+    std::size_t batch_size) {
+    // For each segment the table keeps its end and the offsets
+    // of the target and the update
+    constexpr const char *kernel_template = R"clkernel(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void {kernel_name}(
+{arguments}         __global const ulong *segments,
+         const ulong total_size) {{
+    __global {dtype} *targets[] = {{{targets}}};
+    __global {stype} *updates[] = {{{updates}}};
+    for (ulong i = get_global_id(0); i < total_size; i += get_global_size(0)) {{
+        int s = 0;
+        while (i >= segments[3 * s]) {{
+            ++s;
+        }}
+        const ulong j = i - (s == 0 ? 0 : segments[3 * (s - 1)]);
+        targets[s][segments[3 * s + 1] + j] {operation_code} updates[s][segments[3 * s + 2] + j];
+    }}
+}}
+    )clkernel";
+
+    std::string arguments, targets, updates;
+    for (std::size_t k = 0; k < batch_size; ++k) {
+        arguments += fmt::format(
+            "         __global {dtype} *target{k},\n"
+            "         __global {stype} *update{k},\n",
+            fmt::arg("dtype", cl_type_name_of_array(dtype)),
+            fmt::arg("stype", cl_type_name_of_array(stype)),
+            fmt::arg("k", k));
+        const char *separator = (k == 0 ? "" : ", ");
+        targets += fmt::format("{}target{}", separator, k);
+        updates += fmt::format("{}update{}", separator, k);
+    }
+    return fmt::format(
+        kernel_template,
+        fmt::arg("kernel_name", kernel_name),
+        fmt::arg("arguments", arguments),
+        fmt::arg("targets", targets),
+        fmt::arg("updates", updates),
+        fmt::arg("operation_code", operation_code),
         fmt::arg("dtype", cl_type_name_of_array(dtype)),
         fmt::arg("stype", cl_type_name_of_array(stype)));
 }
@@ -58,12 +106,14 @@ BaseUpdateOp::BaseUpdateOp(const NodeRef &variable, const NodeRef &update,
                    const std::string &operation_cl_code)
 :_result_shape{variable->shape()},
  _result_dtype{variable->dtype()},
+ _update_dtype{update->dtype()},
  _operation_name{operation_name},
+ _operation_code{operation_cl_code},
  _kernel_name{
     updating_kernel_name(operation_name, update->dtype(), variable->dtype())},
  _kernel_source{
     updating_kernel_source(operation_name, update->dtype(),
-                           variable->dtype(), operation_cl_code, WORK_GROUP_SIZE)}
+                           variable->dtype(), operation_cl_code)}
 {
     if (variable->shape() != update->shape()) {
         throw std::invalid_argument(
@@ -74,19 +124,29 @@ BaseUpdateOp::BaseUpdateOp(const NodeRef &variable, const NodeRef &update,
     }
 }
 
+void BaseUpdateOp::collect_programs(const cl::Device &device,
+                                    ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Update);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
 MultiArrayRef
 BaseUpdateOp::forward(const MultiArrayRef &v1, const MultiArrayRef &v2) const {
     auto pool = v1->buffer_unsafe()->pool();
     auto queue = pool->cl_queue();
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Update);
     auto program = CodeCache::get_default().get_program(
         pool->cl_context(), queue,
-        _kernel_name, _kernel_source, "");
+        _kernel_name, _kernel_source, launch.build_options());
     using Buf = const cl::Buffer&;
     cl::KernelFunctor<Buf, cl_ulong, Buf, cl_ulong, cl_ulong>
-        kernel_functor(program, _kernel_name);
+        kernel_functor(CodeCache::get_default().get_kernel(
+            program, _kernel_name, queue));
 
     const auto result_size = v1->shape().size();
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, result_size);
+    const auto work_items = launch.global_size(result_size);
 
     auto data_are_ready = make_event_list(
         {v1->buffer_unsafe()->completion_event(),
@@ -96,7 +156,7 @@ BaseUpdateOp::forward(const MultiArrayRef &v1, const MultiArrayRef &v2) const {
         cl::EnqueueArgs(queue,
                         data_are_ready,
                         cl::NDRange(work_items),
-                        cl::NDRange(WORK_GROUP_SIZE)),
+                        cl::NDRange(launch.work_group_size)),
         v1->cl_buffer_unsafe(),
         static_cast<cl_ulong>(v1->buffer_offset()),
         v2->cl_buffer_unsafe(),
@@ -106,5 +166,72 @@ BaseUpdateOp::forward(const MultiArrayRef &v1, const MultiArrayRef &v2) const {
     return v1;
 }
 
+ArrayRefList
+BaseUpdateOp::forward_batch(
+        const std::vector<ArrayRefList> &input_values) const {
+    std::vector<cl_ulong> segments;
+    std::size_t total_size = 0;
+    std::vector<cl::Event> data_are_ready;
+    for (const auto &values: input_values) {
+        const auto &v1 = values[0], &v2 = values[1];
+        total_size += v1->shape().size();
+        segments.insert(segments.end(),
+                        {static_cast<cl_ulong>(total_size),
+                         static_cast<cl_ulong>(v1->buffer_offset()),
+                         static_cast<cl_ulong>(v2->buffer_offset())});
+        for (const auto &value: values) {
+            const auto &event = value->buffer_unsafe()->completion_event();
+            if (event.get() != nullptr) {
+                data_are_ready.push_back(event);
+            }
+        }
+    }
+    auto pool = input_values.at(0)[0]->buffer_unsafe()->pool();
+    auto queue = pool->cl_queue();
+    // Uploaded only once for all the runs updating the same variables
+    auto segments_buffer = pool->constant_data_for_vector(segments);
+    if (segments_buffer.is_uploaded.get() != nullptr) {
+        data_are_ready.push_back(segments_buffer.is_uploaded);
+    }
+
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Update);
+    const auto kernel_name = fmt::format(
+        "{}_batch_{}", _kernel_name, input_values.size());
+    // The source is generated only the first time the batch is launched
+    const auto batch_size = input_values.size();
+    auto program = CodeCache::get_default().get_program(
+        pool->cl_context(), queue, kernel_name,
+        [this, &kernel_name, batch_size]() {
+            return updating_batch_kernel_source(
+                kernel_name, _update_dtype, _result_dtype, _operation_code,
+                batch_size);
+        },
+        launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, kernel_name, queue);
+    cl_uint arg = 0;
+    for (const auto &values: input_values) {
+        kernel.setArg(arg++, values[0]->cl_buffer_unsafe());
+        kernel.setArg(arg++, values[1]->cl_buffer_unsafe());
+    }
+    kernel.setArg(arg++, segments_buffer.buffer);
+    kernel.setArg(arg++, static_cast<cl_ulong>(total_size));
+    cl::Event result_event;
+    queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(launch.global_size(total_size)),
+        cl::NDRange(launch.work_group_size),
+        &data_are_ready,
+        &result_event);
+    ArrayRefList results;
+    for (const auto &values: input_values) {
+        values[0]->add_dependencies({values[1]});
+        values[0]->set_completion_event(result_event);
+        results.push_back(values[0]);
+    }
+    return results;
+}
 
 } // namespace
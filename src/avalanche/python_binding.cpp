@@ -8,6 +8,7 @@
 #include "avalanche/nodes.h"
 #include "avalanche/Shape.h"
 #include "avalanche/Executor.h"
+#include "avalanche/WorkGroupTuner.h"
 
 namespace py = pybind11;
 
@@ -68,6 +69,14 @@ NodeRef matmul(const NodeRef &a, const NodeRef &b,
             a, b, transpose_left, transpose_right));
 }
 
+NodeRef batch_matmul(const NodeRef &a, const NodeRef &b,
+                     const bool transpose_left = false,
+                     const bool transpose_right = false) {
+    return std::static_pointer_cast<BaseNode>(
+        std::make_shared<BinaryOp<BatchMatMul>>(
+            a, b, transpose_left, transpose_right));
+}
+
 ArrayType dtype_to_avalanche_array_type(const py::dtype &dtype) {
     ArrayType array_type;
     switch (dtype.kind()) {
@@ -213,6 +222,39 @@ py::array array_to_numpy(MultiArrayRef &array) {
 }
 
 
+/**
+ * Converts a dict mapping nodes to scalars, numpy arrays or MultiArrays
+ * into values on the device
+ */
+NodeValueMap dict_to_node_value_map(py::dict values,
+                                    const BufferPoolRef &device_pool) {
+    NodeValueMap node_value_map;
+    for (auto &item: values) {
+        if (!py::isinstance<BaseNode>(item.first)) {
+            throw std::invalid_argument("Only nodes can be the keys");
+        }
+        auto node = item.first.cast<NodeRef>();
+        if (py::isinstance<py::array>(item.second)
+                || py::isinstance<py::list>(item.second)
+                || py::isinstance<py::float_>(item.second)
+                || py::isinstance<py::int_>(item.second)) {
+            auto gpu_array = numpy_to_multi_array_switch(
+                node->dtype(),
+                device_pool,
+                item.second.cast<py::array>());
+            node_value_map[node] = gpu_array;
+            gpu_array->wait_until_ready();
+        } else if (py::isinstance<MultiArray>(item.second)) {
+            node_value_map[node] = item.second.cast<MultiArrayRef>();
+        } else {
+            throw std::invalid_argument(
+                "Only scalars, numpy arrays or MultiArrays are allowed"
+                "as values");
+        }
+    }
+    return node_value_map;
+}
+
 Initializer numpy_value_initializer(py::array value) {
     Initializer initializer = {
         [value](Context &context, ExecutionCache &cache,
@@ -313,6 +355,12 @@ PYBIND11_MODULE(pyvalanche, m) {
         .value("float64", ArrayType::float64)
         .export_values();
 
+    py::enum_<Activation>(m, "Activation")
+        .value("linear", Activation::Linear)
+        .value("relu", Activation::ReLU)
+        .value("sigmoid", Activation::Sigmoid)
+        .value("tanh", Activation::Tanh);
+
     py::class_<BaseNode, NodeRef>(m, "BaseNode", py::dynamic_attr())
         .def(py::init(&Constant::scalar<float>))
         .def(py::init([](long value) {
@@ -379,32 +427,23 @@ PYBIND11_MODULE(pyvalanche, m) {
         .def(py::init<const ContextRef&, const NodeRefList&, const NodeRefList&>())
 //        .def("run", &Executor::run)
         .def("run", [](Executor &executor, py::dict cache_initial_values) {
-            NodeValueMap node_value_map;
-            for (auto &item: cache_initial_values) {
-                if (!py::isinstance<BaseNode>(item.first)) {
-                    throw std::invalid_argument("Only nodes can be the keys");
-                }
-                auto node = item.first.cast<NodeRef>();
-                if (py::isinstance<py::array>(item.second)
-                        || py::isinstance<py::list>(item.second)
-                        || py::isinstance<py::float_>(item.second)
-                        || py::isinstance<py::int_>(item.second)) {
-                    auto gpu_array = numpy_to_multi_array_switch(
-                        node->dtype(),
-                        executor.context()->device_pool(),
-                        item.second.cast<py::array>());
-                    node_value_map[node] = gpu_array;
-                    gpu_array->wait_until_ready();
-                } else if (py::isinstance<MultiArray>(item.second)) {
-                    node_value_map[node] = item.second.cast<MultiArrayRef>();
-                } else {
-                    throw std::invalid_argument(
-                        "Only scalars, numpy arrays or MultiArrays are allowed"
-                        "as values");
-                }
-            }
-            return executor.run(node_value_map);
-        });
+            return executor.run(
+                dict_to_node_value_map(cache_initial_values,
+                                       executor.context()->device_pool()));
+        })
+        .def("warm_up", &Executor::warm_up, py::arg("num_threads") = 0);
+
+    m.def("freeze",
+          [](const ContextRef &context, const NodeRefList &result_nodes,
+             py::dict fixed_values) {
+              return freeze(context, result_nodes,
+                            dict_to_node_value_map(fixed_values,
+                                                   context->device_pool()));
+          },
+          "Makes an executor for inference only, with all variables "
+          "replaced by constants keeping their current values",
+          py::arg("context"), py::arg("result_nodes"),
+          py::arg("fixed_values") = py::dict());
 
     py::class_<DeviceInfo>(m, "DeviceInfo")
         .def_readwrite("name", &DeviceInfo::name)
@@ -419,6 +458,12 @@ PYBIND11_MODULE(pyvalanche, m) {
     py::class_<Initializer>(m, "Initializer");
 
     m.def("default_memory_manager", CLMemoryManager::get_default);
+    m.def("tune_work_groups",
+          [](DeviceIndex device_idx) {
+              WorkGroupTuner::get_default().tune_all(
+                  CLMemoryManager::get_default()->buffer_pool(device_idx));
+          },
+          py::arg("device_idx") = 0);
 
     m.def("build_back_propagation_graph", &build_back_propagation_graph);
 
@@ -482,6 +527,10 @@ PYBIND11_MODULE(pyvalanche, m) {
         .def("scale_pow", [](const NodeRef &input, float scale, float power) {
             return FU<SPower>(input, scale, power);
         })
+        .def("clip", [](const NodeRef &input, float min_value,
+                        float max_value) {
+            return FU<Clip>(input, min_value, max_value);
+        }, "Limits the values to [min_value, max_value]")
         .def("pow", &StraightBinaryOp<Power>)
         .def("plus", &StraightBinaryOp<Plus>,
              "Elem-wise addition with broadcasting")
@@ -515,6 +564,18 @@ PYBIND11_MODULE(pyvalanche, m) {
              "In-place subtraction like -=")
         .def("binary_crossentropy", &StraightBinaryOp<BinaryCrossEntropy>,
              "In-place subtraction like -=")
+        .def("softmax_cross_entropy", &SoftmaxCrossEntropy::make,
+             "Cross-entropy between softmax of the logits and "
+             "the labels (probabilities), for each row",
+             py::arg("logits"), py::arg("labels"),
+             py::arg_v("axis", -1, "Dimension of the classes"))
+        .def("sparse_softmax_cross_entropy", &SparseSoftmaxCrossEntropy::make,
+             "Cross-entropy between softmax of the logits and "
+             "the labels (int32 or int64 indices of classes), for each row",
+             py::arg("logits"), py::arg("labels"),
+             py::arg_v("axis", -1, "Dimension of the classes"))
+        .def("add_n", &AddN::make,
+             "Sum of any number of arrays of the same shape by one kernel")
         .def("matmul", &matmul,
              py::arg_v("a", "Left matrix"),
              py::arg_v("b", "Right matrix"),
@@ -524,6 +585,21 @@ PYBIND11_MODULE(pyvalanche, m) {
              py::arg_v("transpose_right", false,
                        "set to True if the second matrix needs "
                        "to be transposed before multiplication"))
+        .def("batch_matmul", &batch_matmul,
+             "Multiplies stacks of matrices, broadcasting batch dimensions",
+             py::arg_v("a", "Left stack of matrices"),
+             py::arg_v("b", "Right stack of matrices"),
+             py::arg_v("transpose_left", false,
+                       "set to True if the first matrices need "
+                       "to be transposed before multiplication"),
+             py::arg_v("transpose_right", false,
+                       "set to True if the second matrices need "
+                       "to be transposed before multiplication"))
+        .def("dense", &Dense::make,
+             "Fully connected layer: activation(inputs x weights + bias)",
+             py::arg("inputs"), py::arg("weights"), py::arg("bias"),
+             py::arg_v("activation", Activation::Linear,
+                       "Activation.linear"))
         .def("softmax", &softmax,
              py::arg_v("node", "Input tensor"),
              py::arg_v("axis", -1, "Dimension to perform on"))
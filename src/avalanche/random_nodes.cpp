@@ -6,6 +6,7 @@
 #include "avalanche/Context.h"
 #include "avalanche/ExecutionCache.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/MultiArray.h"
 #include "avalanche/opencl_utils.h"
 
@@ -16,16 +17,22 @@ constexpr char cl_sources_of_random_generators[] = {
 #include "avalanche/kernels/random_generator.hex"
 };
 
-constexpr std::size_t WORK_GROUP_SIZE = 64;
+const ProgramSource& random_generators_program_source() {
+    static const ProgramSource source {
+        "random_generators", cl_sources_of_random_generators, ""};
+    return source;
+}
 
-cl::Program load_random_generators_program(cl::CommandQueue &queue) {
+cl::Program load_random_generators_program(cl::CommandQueue &queue,
+                                           const LaunchConfig &launch) {
     auto context = get_context_from_queue(queue);
+    const auto &program = random_generators_program_source();
     return CodeCache::get_default().get_program(
         context,
         queue,
-        "random_generators",
-        cl_sources_of_random_generators,
-        "");
+        program.name,
+        program.source,
+        launch.build_options());
 }
 
 
@@ -34,8 +41,11 @@ UniformRandom::generate_uniform_random(const MultiArrayRef &seeds) const {
     auto pool = seeds->buffer_unsafe()->pool();
     auto output = pool->make_array(seeds->shape(), dtype());
     auto queue = pool->cl_queue();
-    auto program = load_random_generators_program(queue);
-    cl::Kernel kernel(program, cached_generate_uniform_kernel_name().c_str());
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Random);
+    auto program = load_random_generators_program(queue, launch);
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, cached_generate_uniform_kernel_name(), queue);
     kernel.setArg(0, seeds->cl_buffer_unsafe());
     kernel.setArg(1, output->cl_buffer_unsafe());
     kernel.setArg(2, static_cast<cl_ulong>(seeds->size()));
@@ -46,11 +56,12 @@ UniformRandom::generate_uniform_random(const MultiArrayRef &seeds) const {
     std::vector<cl::Event> wait_for_events;
     wait_for_events.push_back(seeds->buffer_unsafe()->completion_event());
     output->add_dependencies({seeds});
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, seeds->size());
+    const auto work_items = make_divisible_by(launch.work_group_size,
+                                              seeds->size());
     cl::Event result_event;
     queue.enqueueNDRangeKernel(
         kernel, cl::NullRange,
-        cl::NDRange(work_items), cl::NDRange(WORK_GROUP_SIZE),
+        cl::NDRange(work_items), cl::NDRange(launch.work_group_size),
         &wait_for_events, &result_event);
     output->set_completion_event(result_event);
     return output;
@@ -59,17 +70,21 @@ UniformRandom::generate_uniform_random(const MultiArrayRef &seeds) const {
 void seed_uniform_random(MultiArrayRef &seeds, std::uint64_t base_seed) {
     auto pool = seeds->buffer_unsafe()->pool();
     auto queue = pool->cl_queue();
-    auto program = load_random_generators_program(queue);
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Random);
+    auto program = load_random_generators_program(queue, launch);
     using KernelType = cl::KernelFunctor<const cl::Buffer&, cl_ulong, cl_ulong>;
-    KernelType kernel(program, "seed_uniform_random");
+    KernelType kernel(CodeCache::get_default().get_kernel(
+        program, "seed_uniform_random", queue));
     CLBufferRef source_buffer = seeds->buffer_unsafe();
     std::vector<cl::Event> wait_for_events;
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, seeds->size());
+    const auto work_items = make_divisible_by(launch.work_group_size,
+                                              seeds->size());
     cl::Event generation_is_done = kernel(
         cl::EnqueueArgs(queue,
                         wait_for_events,
                         cl::NDRange(work_items),
-                        cl::NDRange(WORK_GROUP_SIZE)),
+                        cl::NDRange(launch.work_group_size)),
         source_buffer->cl_buffer_unsafe(),
         static_cast<cl_ulong>(seeds->size()),
         static_cast<cl_ulong>(base_seed));
@@ -79,18 +94,26 @@ void seed_uniform_random(MultiArrayRef &seeds, std::uint64_t base_seed) {
 avalanche::MultiArrayRef
 avalanche::UniformRandom::eval(avalanche::Context &context,
                                avalanche::ExecutionCache &cache) const {
-    MultiArrayRef cached_value, seeds;
+    MultiArrayRef cached_value;
+    if (!cache.get(id, cached_value)) {
+        cached_value = forward(context, cache, {});
+        cache.put(id, cached_value);
+    }
+    return cached_value;
+}
+
+avalanche::MultiArrayRef
+avalanche::UniformRandom::forward(avalanche::Context &context,
+                                  avalanche::ExecutionCache &cache,
+                                  const avalanche::ArrayRefList &input_values) const {
+    MultiArrayRef seeds;
     if (!context.get(id, seeds)) {
         seeds = context.device_pool()->make_array(shape(), ArrayType::int64);
         seeds->set_label(to_string());
         context.init(id, seeds);
         seed_uniform_random(seeds, _seed);
     }
-    if (!cache.get(id, cached_value)) {
-        cached_value = generate_uniform_random(seeds);
-        cache.put(id, cached_value);
-    }
-    return cached_value;
+    return generate_uniform_random(seeds);
 }
 
 
@@ -102,6 +125,15 @@ std::string avalanche::UniformRandom::repr() const {
     return format_repr("UniformRandom", "", "");
 }
 
+void UniformRandom::collect_programs(const cl::Device &device,
+                                     ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Random);
+    auto program = random_generators_program_source();
+    program.options = launch.build_options();
+    programs.push_back(program);
+}
+
 const std::string& UniformRandom::cached_generate_uniform_kernel_name() const {
     if (_generate_uniform_kernel_name.empty()) {
         _generate_uniform_kernel_name = fmt::format(
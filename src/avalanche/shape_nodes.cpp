@@ -9,12 +9,11 @@
 #include "avalanche/terminal_nodes.h"
 #include "avalanche/math_ops/messages.h"
 #include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 #include "avalanche/opencl_utils.h"
 
 namespace avalanche {
 
-constexpr const std::size_t WORK_GROUP_SIZE = 64;
-
 
 Reshape::Reshape(const NodeRef &input, const Shape &new_shape)
     :_new_shape{new_shape},
@@ -147,13 +146,18 @@ MultiArrayRef Concatenate::eval(Context &context, ExecutionCache &cache) const {
         for (auto const &node: _all_nodes) {
             evaluated_inputs.emplace_back(std::move(node->eval(context, cache)));
         }
-        BufferPoolRef pool = context.device_pool();
-        result = forward(pool, evaluated_inputs);
+        result = forward(context, cache, evaluated_inputs);
         cache.put(id, result);
     }
     return result;
 }
 
+MultiArrayRef Concatenate::forward(Context &context, ExecutionCache &cache,
+                                   const ArrayRefList &input_values) const {
+    BufferPoolRef pool = context.device_pool();
+    return forward(pool, input_values);
+}
+
 MultiArrayRef Concatenate::forward(BufferPoolRef &pool,
                                    const ArrayRefList &evaluated_inputs) const {
     // Calculating the result's shape
@@ -551,28 +555,29 @@ std::string tiling_kernel_name(ArrayType orig_dtype, ArrayType tiled_dtype,
  *    the generated kernel will perform summation for all replicas of each
  *    value, outputing the result to the `origin` (so the output for the forward
  *    operation becomes the input for the backward).
- * @param work_group_size OpenCL work group size
- * @return a string containing the kernel
+ * @return a string containing the kernel, expecting WORK_GROUP_SIZE
+ *    to be defined by the build options (see WorkGroupTuner)
  */
 std::string tiling_kernel_code(ArrayType orig_dtype, ArrayType tiled_dtype,
-                               bool forward, int work_group_size) {
+                               bool forward) {
 
     constexpr const char *kernel_template = R"clkernel(
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__kernel __attribute__((reqd_work_group_size({work_group_size}, 1, 1)))
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
 void {kernel_name}(
          __global {orig_dtype} *origin,
          __global {tiled_dtype} *tiled,
          uint rank,
-         __constant ulong *orig_shape,
-         __constant ulong *multiplies,
-         __constant ulong *orig_inner_sizes,
-         __constant ulong *tiled_inner_sizes,
+         __constant ulong *metadata,
          __local ulong *all_counters,
          __local ulong *all_current_locations,
          ulong origin_size) {{
     if (get_global_id(0) >= origin_size) return;
+    __constant ulong *orig_shape = metadata;
+    __constant ulong *multiplies = metadata + rank;
+    __constant ulong *orig_inner_sizes = metadata + 2 * rank;
+    __constant ulong *tiled_inner_sizes = metadata + 3 * rank;
     // choosing which part of the scratchpad can be used by this thread
     __local ulong *counters = all_counters + rank * get_local_id(0);
     __local ulong *current_location = all_current_locations + rank * get_local_id(0);
@@ -636,7 +641,6 @@ void {kernel_name}(
                  tiling_kernel_name(orig_dtype, tiled_dtype, forward)),
         fmt::arg("orig_dtype", cl_type_name_of_array(orig_dtype)),
         fmt::arg("tiled_dtype", cl_type_name_of_array(tiled_dtype)),
-        fmt::arg("work_group_size", work_group_size),
         fmt::arg("initialization", initialization),
         fmt::arg("mapping", mapping),
         fmt::arg("finalization", finalization));
@@ -650,8 +654,7 @@ Tile::Tile(const NodeRef &input, const std::vector<ShapeDim> &multiples,
  _kernel_name{
     tiling_kernel_name(input->dtype(), input->dtype(), run_forward)},
  _kernel_source{
-    tiling_kernel_code(input->dtype(), input->dtype(),
-                       run_forward, WORK_GROUP_SIZE)},
+    tiling_kernel_code(input->dtype(), input->dtype(), run_forward)},
  _is_forward_op{run_forward}
 {
     if (input->shape().rank() != multiples.size()) {
@@ -718,56 +721,63 @@ MultiArrayRef Tile::forward(const MultiArrayRef &value) const {
         tiled_inner_sizes = inner_block_sizes(value->shape());
         orig_shape = result_shape;
     }
+    // Everything the kernel needs to know about the shapes goes into
+    // one buffer, which stays on the device for as long as the shapes are
+    // the same
+    std::vector<cl_ulong> metadata(orig_shape.dims().begin(),
+                                   orig_shape.dims().end());
+    metadata.insert(metadata.end(), _multiples.begin(), _multiples.end());
+    metadata.insert(metadata.end(),
+                    orig_inner_sizes.begin(), orig_inner_sizes.end());
+    metadata.insert(metadata.end(),
+                    tiled_inner_sizes.begin(), tiled_inner_sizes.end());
     auto pool = value->buffer_unsafe()->pool();
-    auto multiplies_buffer = pool->reserve_buffer_for_vector(_multiples);
-    auto orig_shape_buffer = pool->reserve_buffer_for_vector(orig_shape.dims());
-    auto orig_inner_buffer = pool->reserve_buffer_for_vector(orig_inner_sizes);
-    auto tiled_inner_buffer = pool->reserve_buffer_for_vector(tiled_inner_sizes);
-    auto constants_are_ready = make_event_list(
-        {multiplies_buffer->write_from_vector(_multiples, 0),
-         orig_shape_buffer->write_from_vector(orig_shape.dims(), 0),
-         orig_inner_buffer->write_from_vector(orig_inner_sizes, 0),
-         tiled_inner_buffer->write_from_vector(tiled_inner_sizes, 0)});
+    auto metadata_buffer = pool->constant_data_for_vector(metadata);
     auto all_data_are_ready = make_event_list(
-        {value->buffer_unsafe()->completion_event()});
-    std::copy(constants_are_ready.begin(), constants_are_ready.end(),
-              std::back_inserter(all_data_are_ready));
+        {value->buffer_unsafe()->completion_event(),
+         metadata_buffer.is_uploaded});
     auto queue = pool->cl_queue();
     auto result = pool->make_array(result_shape, dtype());
     result->add_dependencies({value});
-    result->add_dependencies({multiplies_buffer, orig_shape_buffer,
-                              orig_inner_buffer, tiled_inner_buffer});
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        pool->cl_device(), KernelFamily::Tile);
     auto program = CodeCache::get_default().get_program(
         pool->cl_context(), queue,
-        _kernel_name, _kernel_source, "");
-    auto kernel = cl::Kernel(program, _kernel_name.c_str());
+        _kernel_name, _kernel_source, launch.build_options());
+    auto kernel = CodeCache::get_default().get_kernel(
+        program, _kernel_name, queue);
     kernel.setArg(0, _is_forward_op ? value->cl_buffer_unsafe()
                                     : result->cl_buffer_unsafe());
     kernel.setArg(1, _is_forward_op ? result->cl_buffer_unsafe()
                                     : value->cl_buffer_unsafe());
     kernel.setArg(2, static_cast<cl_uint>(value->shape().rank()));
-    kernel.setArg(3, orig_shape_buffer->cl_buffer_unsafe());
-    kernel.setArg(4, multiplies_buffer->cl_buffer_unsafe());
-    kernel.setArg(5, orig_inner_buffer->cl_buffer_unsafe());
-    kernel.setArg(6, tiled_inner_buffer->cl_buffer_unsafe());
-    kernel.setArg(7, static_cast<cl_ulong>(rank * sizeof(cl_ulong) * WORK_GROUP_SIZE), nullptr);
-    kernel.setArg(8, static_cast<cl_ulong>(rank * sizeof(cl_ulong) * WORK_GROUP_SIZE), nullptr);
-    kernel.setArg(9, static_cast<cl_ulong>(value->shape().size()));
-    const auto work_items = make_divisible_by(WORK_GROUP_SIZE, value->shape().size());
+    kernel.setArg(3, metadata_buffer.buffer);
+    const auto scratchpad_size = static_cast<cl_ulong>(
+        rank * sizeof(cl_ulong) * launch.work_group_size);
+    kernel.setArg(4, scratchpad_size, nullptr);
+    kernel.setArg(5, scratchpad_size, nullptr);
+    kernel.setArg(6, static_cast<cl_ulong>(value->shape().size()));
+    const auto work_items = make_divisible_by(launch.work_group_size,
+                                              value->shape().size());
     cl::Event operation_is_done;
     queue.enqueueNDRangeKernel(
         kernel,
         cl::NullRange,
         cl::NDRange(work_items),
-        cl::NDRange(WORK_GROUP_SIZE),
+        cl::NDRange(launch.work_group_size),
         &all_data_are_ready,
         &operation_is_done);
-    cl::WaitForEvents(constants_are_ready);
     result->set_completion_event(operation_is_done);
-    operation_is_done.wait();
     return result;
 }
 
+void Tile::collect_programs(const cl::Device &device,
+                            ProgramSourceList &programs) const {
+    const auto launch = WorkGroupTuner::get_default().launch_config(
+        device, KernelFamily::Tile);
+    programs.push_back({_kernel_name, _kernel_source, launch.build_options()});
+}
+
 const NodeRef Tile::apply_chain_rule(const NodeRef &wrt_input,
                                      const NodeRef &d_target_wrt_this,
                                      const NodeRefList &all_inputs) const {
@@ -813,7 +823,8 @@ ShapeOf::ShapeOf(const NodeRef &input)
         {F<NoBackProp>(input)}
     },
     {static_cast<ShapeDim>(input->shape().rank())},
-    DType)
+    DType,
+    "shape of the input")
 {
 }
 
@@ -943,6 +954,15 @@ const NodeRef ReshapeLike::apply_chain_rule(const NodeRef &wrt_input,
     }
 }
 
+int ReshapeLike::passthrough_input() const {
+    // With `_dims_to_ones` the static shape is only an estimation
+    const bool same_shape = (
+        !_replace_dims_to_ones
+        && _input->shape().is_complete()
+        && _input->shape() == shape());
+    return same_shape ? 0 : -1;
+}
+
 NodeRefList ReshapeLike::inputs() const {
     return avalanche::NodeRefList({_input, _shape_node});
 }
@@ -952,32 +972,37 @@ MultiArrayRef ReshapeLike::eval(Context &context, ExecutionCache &cache) const {
     if (!cache.get(id, result)) {
         auto input_value = _input->eval(context, cache);
         auto shape_value = _shape_node->eval(context, cache);
-        auto shape_dims = ShapeOf::extract_shape_from_metadata(shape_value);
-
-        if (_replace_dims_to_ones) {
-            auto extracted_shape = Shape(shape_dims);
-            auto dims_to_replace = extracted_shape.normalize_dims(_dims_to_ones);
-            if (dims_to_replace.empty()) {
-                // This means all dimensions must be replaced
-                for (auto &d: shape_dims) {
-                    d = 1;
-                }
-            } else {
-                // only particular dimensions must be replaced
-                for (auto i: dims_to_replace) {
-                    shape_dims[i] = 1;
-                }
-            }
-        }
-
-        auto shape_is_different = input_value->shape().dims() != shape_dims;
-        result = shape_is_different ? input_value->reshape(shape_dims)
-                                    : input_value;
+        result = forward(context, cache, {input_value, shape_value});
         cache.put(id, result);
     }
     return result;
 }
 
+MultiArrayRef ReshapeLike::forward(Context &context, ExecutionCache &cache,
+                                   const ArrayRefList &input_values) const {
+    const auto &input_value = input_values[0];
+    auto shape_dims = ShapeOf::extract_shape_from_metadata(input_values[1]);
+
+    if (_replace_dims_to_ones) {
+        auto extracted_shape = Shape(shape_dims);
+        auto dims_to_replace = extracted_shape.normalize_dims(_dims_to_ones);
+        if (dims_to_replace.empty()) {
+            // This means all dimensions must be replaced
+            for (auto &d: shape_dims) {
+                d = 1;
+            }
+        } else {
+            // only particular dimensions must be replaced
+            for (auto i: dims_to_replace) {
+                shape_dims[i] = 1;
+            }
+        }
+    }
+
+    auto shape_is_different = input_value->shape().dims() != shape_dims;
+    return shape_is_different ? input_value->reshape(shape_dims) : input_value;
+}
+
 std::string ReshapeLike::to_string() const {
     return fmt::format("({} ReshapeLike {})",
                        _input->to_string(), _shape_node->to_string());
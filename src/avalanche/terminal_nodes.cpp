@@ -51,11 +51,14 @@ const NodeRef Constant::fill(Shape shape, ArrayType dtype, float value) {
         dtype,
         {}
     };
-    return std::static_pointer_cast<BaseNode>(
-        std::make_shared<Constant>(
-            (std::string("Fill ") + shape.to_string() +
-                " with " + std::to_string(value)),
-            initializer, shape, dtype));
+    auto constant = std::make_shared<Constant>(
+        (std::string("Fill ") + shape.to_string() +
+            " with " + std::to_string(value)),
+        initializer, shape, dtype,
+        fmt::format("fill {} with {}", shape.to_string(), value));
+    constant->_is_filled = true;
+    constant->_fill_value = value;
+    return std::static_pointer_cast<BaseNode>(constant);
 }
 
 template <typename T>
@@ -82,21 +85,7 @@ MultiArrayRef Constant::eval(Context &context, ExecutionCache &cache) const {
         for (const auto &dep: _initializer.dependencies) {
             cached_deps.emplace_back(dep->eval(context, cache));
         }
-        if (context.get(id, cached_value)) {
-            // We have already initialized constant in the context
-            if (_initializer.is_cache_valid) {
-                if (!_initializer.is_cache_valid(cached_value,
-                                                 cached_deps)) {
-                    // ... but the constant is outdated now
-                    cached_value = _initializer.code(context, cache, cached_deps);
-                    context.init(id, cached_value);
-                }
-            }
-        } else {
-            // It's the first time we met this constant
-            cached_value = _initializer.code(context, cache, cached_deps);
-            context.init(id, cached_value);
-        }
+        cached_value = forward(context, cache, cached_deps);
         // We store the constant in the ExecutionCache so we would not need
         // to check it again during this run
         cache.put(id, cached_value);
@@ -104,6 +93,28 @@ MultiArrayRef Constant::eval(Context &context, ExecutionCache &cache) const {
     return cached_value;
 }
 
+MultiArrayRef Constant::forward(Context &context, ExecutionCache &cache,
+                                const ArrayRefList &input_values) const {
+    MultiArrayRef cached_value;
+    // Initializers are allowed to modify the list of dependencies
+    ArrayRefList cached_deps(input_values);
+    if (context.get(id, cached_value)) {
+        // We have already initialized constant in the context
+        if (_initializer.is_cache_valid) {
+            if (!_initializer.is_cache_valid(cached_value, cached_deps)) {
+                // ... but the constant is outdated now
+                cached_value = _initializer.code(context, cache, cached_deps);
+                context.init(id, cached_value);
+            }
+        }
+    } else {
+        // It's the first time we met this constant
+        cached_value = _initializer.code(context, cache, cached_deps);
+        context.init(id, cached_value);
+    }
+    return cached_value;
+}
+
 const NodeRef
 Constant::tensor(const std::string &name,
                  const void *data,
@@ -172,10 +183,13 @@ const NodeRef Constant::fill_shape(const avalanche::NodeRef &shape_node,
         static_cast<std::size_t>(
             shape_node->shape().rank() == 1 ? shape_node->shape().dim(0) : 0));
     std::fill(proto_dims.begin(), proto_dims.end(), UnknownDim);
-    return std::static_pointer_cast<BaseNode>(
-        std::make_shared<Constant>(
-            fmt::format("Fill shape {} with {}", shape_node->repr(), value),
-            initializer, proto_dims, dtype));
+    auto constant = std::make_shared<Constant>(
+        fmt::format("Fill shape {} with {}", shape_node->repr(), value),
+        initializer, proto_dims, dtype,
+        fmt::format("fill the shape with {}", value));
+    constant->_is_filled = true;
+    constant->_fill_value = value;
+    return std::static_pointer_cast<BaseNode>(constant);
 }
 
 const NodeRef Constant::fill_like(const NodeRef &other_node, float value) {
@@ -204,11 +218,14 @@ Constant::fill_like_with_type(const NodeRef &other_node,
         dtype,
         {other_node_wrapped}
     };
-    return std::static_pointer_cast<BaseNode>(
-        std::make_shared<Constant>(
-            fmt::format("Fill shape like {} with {}",
-                        other_node->repr(), value),
-            initializer, other_node->shape(), dtype));
+    auto constant = std::make_shared<Constant>(
+        fmt::format("Fill shape like {} with {}",
+                    other_node->repr(), value),
+        initializer, other_node->shape(), dtype,
+        fmt::format("fill like the input with {}", value));
+    constant->_is_filled = true;
+    constant->_fill_value = value;
+    return std::static_pointer_cast<BaseNode>(constant);
 }
 
 const NodeRef
@@ -221,14 +238,68 @@ Constant::ones_like_with_type(const NodeRef &other_node, ArrayType dtype) {
     return fill_like_with_type(other_node, dtype, 1.0);
 }
 
+const NodeRef Constant::make_from_node(const NodeRef &node) {
+    Initializer initializer{
+        [node](Context &context, ExecutionCache &cache,
+               ArrayRefList &dependencies) {
+            return node->eval(context, cache);
+        },
+        nullptr,
+        node->dtype(),
+        {}
+    };
+    return std::static_pointer_cast<BaseNode>(
+        std::make_shared<Constant>(
+            fmt::format("Value of {}", node->to_string()),
+            initializer, node->shape(), node->dtype()));
+}
+
+const NodeRef Constant::make_frozen(const NodeRef &node,
+                                   const MultiArrayRef &value) {
+    Initializer initializer{
+        [value](Context &context, ExecutionCache &cache,
+                ArrayRefList &dependencies) {
+            return value;
+        },
+        nullptr,
+        node->dtype(),
+        {}
+    };
+    return std::static_pointer_cast<BaseNode>(
+        std::make_shared<Constant>(
+            fmt::format("Frozen {}", node->to_string()),
+            initializer, node->shape(), node->dtype()));
+}
+
+/** Indices of all inputs of a node, from the first to the last one */
+std::vector<std::size_t> all_input_indices(const BaseNode &node) {
+    std::vector<std::size_t> result(node.inputs().size());
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = i;
+    }
+    return result;
+}
+
 MultiArrayRef Variable::eval(Context &context, ExecutionCache &cache) const {
     MultiArrayRef cached_value;
+    if (context.get(id, cached_value)) {
+        return cached_value;
+    }
+    ArrayRefList cached_deps;
+    if (_initializer) {
+        for (const auto &dep: _initializer.dependencies) {
+            cached_deps.emplace_back(std::move(dep->eval(context, cache)));
+        }
+    }
+    return forward(context, cache, cached_deps);
+}
+
+MultiArrayRef Variable::forward(Context &context, ExecutionCache &cache,
+                                const ArrayRefList &input_values) const {
+    MultiArrayRef cached_value;
     if (!context.get(id, cached_value)) {
         if (_initializer) {
-            ArrayRefList cached_deps;
-            for (const auto &dep: _initializer.dependencies) {
-                cached_deps.emplace_back(std::move(dep->eval(context, cache)));
-            }
+            ArrayRefList cached_deps(input_values);
             cached_value = _initializer.code(context, cache, cached_deps);
             check_compatibility(this, cached_value);
             cached_value->set_label(to_string());
@@ -241,6 +312,16 @@ MultiArrayRef Variable::eval(Context &context, ExecutionCache &cache) const {
     return cached_value;
 }
 
+std::vector<std::size_t>
+Variable::lazy_inputs_to_evaluate(Context &context,
+                                  const ArrayRefList &eager_values) const {
+    MultiArrayRef cached_value;
+    if (context.get(id, cached_value)) {
+        return {};
+    }
+    return all_input_indices(*this);
+}
+
 NodeRef
 Variable::make_from_node(const std::string &name,
                          const NodeRef &initialize_from_node) {
@@ -312,22 +393,37 @@ NodeRef Placeholder::make(const std::string &name,
 MultiArrayRef Placeholder::eval(Context &context, ExecutionCache &cache) const {
     MultiArrayRef cached_value;
     if (!cache.get(id, cached_value)) {
+        ArrayRefList cached_deps;
         if (_initializer) {
-            ArrayRefList cached_deps;
             for (const auto &dep: _initializer.dependencies) {
                 cached_deps.emplace_back(std::move(dep->eval(context, cache)));
             }
-            cached_value = _initializer.code(context, cache, cached_deps);
-            check_compatibility(this, cached_value);
-            cached_value->set_label(to_string());
-            cache.put(id, cached_value);
-        } else {
-            throw std::runtime_error(
-                fmt::format(
-                    "Can't find an initial value for a placeholder <{}>",
-                    name));
         }
+        cached_value = forward(context, cache, cached_deps);
+        cache.put(id, cached_value);
     }
     return cached_value;
 }
+
+MultiArrayRef Placeholder::forward(Context &context, ExecutionCache &cache,
+                                   const ArrayRefList &input_values) const {
+    if (!_initializer) {
+        throw std::runtime_error(
+            fmt::format(
+                "Can't find an initial value for a placeholder <{}>",
+                name));
+    }
+    ArrayRefList cached_deps(input_values);
+    auto result = _initializer.code(context, cache, cached_deps);
+    check_compatibility(this, result);
+    result->set_label(to_string());
+    return result;
+}
+
+std::vector<std::size_t>
+Placeholder::lazy_inputs_to_evaluate(Context &context,
+                                     const ArrayRefList &eager_values) const {
+    return all_input_indices(*this);
+}
+
 } // namespace
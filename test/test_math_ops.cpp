@@ -3,9 +3,12 @@
 #include <numeric>
 #include <functional>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <numeric>
 
 #include "avalanche/testing_tools.h"
+#include "avalanche/WorkGroupTuner.h"
 
 using namespace avalanche;
 
@@ -80,6 +83,52 @@ TEST_CASE("Broadcasting element-wise ops") {
             // Expected
             {0.5, 3.0, 5.5, 1.5, 4.0, 6.5, 2.5, 5.0, 7.5});
     }
+    SECTION("Adding a column to a matrix") {
+        test_broadcasted_elemwise_op<float, Plus, float>(
+            {1, 2, 3, 4, 5, 6}, Shape({2, 3}),
+            {10, 20}, Shape({2, 1}),
+            std::plus<>(),
+            // Expected
+            {11, 12, 13, 24, 25, 26});
+    }
+}
+
+
+TEST_CASE("Broadcast patterns") {
+    SECTION("Arrays of the same shape") {
+        auto pattern = BroadcastPattern::of(Shape({4, 3, 2}), Shape({4, 3, 2}));
+        REQUIRE(pattern.dims == std::vector<std::size_t>({24}));
+        REQUIRE(pattern.signature() == "b");
+        REQUIRE(pattern.index_expression(true, "i") == "i");
+        REQUIRE(pattern.index_expression(false, "i") == "i");
+    }
+    SECTION("A scalar") {
+        auto pattern = BroadcastPattern::of(Shape({4, 3}), Shape());
+        REQUIRE(pattern.signature() == "l");
+        REQUIRE(pattern.index_expression(true, "i") == "i");
+        REQUIRE(pattern.index_expression(false, "i") == "0");
+    }
+    SECTION("A row") {
+        auto pattern = BroadcastPattern::of(Shape({8, 16, 4}), Shape({4}));
+        REQUIRE(pattern.dims == std::vector<std::size_t>({128, 4}));
+        REQUIRE(pattern.signature() == "l_b4");
+        REQUIRE(pattern.index_expression(false, "i") == "(i % 4UL)");
+        // The size of the first dimension doesn't make a difference
+        REQUIRE(BroadcastPattern::of(Shape({3, 4}), Shape({4})).signature()
+                == pattern.signature());
+    }
+    SECTION("A column") {
+        auto pattern = BroadcastPattern::of(Shape({5, 1}), Shape({5, 6}));
+        REQUIRE(pattern.signature() == "b_r6");
+        REQUIRE(pattern.index_expression(true, "i") == "(i / 6UL)");
+    }
+    SECTION("Everything together") {
+        auto pattern = BroadcastPattern::of(
+            Shape({4, 3, 1, 2}), Shape({4, 1, 1, 2}));
+        REQUIRE(pattern.signature() == "b_l3_b2");
+        REQUIRE(pattern.index_expression(false, "i")
+                == "((i / 6UL) * 2UL + i % 2UL)");
+    }
 }
 
 
@@ -141,10 +190,121 @@ TEST_CASE("Testing matrix multiplication") {
             cpu_copy ==
             std::vector<float>({126, 144, 162, 144, 166, 188, 162, 188, 214}));
     }
+
+    SECTION("Multiplying a part of a larger array") {
+        // The slice shares the buffer with the whole matrix
+        auto output = F<MatMul>(FU<SliceAxis>(val1, 0, 1, 3), val2,
+                                false, false);
+        Executor executor(Context::make_for_device(0), {output});
+        auto results = executor.run();
+        std::vector<float> cpu_copy;
+        results[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>(expected.begin() + 4,
+                                               expected.end()));
+    }
+
+    SECTION("Stacks of matrices") {
+        auto stack1 = Constant::tensor<float>(
+            {1, 2, 3,
+             4, 5, 6,
+
+             0, 1, 0,
+             1, 0, 1},
+            Shape({2, 2, 3}));
+        auto stack2 = Constant::tensor<float>(
+            {1, 0,
+             0, 1,
+             1, 1,
+
+             1, 1,
+             1, 1,
+             1, 1},
+            Shape({2, 3, 2}));
+        // One matrix for the whole stack
+        evaluate_and_check<float>(
+            F<BatchMatMul>(stack1, FU<SliceAxis>(stack2, 0, 0, 0, false)),
+            {4, 5, 10, 11, 0, 1, 2, 1},
+            Shape({2, 2, 2}));
+        // A pair of matrices for every multiplication
+        evaluate_and_check<float>(
+            F<BatchMatMul>(stack1, stack2),
+            {4, 5, 10, 11, 1, 1, 2, 2},
+            Shape({2, 2, 2}));
+        // The first matrix of the left stack is used twice
+        evaluate_and_check<float>(
+            F<BatchMatMul>(FU<SliceAxis>(stack1, 0, 0, 0), stack2),
+            {4, 5, 10, 11, 6, 6, 15, 15},
+            Shape({2, 2, 2}));
+        // Transposed stacks
+        evaluate_and_check<float>(
+            F<BatchMatMul>(stack2, stack1, true, true),
+            {4, 10, 5, 11, 1, 2, 1, 2},
+            Shape({2, 2, 2}));
+    }
+
+    SECTION("Derivatives of multiplication of stacks of matrices") {
+        auto inputs = Variable::make("inputs", {2, 2, 3}, ArrayType::float32);
+        auto weights = Variable::make("weights", {3, 2}, ArrayType::float32);
+        auto context = Context::make_for_device(0);
+        context->init<float>(
+            inputs, {1, 2, 3, 4, 5, 6, 0, 1, 0, 1, 0, 1}, inputs->shape());
+        context->init<float>(weights, {1, 0, 0, 1, 1, 1}, weights->shape());
+        verify_derivatives<float>(
+            context, {inputs, weights},
+            F<BatchMatMul>(inputs, weights), 1e-2);
+        verify_derivatives<float>(
+            context, {inputs, weights},
+            F<BatchMatMul>(weights, inputs, true, true), 1e-2);
+    }
 }
 
 
 
+TEST_CASE("Dense layers") {
+    auto inputs = Variable::make("inputs", {2, 3}, ArrayType::float32);
+    auto weights = Variable::make("weights", {3, 2}, ArrayType::float32);
+    auto bias = Variable::make("bias", {2}, ArrayType::float32);
+    auto context = Context::make_for_device(0);
+    context->init<float>(inputs, {1, 2, 3, 4, 5, 6}, inputs->shape());
+    context->init<float>(weights, {1, 0, 0, 1, 1, 1}, weights->shape());
+    context->init<float>(bias, {-5, 0.5}, bias->shape());
+
+    SECTION("Bias and activation applied to the product") {
+        evaluate_and_check<float>(
+            Dense::make(inputs, weights, bias),
+            {-1, 5.5, 5, 11.5}, Shape({2, 2}), context);
+        evaluate_and_check<float>(
+            Dense::make(inputs, weights, bias, Activation::ReLU),
+            {0, 5.5, 5, 11.5}, Shape({2, 2}), context);
+    }
+
+    SECTION("Derivatives") {
+        for (auto activation: {Activation::Linear, Activation::ReLU,
+                               Activation::Sigmoid, Activation::Tanh}) {
+            verify_derivatives<float>(
+                context, {inputs, weights, bias},
+                Dense::make(inputs, weights, bias, activation), 1e-2);
+        }
+    }
+
+    SECTION("Second derivatives") {
+        for (auto activation: {Activation::Linear, Activation::ReLU,
+                               Activation::Sigmoid, Activation::Tanh}) {
+            auto output = FU<Square>(
+                Dense::make(inputs, weights, bias, activation));
+            auto weights_gradient = build_gradients(output, {weights})[0];
+            verify_derivatives<float>(
+                context, {inputs, bias}, weights_gradient, 1e-2);
+        }
+    }
+
+    SECTION("Shapes that don't match") {
+        REQUIRE_THROWS_AS(Dense::make(weights, weights, bias),
+                          std::invalid_argument);
+    }
+}
+
+
 TEST_CASE("Testing scaling") {
     auto val1 = Constant::tensor<float>(
         {0.0f, 1.0f, 2.0f,
@@ -220,6 +380,18 @@ TEST_CASE("Test various transformations") {
             Shape({3}));
     }
 
+    SECTION("Clipping") {
+        auto val1 = Constant::tensor<float>(
+            {-5.0f, 0.0f, 0.5f, 1.0f, 5.0f},
+            Shape({5}));
+        auto output = FU<Clip>(val1, 0.0f, 1.0f);
+        evaluate_and_check<float>(
+            output,
+            {0.0f, 0.0f, 0.5f, 1.0f, 1.0f},
+            Shape({5}));
+        REQUIRE_THROWS_AS(FU<Clip>(val1, 1.0f, 0.0f), std::invalid_argument);
+    }
+
     SECTION("ReduceSum") {
         auto val1 = Constant::tensor<float>(
             {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
@@ -278,6 +450,111 @@ TEST_CASE("Test various transformations") {
             Shape());
     }
 
+    SECTION("Reductions of long dimensions") {
+        // Adjacent dimensions get reduced as one
+        auto val1 = Constant::tensor<float>(
+            {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+            Shape({2, 3, 2}));
+        auto output1 = FU<ReduceSum>(val1, std::vector<ShapeDim>({0, 1}));
+        evaluate_and_check<float>(output1, {30, 36}, Shape({2}));
+        auto output2 = FU<ReduceSum>(val1, std::vector<ShapeDim>({1, 2}),
+                                     true);
+        evaluate_and_check<float>(output2, {15, 51}, Shape({2, 1, 1}));
+        // Few outputs of long rows are reduced by whole work groups
+        const std::size_t row_length = 1000;
+        std::vector<float> rows(3 * row_length);
+        std::iota(rows.begin(), rows.end(), 0);
+        auto val2 = Constant::tensor<float>(
+            rows, Shape({3, static_cast<ShapeDim>(row_length)}));
+        auto output3 = FU<ReduceSum>(val2, std::vector<ShapeDim>({-1}));
+        evaluate_and_check<float>(
+            output3, {499500, 1499500, 2499500}, Shape({3}));
+        auto output4 = FU<ReduceMax>(val2, std::vector<ShapeDim>({-1}));
+        evaluate_and_check<float>(output4, {999, 1999, 2999}, Shape({3}));
+        // Same for long columns
+        auto val3 = Constant::tensor<float>(
+            rows, Shape({static_cast<ShapeDim>(row_length), 3}));
+        auto output5 = FU<ReduceMean>(val3, std::vector<ShapeDim>({0}));
+        evaluate_and_check<float>(output5, {1498.5, 1499.5, 1500.5}, Shape({3}));
+    }
+
+    SECTION("Full reductions of long arrays") {
+        // Long enough to need several passes, and not divisible by 4
+        std::vector<float> ones(1 << 20 | 3, 1.0f);
+        auto val1 = Constant::tensor<float>(
+            ones, Shape({static_cast<ShapeDim>(ones.size())}));
+        evaluate_and_check<float>(
+            FU<ReduceSum>(val1), {static_cast<float>(ones.size())}, Shape());
+        evaluate_and_check<float>(FU<ReduceMean>(val1), {1.0f}, Shape());
+        std::vector<std::int32_t> numbers(100003);
+        std::iota(numbers.begin(), numbers.end(), -50000);
+        auto val2 = Constant::tensor<std::int32_t>(
+            numbers, Shape({static_cast<ShapeDim>(numbers.size())}));
+        evaluate_and_check<std::int32_t>(
+            FU<ReduceMax>(val2), {50002}, Shape());
+        evaluate_and_check<std::int32_t>(
+            FU<ReduceMin>(val2), {-50000}, Shape());
+        // Integer means are divided only once, after summing all parts
+        evaluate_and_check<std::int32_t>(
+            FU<ReduceMean>(val2), {1}, Shape());
+        std::vector<std::int32_t> int_ones(2048, 1);
+        auto val3 = Constant::tensor<std::int32_t>(
+            int_ones, Shape({static_cast<ShapeDim>(int_ones.size())}));
+        evaluate_and_check<std::int32_t>(
+            FU<ReduceMean>(val3), {1}, Shape());
+    }
+
+    SECTION("Full reductions of half precision arrays") {
+        auto context = Context::make_for_device(0);
+        const auto extensions = context->device_pool()->cl_device()
+            .getInfo<CL_DEVICE_EXTENSIONS>();
+        if (extensions.find("cl_khr_fp16") == std::string::npos) {
+            WARN("The device doesn't support half precision, skipping");
+            return;
+        }
+        // Alternating signs keep every partial sum exact in half precision
+        std::vector<float> values(10003);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            values[i] = (i % 2 == 0 ? 1.0f : -1.0f);
+        }
+        auto val1 = FU<Cast>(
+            Constant::tensor<float>(
+                values, Shape({static_cast<ShapeDim>(values.size())})),
+            ArrayType::float16);
+        for (const auto &item: std::vector<std::pair<NodeRef, float>>({
+                {FU<ReduceSum>(val1), 1.0f},
+                {FU<ReduceMax>(val1), 1.0f},
+                {FU<ReduceMin>(val1), -1.0f}})) {
+            evaluate_and_check<float>(
+                FU<Cast>(item.first, ArrayType::float32), {item.second},
+                Shape(), context);
+        }
+    }
+
+    SECTION("Softmax") {
+        auto val1 = Constant::tensor<float>(
+            {1, 2, 3, 1000, 1001, 1002}, Shape({2, 3}));
+        // Large values must not overflow
+        evaluate_and_check<float>(
+            softmax(val1),
+            {0.09003057f, 0.24472847f, 0.66524096f,
+             0.09003057f, 0.24472847f, 0.66524096f},
+            Shape({2, 3}));
+        evaluate_and_check<float>(
+            softmax(val1, 0),
+            {0, 0, 0, 1, 1, 1},
+            Shape({2, 3}));
+        // Long rows are calculated by whole work groups
+        std::vector<float> zeros(2 * 1000, 0.0f);
+        auto val2 = Constant::tensor<float>(zeros, Shape({2, 1000}));
+        evaluate_and_check<float>(
+            softmax(val2), std::vector<float>(zeros.size(), 0.001f),
+            Shape({2, 1000}));
+        REQUIRE_THROWS_AS(
+            softmax(Constant::tensor<std::int32_t>({1, 2}, Shape({2}))),
+            std::invalid_argument);
+    }
+
     SECTION("ReduceSum to be like some other node") {
         auto data1 = Variable::make("data1", {3, 2}, ArrayType::float32);
         auto data2 = Variable::make("data2", {3, 1}, ArrayType::float32);
@@ -361,6 +638,14 @@ TEST_CASE("Checking automatic derivations (backprop)") {
         verify_derivatives<float>(context, {input}, output, 1e-2);
     }
 
+    SECTION("Clip") {
+        auto input = Variable::make("input1", {4}, ArrayType::float32);
+        auto output = FU<Clip>(input, 0.5f, 1.5f);
+        auto context = Context::make_for_device(0);
+        context->init<float>(input, {0.0f, 0.75f, 1.25f, 2.0f}, input->shape());
+        verify_derivatives<float>(context, {input}, output, 1e-2);
+    }
+
     SECTION("MatMul") {
         auto input1 = Variable::make("input1", {3, 3}, ArrayType::float32);
         auto input2 = Variable::make("input2", {3, 3}, ArrayType::float32);
@@ -454,6 +739,33 @@ TEST_CASE("Checking automatic derivations (backprop)") {
         verify_derivatives<float>(context, {weights, biases}, output, 1e-2);
     }
 
+    SECTION("Sum of many arrays") {
+        auto weights = Variable::make("weights", {3, 3} , ArrayType::float32);
+        auto biases = Variable::make("biases", {3, 3}, ArrayType::float32);
+        auto output = AddN::make(
+            {weights, F<ElemWiseMultiply>(weights, weights), biases});
+        auto context = Context::make_for_device(0);
+        context->init<float>(
+            weights,
+            {0.0f, 3.0f, 6.0,
+             1.0, 4.0, 7.0,
+             2.0, 5.0, 8.0},
+            weights->shape());
+        context->init<float>(
+            biases,
+            {0.5, 0.0, -0.5,
+             0.5, 0.0, -0.5,
+             0.5, 0.0, -0.5},
+            biases->shape());
+        evaluate_and_check<float>(
+            output,
+            {0.5, 12.0, 41.5, 2.5, 20.0, 55.5, 6.5, 30.0, 71.5},
+            Shape({3, 3}),
+            context);
+        // weights get three chunks of the gradient, added up by one AddN
+        verify_derivatives<float>(context, {weights, biases}, output, 1e-2);
+    }
+
     SECTION("Broadcasted minus") {
         auto weights = Variable::make("weights", {3, 3} , ArrayType::float32);
         auto biases = Variable::make("biases", {3}, ArrayType::float32);
@@ -678,6 +990,24 @@ TEST_CASE("Checking automatic derivations (backprop)") {
         verify_derivatives<float>(context, {data}, output, 0.05);
     }
 
+    SECTION("Derivatives of Softmax #3") {
+        // The sum of softmax is always 1, so the rows get weighted
+        const ShapeDim row_length = 100;
+        auto data = Variable::make("data", {2, row_length},
+                                   ArrayType::float32);
+        std::vector<float> values(2 * row_length), weights(2 * row_length);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            values[i] = static_cast<float>(i % 7) / 2.0f;
+            weights[i] = static_cast<float>(i % 5) * 10.0f;
+        }
+        auto output = F<Multiply>(
+            softmax(data, -1),
+            Constant::tensor<float>(weights, data->shape()));
+        auto context = Context::make_for_device(0);
+        context->init<float>(data, values, data->shape());
+        verify_derivatives<float>(context, {data}, output, 0.05);
+    }
+
     SECTION("Derivatives of broadcasted subtraction #2") {
         auto data1 = Variable::make("data1", {3, 2}, ArrayType::float32);
         auto data2 = Variable::make("data2", {3, 1}, ArrayType::float32);
@@ -962,4 +1292,125 @@ TEST_CASE("Loss functions") {
         verify_derivatives<float>(context, {nn_outputs, labels}, output, 1e-2);
     }
 
+    SECTION("Test of softmax cross-entropy") {
+        auto logits = Variable::make("logits", {2, 3}, ArrayType::float32);
+        auto labels = Variable::make("labels", {2, 3}, ArrayType::float32);
+        auto output = SoftmaxCrossEntropy::make(logits, labels);
+        REQUIRE(output->shape() == Shape({2}));
+        auto context = Context::make_for_device(0);
+        // Large logits must not overflow
+        context->init<float>(
+            logits, {1, 2, 3, 1000, 1000, 1000}, logits->shape());
+        context->init<float>(
+            labels, {0, 0, 1, 0.5f, 0.5f, 0}, labels->shape());
+        evaluate_and_check<float>(
+            output, {0.40760596f, 1.09861229f}, Shape({2}), context);
+        // Logarithms of zero probabilities of the classes
+        // the labels skip don't make the loss NaN
+        const float log_of_zero = -std::numeric_limits<float>::infinity();
+        context->init<float>(
+            logits, {1, 2, 3, 0, log_of_zero, 0}, logits->shape());
+        context->init<float>(
+            labels, {0, 0, 1, 1, 0, 0}, labels->shape());
+        evaluate_and_check<float>(
+            output, {0.40760596f, 0.69314718f}, Shape({2}), context);
+        context->init<float>(
+            logits, {1, 2, 3, 3, 1, 2}, logits->shape());
+        verify_derivatives<float>(context, {logits, labels}, output, 1e-2);
+        REQUIRE_THROWS_AS(
+            SoftmaxCrossEntropy::make(
+                logits, Variable::make("labels", {2, 4}, ArrayType::float32)),
+            std::invalid_argument);
+    }
+
+    SECTION("Test of sparse softmax cross-entropy") {
+        auto logits = Variable::make("logits", {2, 3}, ArrayType::float32);
+        auto labels = Constant::tensor<std::int64_t>({2, 0}, Shape({2}));
+        auto output = SparseSoftmaxCrossEntropy::make(logits, labels);
+        REQUIRE(output->shape() == Shape({2}));
+        auto context = Context::make_for_device(0);
+        context->init<float>(
+            logits, {1, 2, 3, 1000, 1000, 1000}, logits->shape());
+        evaluate_and_check<float>(
+            output, {0.40760596f, 1.09861229f}, Shape({2}), context);
+        context->init<float>(
+            logits, {1, 2, 3, 3, 1, 2}, logits->shape());
+        verify_derivatives<float>(context, {logits}, output, 1e-2);
+        // Classes along the first axis
+        auto labels_by_column = Constant::tensor<std::int32_t>(
+            {1, 0, 1}, Shape({3}));
+        evaluate_and_check<float>(
+            SparseSoftmaxCrossEntropy::make(logits, labels_by_column, 0),
+            {0.12692801f, 0.31326169f, 1.31326169f}, Shape({3}), context);
+        // Long rows of many classes
+        std::vector<float> zeros(2 * 1000, 0.0f);
+        auto many_classes = Constant::tensor<float>(zeros, Shape({2, 1000}));
+        auto classes = Constant::tensor<std::int32_t>({5, 999}, Shape({2}));
+        evaluate_and_check<float>(
+            SparseSoftmaxCrossEntropy::make(many_classes, classes),
+            {6.90775528f, 6.90775528f}, Shape({2}));
+        // Rows with labels out of range get NaN as the loss
+        // and as the gradient, instead of training on them silently
+        auto bad_labels = Constant::tensor<std::int64_t>({0, 3}, Shape({2}));
+        auto bad_output = SparseSoftmaxCrossEntropy::make(logits, bad_labels);
+        auto bad_gradient = build_gradients(bad_output, {logits})[0];
+        Executor bad_executor(context, {bad_output, bad_gradient});
+        auto bad_results = bad_executor.run();
+        std::vector<float> cpu_copy;
+        bad_results[0]->fetch_data_into(cpu_copy);
+        REQUIRE(std::isfinite(cpu_copy[0]));
+        REQUIRE(std::isnan(cpu_copy[1]));
+        bad_results[1]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy.size() == 6);
+        for (std::size_t i = 0; i < 3; ++i) {
+            REQUIRE(std::isfinite(cpu_copy[i]));
+            REQUIRE(std::isnan(cpu_copy[3 + i]));
+        }
+        REQUIRE_THROWS_AS(
+            SparseSoftmaxCrossEntropy::make(
+                logits, Constant::tensor<float>({2, 0}, Shape({2}))),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(
+            SparseSoftmaxCrossEntropy::make(
+                logits, Constant::tensor<std::int64_t>({2, 0, 1},
+                                                       Shape({3}))),
+            std::invalid_argument);
+    }
+}
+
+
+TEST_CASE("Kernels launched with tuned configurations") {
+    // Each work item processes several elements, and the size of the data
+    // isn't divisible by the size of work groups
+    LaunchConfig config {16, 4};
+    std::vector<float> data(1001);
+    std::iota(data.begin(), data.end(), 0.0f);
+    std::vector<float> doubled(data), squared(data), incremented(data);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        doubled[i] = 2 * data[i];
+        squared[i] = data[i] * data[i];
+        incremented[i] = data[i] + 1;
+    }
+    auto value = Constant::tensor<float>(data, Shape({1001}));
+
+    SECTION("Transformations") {
+        LaunchConfigOverride tuned(KernelFamily::Transform, config);
+        evaluate_and_check<float>(FU<Scale>(value, 2), doubled,
+                                  Shape({1001}));
+    }
+    SECTION("Element-wise operations") {
+        LaunchConfigOverride tuned(KernelFamily::ElementWise, config);
+        evaluate_and_check<float>(F<ElemWiseMultiply>(value, value), squared,
+                                  Shape({1001}));
+    }
+    SECTION("Broadcasted operations") {
+        LaunchConfigOverride tuned(KernelFamily::Broadcasted, config);
+        evaluate_and_check<float>(F<Plus>(value, Constant::scalar(1.0f)),
+                                  incremented, Shape({1001}));
+    }
+    SECTION("Reductions") {
+        LaunchConfigOverride tuned(KernelFamily::Reduction, {128, 1});
+        evaluate_and_check<float>(FU<ReduceSum>(value), {500500},
+                                  Shape());
+    }
 }
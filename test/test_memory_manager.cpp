@@ -1,6 +1,15 @@
 #define CATCH_CONFIG_MAIN
 
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
 
 #include "catch.hpp"
 
@@ -9,6 +18,8 @@
 #include "avalanche/BaseNode.h"
 #include "avalanche/Context.h"
 #include "avalanche/ExecutionCache.h"
+#include "avalanche/CodeCache.h"
+#include "avalanche/WorkGroupTuner.h"
 
 
 TEST_CASE("Test memory manager") {
@@ -49,6 +60,27 @@ TEST_CASE("Test memory manager") {
     REQUIRE(pool->num_available_blocks() == 2);
 }
 
+TEST_CASE("Keeping constant data on the device") {
+    auto manager = avalanche::CLMemoryManager();
+    manager.init_for_all_gpus();
+    auto pool = manager.buffer_pool(0);
+    std::vector<cl_ulong> masks({12, 4, 1}), other_masks({12, 0, 1});
+    auto first = pool->constant_data_for_vector(masks);
+    auto second = pool->constant_data_for_vector(
+        std::vector<cl_ulong>(masks));
+    auto third = pool->constant_data_for_vector(other_masks);
+    // The same data is uploaded only once
+    REQUIRE(first.buffer() == second.buffer());
+    REQUIRE(first.buffer() != third.buffer());
+    REQUIRE(pool->num_constant_data() == 2);
+    std::vector<cl_ulong> uploaded(masks.size());
+    std::vector<cl::Event> wait_for({third.is_uploaded});
+    pool->cl_queue().enqueueReadBuffer(
+        third.buffer, CL_TRUE, 0, sizeof(cl_ulong) * uploaded.size(),
+        uploaded.data(), &wait_for);
+    REQUIRE(uploaded == other_masks);
+}
+
 TEST_CASE("Testing Shape class") {
     avalanche::Shape shape({1, 3, 5});
     REQUIRE(shape.rank() == 3);
@@ -155,4 +187,166 @@ TEST_CASE("Checking ExecutionCache") {
     REQUIRE(cached.reuse_counter == 0);
     REQUIRE(cache.get_info(node2_id, cached));
     REQUIRE(cached.reuse_counter == 0);
-}
\ No newline at end of file
+}
+
+
+// A new directory under the system temp path, removed with all its files
+// at the end of the test, even a failed one
+struct TempDirectory {
+    std::string path;
+
+    TempDirectory() {
+        const char *temp_root = std::getenv("TMPDIR");
+        path = (temp_root != nullptr && *temp_root != '\0') ? temp_root : "/tmp";
+        path += "/avalanche_test_XXXXXX";
+        if (mkdtemp(&path[0]) == nullptr) {
+            throw std::runtime_error("Cannot create a temporary directory");
+        }
+    }
+
+    ~TempDirectory() {
+        DIR *dir = opendir(path.c_str());
+        if (dir != nullptr) {
+            while (auto *entry = readdir(dir)) {
+                std::string name(entry->d_name);
+                if (name != "." && name != "..") {
+                    std::remove((path + "/" + name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+};
+
+TEST_CASE("Keeping compiled programs on disk") {
+    auto pool = avalanche::CLMemoryManager::get_default()->buffer_pool(0);
+    // The directory is new, so no older binaries could interfere
+    TempDirectory temp_directory;
+    const auto &cache_directory = temp_directory.path;
+    const std::string source = R"clkernel(
+__kernel void add_one(__global float *data) {
+    data[get_global_id(0)] += 1;
+}
+)clkernel";
+    avalanche::CodeCache first_cache;
+    first_cache.set_cache_directory(cache_directory);
+    first_cache.get_program(pool->cl_context(), pool->cl_queue(),
+                            "add_one", source, "");
+    REQUIRE(first_cache.num_loaded_from_disk() == 0);
+
+    INFO("A new cache (like in a new process) finds the compiled binary");
+    avalanche::CodeCache second_cache;
+    second_cache.set_cache_directory(cache_directory);
+    auto program = second_cache.get_program(
+        pool->cl_context(), pool->cl_queue(), "add_one", source, "");
+    REQUIRE(second_cache.num_loaded_from_disk() == 1);
+    REQUIRE_NOTHROW(cl::Kernel(program, "add_one"));
+
+    INFO("Different build options require a different binary");
+    avalanche::CodeCache third_cache;
+    third_cache.set_cache_directory(cache_directory);
+    third_cache.get_program(pool->cl_context(), pool->cl_queue(),
+                            "add_one", source, "-cl-fast-relaxed-math");
+    REQUIRE(third_cache.num_loaded_from_disk() == 0);
+
+    INFO("Truncated binaries are compiled again");
+    DIR *dir = opendir(cache_directory.c_str());
+    REQUIRE(dir != nullptr);
+    while (auto *entry = readdir(dir)) {
+        std::string name(entry->d_name);
+        if (name != "." && name != "..") {
+            auto path = cache_directory + "/" + name;
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            auto size = static_cast<off_t>(file.tellg());
+            file.close();
+            REQUIRE(truncate(path.c_str(), size - 1) == 0);
+        }
+    }
+    closedir(dir);
+    avalanche::CodeCache fourth_cache;
+    fourth_cache.set_cache_directory(cache_directory);
+    program = fourth_cache.get_program(
+        pool->cl_context(), pool->cl_queue(), "add_one", source, "");
+    REQUIRE(fourth_cache.num_loaded_from_disk() == 0);
+    REQUIRE_NOTHROW(cl::Kernel(program, "add_one"));
+}
+
+
+TEST_CASE("Sharing CodeCache between threads") {
+    auto pool = avalanche::CLMemoryManager::get_default()->buffer_pool(0);
+    const std::string source = R"clkernel(
+__kernel void multiply_by_two(__global float *data) {
+    data[get_global_id(0)] *= 2;
+}
+)clkernel";
+    avalanche::CodeCache code_cache;
+    code_cache.set_cache_directory("");
+    std::vector<cl::Program> programs(4);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < programs.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            programs[i] = code_cache.get_program(
+                pool->cl_context(), pool->cl_queue(),
+                "multiply_by_two", source, "");
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    INFO("The program gets built only once");
+    for (const auto &program: programs) {
+        REQUIRE(program() == programs[0]());
+    }
+
+    INFO("Kernels are reused within the same thread");
+    auto kernel = code_cache.get_kernel(
+        programs[0], "multiply_by_two", pool->cl_queue());
+    REQUIRE(kernel() == code_cache.get_kernel(
+        programs[0], "multiply_by_two", pool->cl_queue())());
+    cl::Kernel kernel_from_other_thread;
+    std::thread([&]() {
+        kernel_from_other_thread = code_cache.get_kernel(
+            programs[0], "multiply_by_two", pool->cl_queue());
+    }).join();
+    REQUIRE(kernel() != kernel_from_other_thread());
+}
+
+TEST_CASE("Keeping the results of work group tuning") {
+    auto pool = avalanche::CLMemoryManager::get_default()->buffer_pool(0);
+    const auto &device = pool->cl_device();
+    const std::string tuning_file = "avalanche_test_tuning.txt";
+    std::remove(tuning_file.c_str());
+
+    avalanche::LaunchConfig config {128, 4};
+    REQUIRE(config.global_size(1000) == 256);
+    REQUIRE(config.build_options() == "-DWORK_GROUP_SIZE=128");
+
+    avalanche::WorkGroupTuner first_tuner;
+    first_tuner.set_tuning_file(tuning_file);
+    INFO("Untuned devices get the old defaults");
+    REQUIRE(first_tuner.launch_config(
+        device, avalanche::KernelFamily::ElementWise) ==
+            avalanche::LaunchConfig(
+                {avalanche::WorkGroupTuner::DefaultWorkGroupSize, 1}));
+    first_tuner.set_launch_config(
+        device, avalanche::KernelFamily::ElementWise, config);
+    first_tuner.save();
+
+    avalanche::WorkGroupTuner second_tuner;
+    second_tuner.set_tuning_file(tuning_file);
+    REQUIRE(second_tuner.launch_config(
+        device, avalanche::KernelFamily::ElementWise) == config);
+    REQUIRE(second_tuner.launch_config(
+        device, avalanche::KernelFamily::Reduction).items_per_thread == 1);
+
+    INFO("Tuning picks one of the configurations the device supports");
+    auto best = second_tuner.tune(pool, avalanche::KernelFamily::Transform);
+    REQUIRE(best.work_group_size
+            <= device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    avalanche::WorkGroupTuner third_tuner;
+    third_tuner.set_tuning_file(tuning_file);
+    REQUIRE(third_tuner.launch_config(
+        device, avalanche::KernelFamily::Transform) == best);
+    std::remove(tuning_file.c_str());
+}
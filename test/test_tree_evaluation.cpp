@@ -1,5 +1,6 @@
 #define CATCH_CONFIG_MAIN
 
+#include <cmath>
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -8,6 +9,7 @@
 #include "avalanche/terminal_nodes.h"
 #include "avalanche/nodes.h"
 #include "avalanche/Executor.h"
+#include "avalanche/DataParallelExecutor.h"
 #include "avalanche/testing_tools.h"
 
 using namespace avalanche;
@@ -157,3 +159,501 @@ TEST_CASE("Conditional evaluation") {
     evaluate_and_check<float>(var1, {2}, Shape(), context);
     evaluate_and_check<float>(var2, {1}, Shape(), context);
 }
+
+TEST_CASE("Flattened execution plan") {
+    auto context = Context::make_for_device(0);
+
+    SECTION("Shared nodes get only one slot and are evaluated once") {
+        auto a = Constant::scalar(2.0f);
+        auto b = a + a;
+        auto c = b * b;
+        auto d = c + b;
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor executor(context, {c, d}, {}, options);
+        REQUIRE(executor.plan().size() == 4);
+        REQUIRE(executor.plan().main_sequence_size() == 4);
+        for (int i = 0; i < 2; ++i) {
+            auto results = executor.run();
+            std::vector<float> cpu_copy;
+            results[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({16}));
+            results[1]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({20}));
+        }
+    }
+
+    SECTION("Branches of Cond are kept out of the main sequence") {
+        auto condition = Variable::make("condition", {}, ArrayType::int8);
+        auto x = Constant::scalar(3.0f);
+        auto y = Constant::scalar(5.0f);
+        auto output = Cond::make(condition, x * x, y * y);
+        PlanOptions options;
+        options.skip_passthrough_nodes = false;
+        Executor executor(context, {output}, {}, options);
+        // condition, NoBackProp(condition), x, x * x, y, y * y and Cond itself
+        REQUIRE(executor.plan().size() == 7);
+        REQUIRE(executor.plan().main_sequence_size() == 3);
+        context->init<std::int8_t>(condition, {1});
+        std::vector<float> cpu_copy;
+        executor.run()[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({9}));
+        context->init<std::int8_t>(condition, {0});
+        executor.run()[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({25}));
+    }
+
+    SECTION("Values can be given for intermediate nodes") {
+        auto a = Placeholder::make("a", {}, ArrayType::float32);
+        auto b = a * a;
+        auto c = b + Constant::scalar(1.0f);
+        Executor executor(context, {c});
+        auto given_value = context->device_pool()->make_array(
+            Shape(), ArrayType::float32);
+        given_value->write_from_vector(std::vector<float>({10}));
+        // `a` has no value, but it isn't necessary since `b` is known
+        auto results = executor.run({{b, given_value}});
+        std::vector<float> cpu_copy;
+        results[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({11}));
+    }
+
+    SECTION("Intermediate values not living together share the memory") {
+        auto x = Constant::fill(Shape({4, 4}), ArrayType::float32, 2);
+        auto y1 = x * x;
+        auto y2 = y1 * y1;
+        auto y3 = y2 * y2;
+        auto y4 = y3 * y3;
+        Executor executor(context, {y4});
+        // y1 and y3 take the same place, y4 is an output and stays outside
+        REQUIRE(executor.plan().arena_size()
+                == 2 * ExecutionPlan::DefaultArenaAlignment);
+        for (int i = 0; i < 2; ++i) {
+            std::vector<float> cpu_copy;
+            executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>(16, 65536));
+        }
+    }
+
+    SECTION("Independent branches are split into separate chains") {
+        REQUIRE(context->device_pool()->num_queues() > 0);
+        auto x = Constant::fill(Shape({3}), ArrayType::float32, 3);
+        auto squared = x * x;
+        auto doubled = x + x;
+        auto output = squared - doubled;
+        // Fusion would turn all three operations into one kernel
+        PlanOptions options;
+        options.fuse_elementwise = false;
+        Executor executor(context, {output}, {}, options);
+        // x, squared and output form one chain, doubled starts another one
+        REQUIRE(executor.plan().num_chains() == 2);
+        for (int i = 0; i < 2; ++i) {
+            std::vector<float> cpu_copy;
+            executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({3, 3, 3}));
+        }
+    }
+
+    SECTION("Chains of element-wise operations are fused") {
+        auto x = Constant::fill(Shape({2, 3}), ArrayType::float32, 2);
+        auto bias = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        auto output = FU<Scale>(F<Sqrt>(x * x + bias), 2.0f) - x;
+        auto shared = x + bias;
+        auto with_shared = F<ElemWiseMultiply>(shared, shared) / shared;
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor executor(context, {output, with_shared}, {}, options);
+        // x, bias, shared and two fused instructions: the first one
+        // calculates output, the second one with_shared
+        REQUIRE(executor.plan().main_sequence_size() == 5);
+        options.fuse_elementwise = false;
+        Executor unfused_executor(context, {output, with_shared}, {}, options);
+        REQUIRE(unfused_executor.plan().main_sequence_size() == 10);
+        for (int i = 0; i < 2; ++i) {
+            auto results = executor.run();
+            auto expected = unfused_executor.run();
+            for (std::size_t k = 0; k < results.size(); ++k) {
+                std::vector<float> cpu_copy, expected_copy;
+                results[k]->fetch_data_into(cpu_copy);
+                expected[k]->fetch_data_into(expected_copy);
+                REQUIRE(approximately_equal(cpu_copy, expected_copy));
+            }
+        }
+        std::vector<float> cpu_copy;
+        executor.run()[1]->fetch_data_into(cpu_copy);
+        REQUIRE(approximately_equal(
+            cpu_copy, std::vector<float>({3, 4, 5, 3, 4, 5})));
+    }
+
+    SECTION("Values given for fused nodes don't undo the fusion") {
+        auto x = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        auto square = x * x;
+        auto output = F<Sqrt>(square + x);
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor executor(context, {output}, {}, options);
+        // x and the fused instruction calculating the output
+        REQUIRE(executor.plan().main_sequence_size() == 2);
+        auto square_value = context->device_pool()->make_array(
+            Shape({3}), ArrayType::float32);
+        square_value->write_from_vector(std::vector<float>({3, 7, 13}));
+        std::vector<float> cpu_copy;
+        for (int i = 0; i < 2; ++i) {
+            executor.run({{square, square_value}})[0]->fetch_data_into(
+                cpu_copy);
+            REQUIRE(approximately_equal(
+                cpu_copy, std::vector<float>({2, 3, 4})));
+            REQUIRE(executor.plan().main_sequence_size() == 2);
+            executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(approximately_equal(
+                cpu_copy, std::vector<float>(
+                    {std::sqrt(2.0f), std::sqrt(6.0f), std::sqrt(12.0f)})));
+            REQUIRE(executor.plan().main_sequence_size() == 2);
+        }
+    }
+
+    SECTION("Element-wise producers are fused into reductions") {
+        auto x = Constant::tensor<float>({1, 2, 3, 4, 5, 6}, Shape({2, 3}));
+        auto y = Constant::tensor<float>({1, 0, 2}, Shape({3}));
+        auto total = FU<ReduceSum>(x * y);
+        auto row_means = FU<ReduceMean>(FU<Square>(x - y),
+                                        std::vector<ShapeDim>({1}));
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor executor(context, {total, row_means}, {}, options);
+        // x, y and both reductions reading their inputs from prologues
+        REQUIRE(executor.plan().main_sequence_size() == 4);
+        options.fuse_elementwise = false;
+        Executor unfused_executor(context, {total, row_means}, {}, options);
+        REQUIRE(unfused_executor.plan().main_sequence_size() == 7);
+        for (int i = 0; i < 2; ++i) {
+            auto results = executor.run();
+            auto expected = unfused_executor.run();
+            for (std::size_t k = 0; k < results.size(); ++k) {
+                std::vector<float> cpu_copy, expected_copy;
+                results[k]->fetch_data_into(cpu_copy);
+                expected[k]->fetch_data_into(expected_copy);
+                REQUIRE(approximately_equal(cpu_copy, expected_copy));
+            }
+        }
+        std::vector<float> cpu_copy;
+        auto results = executor.run();
+        results[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({23}));
+        results[1]->fetch_data_into(cpu_copy);
+        REQUIRE(approximately_equal(
+            cpu_copy, std::vector<float>({5.0f / 3, 50.0f / 3})));
+    }
+
+    SECTION("Small independent operations are launched together") {
+        auto a = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        auto b = Constant::tensor<float>({4, 5}, Shape({2}));
+        auto product_a = F<ElemWiseMultiply>(a, a);
+        auto product_b = F<ElemWiseMultiply>(b, b);
+        auto var_a = Variable::make("var_a", {3}, ArrayType::float32);
+        auto var_b = Variable::make("var_b", {2}, ArrayType::float32);
+        context->init<float>(var_a, {10, 20, 30});
+        context->init<float>(var_b, {40, 50});
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor executor(context, {product_a, product_b},
+                          {F<UpdateSub>(var_a, a), F<UpdateSub>(var_b, b)},
+                          options);
+        // a, b, var_a, var_b, both products and both updates
+        // as two batches
+        REQUIRE(executor.plan().main_sequence_size() == 6);
+        for (int i = 1; i <= 2; ++i) {
+            auto results = executor.run();
+            std::vector<float> cpu_copy;
+            results[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({1, 4, 9}));
+            results[1]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({16, 25}));
+            context->eval(var_a)->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({
+                10.0f - i, 20.0f - 2 * i, 30.0f - 3 * i}));
+            context->eval(var_b)->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({
+                40.0f - 4 * i, 50.0f - 5 * i}));
+        }
+    }
+
+    SECTION("Batched updates don't hide the new values of variables") {
+        auto a = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        auto c = Constant::tensor<float>({2, 2, 2}, Shape({3}));
+        auto var_a = Variable::make("var_a", {3}, ArrayType::float32);
+        auto var_b = Variable::make("var_b", {3}, ArrayType::float32);
+        context->init<float>(var_a, {10, 20, 30});
+        context->init<float>(var_b, {40, 50, 60});
+        PlanOptions options;
+        options.fold_constants = false;
+        // The product reads var_a after its update, so the updates
+        // cannot wait for each other to be launched together
+        Executor executor(
+            context, {},
+            {F<UpdateSub>(var_a, a),
+             F<UpdateSub>(var_b, F<ElemWiseMultiply>(var_a, c))},
+            options);
+        // var_a, a, the first update, var_b, c, the product
+        // and the second update
+        REQUIRE(executor.plan().main_sequence_size() == 7);
+        executor.run();
+        std::vector<float> cpu_copy;
+        context->eval(var_a)->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({9, 18, 27}));
+        context->eval(var_b)->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({22, 14, 6}));
+    }
+
+    SECTION("Duplicate nodes are evaluated once") {
+        auto x = Variable::make("x", {3}, ArrayType::float32);
+        context->init<float>(x, {1, 2, 3});
+        auto output = ((x + Constant::ones_like(x))
+                       * (x + Constant::ones_like(x)));
+        PlanOptions options;
+        options.skip_passthrough_nodes = false;
+        options.fuse_elementwise = false;
+        Executor executor(context, {output}, {}, options);
+        // x, NoBackProp(x), ones_like(x), x + 1 and the product
+        REQUIRE(executor.plan().main_sequence_size() == 5);
+        options.merge_duplicates = false;
+        Executor unmerged_executor(context, {output}, {}, options);
+        REQUIRE(unmerged_executor.plan().main_sequence_size() == 8);
+        for (int i = 0; i < 2; ++i) {
+            std::vector<float> cpu_copy;
+            executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({4, 9, 16}));
+        }
+    }
+
+    SECTION("Nodes passing their inputs through are skipped") {
+        auto x = Variable::make("x", {3}, ArrayType::float32);
+        context->init<float>(x, {1, 2, 3});
+        auto output = (x * Constant::ones(Shape({3}), ArrayType::float32)
+                       + Constant::zeros(Shape({3}), ArrayType::float32));
+        Executor executor(context, {output});
+        // Both operations change nothing, so there's only x
+        REQUIRE(executor.plan().main_sequence_size() == 1);
+        PlanOptions options;
+        options.skip_passthrough_nodes = false;
+        options.fuse_elementwise = false;
+        Executor unsimplified_executor(context, {output}, {}, options);
+        REQUIRE(unsimplified_executor.plan().main_sequence_size() == 5);
+        for (int i = 0; i < 2; ++i) {
+            std::vector<float> cpu_copy;
+            executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({1, 2, 3}));
+            unsimplified_executor.run()[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({1, 2, 3}));
+        }
+    }
+
+    SECTION("Parts of the graph depending only on constants are folded") {
+        auto x = Variable::make("x", {3}, ArrayType::float32);
+        context->init<float>(x, {1, 2, 3});
+        auto counts = Constant::tensor<std::int32_t>({1, 2, 3}, Shape({3}));
+        auto weights = FU<Cast>(counts, ArrayType::float32) * 2.0f;
+        auto output = x * weights;
+        Executor executor(context, {output, weights});
+        // x, weights (now a constant itself) and output
+        REQUIRE(executor.plan().main_sequence_size() == 3);
+        PlanOptions options;
+        options.fold_constants = false;
+        Executor unfolded_executor(context, {output, weights}, {}, options);
+        REQUIRE(unfolded_executor.plan().main_sequence_size() == 6);
+        for (int i = 0; i < 2; ++i) {
+            auto results = executor.run();
+            std::vector<float> cpu_copy;
+            results[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({2, 8, 18}));
+            results[1]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({2, 4, 6}));
+        }
+        // Only the constant part is remembered
+        context->init<float>(x, {3, 3, 3});
+        std::vector<float> cpu_copy;
+        executor.run()[0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({6, 12, 18}));
+    }
+
+    SECTION("Frozen graphs keep the values the variables had") {
+        auto weights = Variable::make("weights", {3}, ArrayType::float32);
+        context->init<float>(weights, {1, 2, 3});
+        auto training = Placeholder::make("training", {}, ArrayType::int8);
+        auto x = Placeholder::make("x", {3}, ArrayType::float32);
+        auto output = Cond::make(training, x * weights + weights, x * weights);
+        auto squared = weights * weights;
+        auto training_value = context->device_pool()->make_array(
+            Shape(), ArrayType::int8);
+        training_value->write_from_vector(std::vector<std::int8_t>({0}));
+        auto frozen = freeze(context, {output, squared},
+                             {{training, training_value}});
+        // x, weights, x * weights and squared (folded), without the Cond
+        REQUIRE(frozen.plan().main_sequence_size() == 4);
+        context->init<float>(weights, {10, 20, 30});
+        auto x_value = context->device_pool()->make_array(
+            Shape({3}), ArrayType::float32);
+        x_value->write_from_vector(std::vector<float>({1, 1, 1}));
+        for (int i = 0; i < 2; ++i) {
+            auto results = frozen.run({{x, x_value}});
+            std::vector<float> cpu_copy;
+            results[0]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({1, 2, 3}));
+            results[1]->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({1, 4, 9}));
+        }
+    }
+}
+
+
+TEST_CASE("Compiling programs in advance") {
+    auto context = Context::make_for_device(0);
+    auto x = Variable::make("x", {3}, ArrayType::float32);
+    context->init<float>(x, {1, 2, 3});
+    auto output = FU<ReduceSum>(x * x + x);
+
+    const auto &device = context->device_pool()->cl_device();
+    ProgramSourceList programs;
+    output->collect_programs(device, programs);
+    REQUIRE(programs.size() == 1);
+    REQUIRE(programs[0].name == "reductions");
+    // Terminal nodes don't compile anything
+    x->collect_programs(device, programs);
+    REQUIRE(programs.size() == 1);
+
+    Executor executor(context, {output});
+    REQUIRE_NOTHROW(executor.warm_up(2));
+    auto results = executor.run();
+    std::vector<float> cpu_copy;
+    results[0]->fetch_data_into(cpu_copy);
+    REQUIRE(cpu_copy == std::vector<float>({20}));
+}
+
+TEST_CASE("Data-parallel execution") {
+    // Replicas may share the same device, they still have separate variables
+    std::vector<ContextRef> contexts({Context::make_for_device(0),
+                                      Context::make_for_device(0)});
+    auto batch = Placeholder::make("batch", {-1}, ArrayType::float32);
+    auto weight = Variable::make("weight", {}, ArrayType::float32);
+    contexts[0]->init<float>(weight, {10});
+    auto batch_mean = FU<ReduceMean>(batch);
+    auto update = F<UpdateSub>(weight, batch_mean);
+    DataParallelExecutor executor(contexts, {batch_mean}, {update});
+    auto batch_value = contexts[0]->device_pool()->make_array(
+        Shape({4}), ArrayType::float32);
+    batch_value->write_from_vector(std::vector<float>({1, 2, 3, 4}));
+
+    auto results = executor.run({{batch, batch_value}});
+    REQUIRE(results.size() == 2);
+    std::vector<float> cpu_copy;
+    results[0][0]->fetch_data_into(cpu_copy);
+    REQUIRE(cpu_copy == std::vector<float>({1.5}));
+    results[1][0]->fetch_data_into(cpu_copy);
+    REQUIRE(cpu_copy == std::vector<float>({3.5}));
+    // Both replicas subtract the mean of the whole batch
+    for (auto &context: contexts) {
+        context->eval(weight)->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({7.5}));
+    }
+    // Each replica needs at least one row of the batch
+    auto tiny_batch = contexts[0]->device_pool()->make_array(
+        Shape({1}), ArrayType::float32);
+    REQUIRE_THROWS_AS(executor.run({{batch, tiny_batch}}),
+                      std::invalid_argument);
+}
+
+TEST_CASE("Data-parallel execution with non-batch inputs") {
+    std::vector<ContextRef> contexts({Context::make_for_device(0),
+                                      Context::make_for_device(0)});
+    auto batch = Placeholder::make("batch", {-1}, ArrayType::float32);
+    auto rate = Placeholder::make("rate", {}, ArrayType::float32);
+    auto weight = Variable::make("weight", {}, ArrayType::float32);
+    contexts[0]->init<float>(weight, {10});
+    auto batch_mean = FU<ReduceMean>(batch);
+    auto update = F<UpdateSub>(weight, batch_mean * rate);
+    auto batch_value = contexts[0]->device_pool()->make_array(
+        Shape({4}), ArrayType::float32);
+    batch_value->write_from_vector(std::vector<float>({1, 2, 3, 4}));
+    auto rate_value = contexts[0]->device_pool()->make_array(
+        Shape(), ArrayType::float32);
+    rate_value->write_from_vector(std::vector<float>({2}));
+    std::vector<float> cpu_copy;
+
+    SECTION("The batch is recognized by its first dimension") {
+        DataParallelExecutor executor(contexts, {batch_mean * rate},
+                                      {update});
+        auto results = executor.run({{batch, batch_value},
+                                     {rate, rate_value}});
+        // The scalar goes to both replicas unchanged
+        results[0][0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({3}));
+        results[1][0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({7}));
+        for (auto &context: contexts) {
+            context->eval(weight)->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({5}));
+        }
+    }
+
+    SECTION("Batch inputs given explicitly") {
+        auto mask = Placeholder::make("mask", {-1}, ArrayType::float32);
+        auto mask_value = contexts[0]->device_pool()->make_array(
+            Shape({4}), ArrayType::float32);
+        mask_value->write_from_vector(std::vector<float>({1, 1, 0, 0}));
+        // The mask is as long as the batch, but isn't a part of it
+        auto masked_sum = FU<ReduceSum>(mask) + batch_mean;
+        DataParallelExecutor executor(contexts, {masked_sum}, {update},
+                                      {batch});
+        auto results = executor.run({{batch, batch_value},
+                                     {mask, mask_value},
+                                     {rate, rate_value}});
+        results[0][0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({3.5}));
+        results[1][0]->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({5.5}));
+    }
+}
+
+
+TEST_CASE("Device placement") {
+    auto context = Context::make_for_device(0);
+    auto num_devices = CLMemoryManager::get_default()->num_devices();
+    // With only one device available everything stays on it,
+    // but the nodes still have to work
+    DeviceIndex other_device = num_devices - 1;
+    std::vector<float> cpu_copy;
+
+    SECTION("Transfer nodes move values between devices") {
+        auto x = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        auto moved = Transfer::make(x * x, other_device);
+        auto doubled = moved + moved;
+        auto moved_back = Transfer::make(doubled, 0);
+        Executor executor(context, {doubled, moved_back});
+        auto results = executor.run();
+        REQUIRE(results[0]->buffer_unsafe()->device_index() == other_device);
+        REQUIRE(results[1]->buffer_unsafe()->device_index() == 0);
+        for (const auto &result: results) {
+            result->fetch_data_into(cpu_copy);
+            REQUIRE(cpu_copy == std::vector<float>({2, 8, 18}));
+        }
+    }
+
+    SECTION("Placed nodes get their inputs from other devices") {
+        auto x = Constant::tensor<float>({1, 2, 3}, Shape({3}));
+        x->place_on_device(other_device);
+        auto y = Constant::tensor<float>({4, 5, 6}, Shape({3}));
+        auto output = x + y;
+        output->place_on_device(0);
+        Executor executor(context, {output});
+        auto result = executor.run()[0];
+        REQUIRE(result->buffer_unsafe()->device_index() == 0);
+        result->fetch_data_into(cpu_copy);
+        REQUIRE(cpu_copy == std::vector<float>({5, 7, 9}));
+        REQUIRE(context->eval(x)->buffer_unsafe()->device_index()
+                == other_device);
+    }
+
+    REQUIRE_THROWS_AS(context->device_pool(num_devices),
+                      std::invalid_argument);
+}
+